@@ -0,0 +1,319 @@
+#define WE_ALLOC_HOOKS // count heap allocations (this is the only translation unit)
+#include "wineng.hpp"
+
+// Benchmarks.
+//  1. Lighting: serial vs parallel LightMap::build (full relight) at 1/16/128/1024 lights.
+//  2. Scenarios on a headless App (no window, fixed 1/60 s frames): ns/frame per profiler
+//     zone plus a framebuffer hash. Each scenario runs on the fast path (detected SIMD,
+//     workers, tiled rasterizer) and on the reference path (scalar kernels, no workers,
+//     immediate drawing); the hashes must match. Scenarios that stream no new chunks must
+//     also run without heap allocations once warmed up.
+// Build: g++ bench.cpp -O2 -std=c++17 -lgdi32 -luser32 -lole32 -luuid -lwindowscodecs -o bench.exe
+// Usage: bench.exe [frames per scenario, default 120]
+
+using namespace we;
+
+static double now_ms(){
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (double)t.QuadPart*1000.0/(double)f.QuadPart;
+}
+
+static void bench_lighting(){
+    JobSystem jobs;
+    jobs.init(std::max((int)std::thread::hardware_concurrency()-1, 0));
+
+    World world;
+    world.tile_px = 32;
+    Camera2D cam;
+    cam.viewport = V2(1920, 1080);
+    cam.pos = V2(0, 300);
+
+    // load everything the lights can reach (build never generates)
+    for(int cy=-4; cy<=5; cy++)
+        for(int cx=-4; cx<=4; cx++)
+            world.get_chunk(cx, cy);
+
+    std::printf("threads: %d\n", jobs.size());
+    std::printf("%8s %12s %12s %8s %s\n", "lights", "serial ms", "parallel ms", "speedup", "identical");
+
+    const int counts[] = { 1, 16, 128, 1024 };
+    for(int n: counts){
+        u32 rng = 1234567u + (u32)n;
+        auto rnd = [&](int m){ rng = rng*1664525u + 1013904223u; return (int)((rng>>8) % (u32)m); };
+
+        std::vector<LightSource> lights((size_t)n);
+        for(auto& l: lights){
+            l.pos_px = V2((f32)(rnd(2200)-1100), (f32)(rnd(1300)-350));
+            l.radius_tiles = 8 + rnd(16);
+            l.intensity = (u8)(160 + rnd(96));
+        }
+
+        LightMap serial, par;
+        serial.ambient = par.ambient = 35;
+        int iters = n>=128 ? 20 : 200;
+
+        double t0 = now_ms();
+        for(int i=0;i<iters;i++){ serial.invalidate(); serial.build(world, cam, lights); }
+        double t1 = now_ms();
+        for(int i=0;i<iters;i++){ par.invalidate(); par.build(world, cam, lights, &jobs); }
+        double t2 = now_ms();
+
+        double ms_s = (t1-t0)/iters, ms_p = (t2-t1)/iters;
+        bool same = serial.L == par.L;
+        std::printf("%8d %12.3f %12.3f %7.2fx %s\n", n, ms_s, ms_p, ms_p>0 ? ms_s/ms_p : 0.0, same ? "yes" : "NO");
+    }
+
+    jobs.shutdown();
+}
+
+// ============================================================
+// Scenarios
+// ============================================================
+static constexpr int WARMUP=60; // long enough for particle counts and arenas to level off
+
+// Everything a scenario touches; rebuilt for every run so both paths start identical.
+struct Scene {
+    App& app;
+    u32 rng=0x9E3779B9u;
+
+    Image sheet, sprite;   // synthetic 4x4 tile sheet and a 16x16 sprite
+    World world;
+    Camera2D cam;
+    LightMap lightmap;
+    std::vector<LightSource> lights;
+    Particles particles;
+    ECS ecs;
+    SpatialHash hash;
+    TiledRasterizer raster;
+
+    bool do_sprites=false, do_particles=false, do_lights=false;
+
+    explicit Scene(App& a, bool fast) : app(a) {
+        sheet.w=sheet.h=64;
+        sheet.px.resize(64*64);
+        for(int y=0;y<64;y++)
+            for(int x=0;x<64;x++){
+                int id=(y/16)*4+(x/16), u=x&15, v=y&15;
+                u8 a_=(u8)((u^v)&1 ? 255 : 200);
+                sheet.px[(size_t)(y*64+x)]=RGBA((u8)(40+id*13+u*4), (u8)(60+id*7+v*5), (u8)(90+((u*v)&63)), a_);
+            }
+        premultiply(sheet);
+        build_mips(sheet, 4);
+
+        sprite.w=sprite.h=16;
+        sprite.px.resize(16*16);
+        for(int y=0;y<16;y++)
+            for(int x=0;x<16;x++){
+                int dx=x-8, dy=y-8;
+                u8 a_=(u8)(dx*dx+dy*dy<=49 ? 255 : dx*dx+dy*dy<=64 ? 128 : 0);
+                sprite.px[(size_t)(y*16+x)]=RGBA((u8)(120+x*8), (u8)(200-y*6), 80, a_);
+            }
+
+        world.ts = make_tileset(&sheet, 16, 16);
+        world.tile_px = 32;
+        world.bilinear = true;
+        world.blend = true;
+        world.stream_max_inflight = 1<<20; // no cap: the same chunks load with or without workers
+
+        cam.viewport = V2((f32)app.fb.w, (f32)app.fb.h);
+        cam.pos = V2(0, 300);
+        lightmap.ambient = 35;
+        raster.deferred = fast;
+    }
+
+    int rnd(int m){ rng = rng*1664525u + 1013904223u; return (int)((rng>>8) % (u32)m); }
+
+    // Generate what the camera needs, then wait for it (results must not depend on timing).
+    void stream(){
+        world.stream(cam, app.jobs);
+        WE_ZONE("World::wait_stream");
+        world.wait_stream();
+    }
+
+    void render(){
+        if(do_sprites) hash.build(ecs, world.tile_px);
+        if(do_lights) lightmap.build(world, cam, lights, &app.jobs);
+
+        raster.begin(app.fb);
+        app.fb.clear(RGBA(14,15,18,255));
+        sys_render_world(app.fb, world, cam);
+        if(do_sprites) sys_render_sprites(app.fb, ecs, cam, &hash, 1.0f);
+        if(do_particles) particles.draw(app.fb, cam);
+        if(do_lights) lightmap.draw_darkness_overlay(app.fb, world, cam);
+        raster.end(app.fb, app.jobs);
+    }
+};
+
+struct Scenario {
+    const char* name;
+    void (*setup)(Scene&);
+    void (*frame)(Scene&, int);
+    bool steady;            // no chunk generation: expect zero heap allocations per frame
+};
+
+// Steady scenarios sway the camera with the warm-up period, so every chunk surface they
+// show is built before measuring starts.
+static f32 sway(int f){ return std::sin((f32)f*6.2831853f/(f32)WARMUP); }
+
+static void terrain_setup(Scene& s, f32 zoom){ s.cam.zoom = zoom; s.stream(); }
+static void terrain_frame(Scene& s, int f){
+    s.cam.pos.x = 120.0f / s.cam.zoom * sway(f);
+    s.stream();
+    s.render();
+}
+
+static void particles_setup(Scene& s){
+    s.stream();
+    s.particles.init(10000, 0x123456u, ParticleOverflow::Drop);
+    s.particles.collide = true;
+    s.do_particles = true;
+}
+static void particles_frame(Scene& s, int){
+    for(int i=0;i<4;i++){
+        v2 at = V2((f32)(s.rnd(1200)-600), (f32)(s.rnd(500)+100));
+        s.particles.emit_burst(at, 100, 120, 700, 0.5f, 1.5f, 2, 7, RGBA(255,180,80,230), RGBA(255,40,40,0));
+    }
+    while(s.app.sim_step()) s.particles.update(s.app.sim_dt, &s.world, &s.app.jobs);
+    s.render();
+}
+
+static void lights_setup(Scene& s){
+    s.stream();
+    s.lights.resize(256);
+    for(auto& l: s.lights){
+        l.pos_px = V2((f32)(s.rnd(1400)-700), (f32)(s.rnd(800)-100));
+        l.radius_tiles = 6 + s.rnd(12);
+        l.intensity = (u8)(160 + s.rnd(96));
+    }
+    s.do_lights = true;
+}
+static void lights_frame(Scene& s, int f){
+    for(int i=0;i<16;i++){ // a few movers per frame: incremental relight
+        LightSource& l = s.lights[(size_t)((f*16+i) % (int)s.lights.size())];
+        l.pos_px.x += (f32)(s.rnd(33)-16);
+        l.pos_px.y += (f32)(s.rnd(33)-16);
+    }
+    s.render();
+}
+
+static void sprites_setup(Scene& s){
+    s.stream();
+    for(int i=0;i<5000;i++){
+        Entity e = s.ecs.reg.create();
+        f32 sc = 1.0f + (f32)s.rnd(3);
+        s.ecs.tr.add(e, CTransform{ V2((f32)(s.rnd(2400)-1200), (f32)(s.rnd(1400)-400)), 0.0f, V2(sc,sc) });
+        CSprite sp;
+        sp.img = &s.sprite; sp.sw = 16; sp.sh = 16;
+        sp.bilinear = (i&1)!=0;
+        sp.tint = RGBA(255, (u8)(128+s.rnd(128)), 255, 255);
+        s.ecs.spr.add(e, sp);
+    }
+    s.do_sprites = true;
+}
+static void sprites_frame(Scene& s, int f){
+    s.cam.pos.x = 200.0f*sway(f);
+    s.render();
+}
+
+static void pan_setup(Scene& s){ s.cam.zoom = 0.5f; s.stream(); }
+static void pan_frame(Scene& s, int){
+    s.cam.pos = add(s.cam.pos, V2(160, 40)); // ~ one chunk column every 6 frames
+    s.stream();
+    s.render();
+}
+
+static const Scenario scenarios[] = {
+    { "terrain zoom 0.35",  [](Scene& s){ terrain_setup(s, 0.35f); }, terrain_frame, true },
+    { "terrain zoom 1",     [](Scene& s){ terrain_setup(s, 1.0f);  }, terrain_frame, true },
+    { "terrain zoom 2.5",   [](Scene& s){ terrain_setup(s, 2.5f);  }, terrain_frame, true },
+    { "10k particles",      particles_setup, particles_frame, true },
+    { "256 lights",         lights_setup,    lights_frame,    true },
+    { "5k sprites",         sprites_setup,   sprites_frame,   true },
+    { "pan + streaming",    pan_setup,       pan_frame,       false },
+};
+
+struct RunResult {
+    u64 hash=0;
+    u64 max_allocs=0;       // most heap allocations in one measured frame
+    std::vector<ProfStats> zones;
+    bool ok=false;
+
+    f32 avg_ns(const char* name) const {
+        for(const ProfStats& z: zones) if(std::strcmp(z.name,name)==0) return z.avg_ms*1e6f;
+        return 0;
+    }
+};
+
+
+static RunResult run_scenario(const Scenario& sc, bool fast, int frames){
+    RunResult r;
+    AppConfig cfg;
+    cfg.w = 1280; cfg.h = 720;
+    cfg.present = PresentBackend::Headless;
+    cfg.buffers = 1;            // fb keeps the last frame after frame_end
+    cfg.fixed_dt = 1.0/60.0;
+    cfg.worker_threads = fast ? -1 : 0;
+
+    App app;
+    if(!app.init(cfg)) return r;
+    span_set_level(fast ? SimdLevel::AVX2 : SimdLevel::Scalar);
+
+    {
+        Scene s(app, fast);
+        sc.setup(s);
+        // hash every 16th frame and the last (the hash itself stays out of the zones)
+        u64 h = 0;
+        for(int f=0; f<WARMUP+frames && app.frame_begin(); f++){
+            if(f==WARMUP) profiler().reset();
+            sc.frame(s, f);
+            if(f>=WARMUP && ((f-WARMUP)%16==0 || f==WARMUP+frames-1)) h = h*1099511628211ull ^ canvas_hash(app.fb);
+            app.frame_end();
+        }
+        profiler().frame_mark(); // close the last frame
+        r.hash = h;
+        r.max_allocs = profiler().max_allocs();
+        profiler().all_stats(r.zones);
+        r.ok = true;
+    }
+    app.shutdown();
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = argc>1 ? std::max(std::atoi(argv[1]), 1) : 120;
+
+    bench_lighting();
+
+    SimdLevel best = simd_detect();
+    std::printf("\nscenarios: %d frames each (+%d warm-up), 1280x720, %s + %d threads vs scalar + 1 thread\n",
+                frames, WARMUP, simd_level_name(best), (int)std::thread::hardware_concurrency());
+
+    int failed = 0;
+    for(const Scenario& sc: scenarios){
+        RunResult fast = run_scenario(sc, true, frames);
+        RunResult ref  = run_scenario(sc, false, frames);
+        if(!fast.ok || !ref.ok){ std::printf("%s: headless init failed\n", sc.name); return 1; }
+
+        bool same = fast.hash == ref.hash;
+        bool no_allocs = !sc.steady || (fast.max_allocs==0 && ref.max_allocs==0);
+        if(!same || !no_allocs) failed++;
+        std::printf("\n== %s ==  hash %016llx  ref %016llx  %s\n", sc.name,
+                    (unsigned long long)fast.hash, (unsigned long long)ref.hash, same ? "identical" : "MISMATCH");
+        std::printf("  heap allocs/frame (max): %llu, ref %llu%s\n", (unsigned long long)fast.max_allocs,
+                    (unsigned long long)ref.max_allocs, no_allocs ? "" : "  EXPECTED 0");
+        std::printf("  %-32s %14s %14s\n", "zone", "ns/frame", "ref ns/frame");
+        for(const ProfStats& z: fast.zones){
+            f32 a = z.avg_ms*1e6f, b = ref.avg_ns(z.name);
+            if(a<=0 && b<=0) continue; // not used by this scenario
+            std::printf("  %-32s %14.0f %14.0f\n", z.name, a, b);
+        }
+    }
+
+    span_set_level(best);
+    std::printf("\n%s\n", failed ? "FAILED: framebuffer hashes differ or steady frames allocate"
+                                   : "all framebuffer hashes identical, steady frames allocation-free");
+    return failed ? 1 : 0;
+}
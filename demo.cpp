@@ -1,9 +1,18 @@
+#define WE_ALLOC_HOOKS // heap allocations per frame in the profiler overlay
 #include "wineng.hpp"
 
-int main()
+int main(int argc, char** argv)
 {
     using namespace we;
 
+    // demo.exe --record input.wein | --replay input.wein
+    const char* record_path = nullptr;
+    const char* replay_path = nullptr;
+    for(int i=1;i+1<argc;i++){
+        if(!std::strcmp(argv[i],"--record")) record_path = argv[++i];
+        else if(!std::strcmp(argv[i],"--replay")) replay_path = argv[++i];
+    }
+
     App app;
     AppConfig cfg;
     cfg.w = 1200;
@@ -13,13 +22,34 @@ int main()
 
     if(!app.init(cfg)) return 1;
 
-    // -------- Assets (optional) --------
-    Image tiles_png;
-    bool have_tiles = app.wic.load(tiles_png, "tiles.png"); // optional
-    Tileset tileset = make_tileset(have_tiles ? &tiles_png : nullptr, 16, 16);
+    InputLog input_log;
+    if(replay_path){
+        if(!load_input_log(replay_path, input_log)) return 1;
+        app.replaying = &input_log;
+    }else if(record_path){
+        app.recording = &input_log;
+    }
 
-    Image player_png;
-    bool have_player = app.wic.load(player_png, "player.png"); // optional
+    // -------- Assets (optional; decoded in parallel, baked into assets.wtc for next time) --------
+    AssetManager assets;
+    assets.init(app.jobs, "assets.wtc");
+    auto tiles_png  = assets.load("tiles.png");
+    auto player_png = assets.load("player.png");
+    assets.wait_all();
+    if(assets.decodes > 0) assets.save_cache();
+
+    // one premultiplied atlas with mips: 16-aligned rects keep 4 levels inside each 16x16 tile
+    AtlasBuilder packer;
+    packer.align = 16;
+    int tiles_rect  = packer.add(tiles_png->image());
+    int player_rect = packer.add(player_png->image());
+    Atlas atlas;
+    packer.build(atlas);
+    premultiply(atlas.img);
+    build_mips(atlas.img, 4);
+
+    Tileset tileset = make_tileset(atlas, tiles_rect, 16, 16);
+    bool have_player = atlas.rect(player_rect).w > 0;
 
     // -------- World --------
     World world;
@@ -27,6 +57,9 @@ int main()
     world.tile_px = 32;
     world.bilinear = true;
     world.blend = true;
+    // Recording and replay both start from the generated world: saved edits would diverge.
+    bool deterministic = replay_path || record_path;
+    if(!deterministic) world.open("world"); // edits persist in ./world (region files)
 
     // give the player a flat spawn platform near origin
     for(int x=-15;x<=15;x++){
@@ -46,9 +79,7 @@ int main()
 
     // Sprite (optional)
     if(have_player){
-        CSprite sp;
-        sp.img = &player_png;
-        sp.sx = 0; sp.sy = 0; sp.sw = player_png.w; sp.sh = player_png.h;
+        CSprite sp = make_sprite(atlas, player_rect);
         sp.bilinear = true;
         sp.blend = true;
         sp.tint = RGBA(255,255,255,255);
@@ -58,7 +89,7 @@ int main()
     // Torch light entity (follows player)
     Entity torch = ecs.reg.create();
     ecs.tr.add(torch, CTransform{ V2(0,0), 0.0f, V2(1,1) });
-    ecs.light.add(torch, CLight{ 12, 255 });
+    ecs.light.add(torch, CLight{ 21, 255 }); // 255 - 12/tile fades out at ~21 tiles
 
     // -------- Camera --------
     Camera2D cam;
@@ -74,26 +105,50 @@ int main()
 
     // -------- Particles --------
     Particles particles;
-    particles.init(8000, 0x123456u);
+    particles.init(8000, 0x123456u, ParticleOverflow::ReplaceOldest);
+    particles.collide = true; // debris bounces off terrain
+
+    // -------- Systems (scheduled on the job system by their read/write sets) --------
+    // Fixed-step sim (AppConfig::sim_hz): systems see app.sim_in / app.sim_dt.
+    Scheduler sched;
+    schedule_snapshot(sched, ecs);
+    schedule_player(sched, ecs, app.sim_in, app.sim_dt);
+    schedule_physics(sched, ecs, world, app.sim_dt);
+    sched.add("torch", RES_TRANSFORM, RES_TRANSFORM, [&]{ // torch follows player
+        if(auto* pt=ecs.tr.get(player)){
+            if(auto* tt=ecs.tr.get(torch)){
+                tt->pos = add(pt->pos, V2(0,-20));
+            }
+        }
+    });
+
+    SpatialHash hash; // view culling for sprites and lights, rebuilt per rendered frame
+
+    // Per rendered frame: rebuild the hash, then gather the lights it culls to the view
+    Scheduler frame_sched;
+    schedule_spatial_hash(frame_sched, hash, ecs, world);
+    schedule_gather_lights(frame_sched, ecs, lights, hash, cam, world);
+
+    // -------- Renderer --------
+    TiledRasterizer raster;
+    raster.deferred = true;
 
     // -------- UI --------
     UI ui;
-    int wx=20, wy=20, ww=360, wh=340;
+    int wx=20, wy=20, ww=360, wh=420;
     bool wopen=true;
 
     bool show_grid=true;
     bool show_debug=true;
 
+    // -------- Profiler overlay (zones are always collected; see profiler()) --------
+    ProfOverlay prof;
+    prof.open = false;
+
     while(app.frame_begin())
     {
         cam.viewport = V2((f32)app.fb.w, (f32)app.fb.h);
 
-        // Follow camera towards player smoothly (nice feel)
-        if(auto* t = ecs.tr.get(player)){
-            cam.pos.x = lerp(cam.pos.x, t->pos.x, 1.0f - std::exp(-6.0f*app.dt));
-            cam.pos.y = lerp(cam.pos.y, t->pos.y, 1.0f - std::exp(-6.0f*app.dt));
-        }
-
         // Zoom wheel (stable, correct)
         if(app.in.wheel != 0){
             f32 steps = (f32)app.in.wheel / 120.0f;
@@ -101,6 +156,12 @@ int main()
             cam.zoom = clampf(cam.zoom, 0.35f, 4.0f);
         }
 
+        // Record/replay: chunks must be resident before input and sim touch them (as in bench.cpp)
+        if(deterministic){
+            world.stream(cam, app.jobs);
+            world.wait_stream();
+        }
+
         // Dig/place
         v2 mw = cam.screen_to_world(app.in.mouse_x, app.in.mouse_y);
         int tx = (int)std::floor(mw.x / (f32)world.tile_px);
@@ -123,25 +184,29 @@ int main()
             }
         }
 
-        // Update systems
-        sys_player(ecs, app.in, app.dt);
-        sys_physics(ecs, world, app.dt);
+        // Fixed-step simulation (snapshot, player, gravity, physics, torch; particles)
+        while(app.sim_step()){
+            sched.run(app.jobs);
+            particles.update(app.sim_dt, &world, &app.jobs);
+        }
 
-        // Torch follows player
-        if(auto* pt=ecs.tr.get(player)){
-            if(auto* tt=ecs.tr.get(torch)){
-                tt->pos = add(pt->pos, V2(0,-20));
-            }
+        // Follow camera towards the interpolated player smoothly (nice feel)
+        if(auto* t = ecs.tr.get(player)){
+            v2 p = interp_pos(*t, app.alpha);
+            cam.pos.x = lerp(cam.pos.x, p.x, 1.0f - std::exp(-6.0f*app.dt));
+            cam.pos.y = lerp(cam.pos.y, p.y, 1.0f - std::exp(-6.0f*app.dt));
         }
 
-        // Lighting build
-        gather_lights(ecs, lights);
-        lightmap.build(world, cam, lights);
+        // Background chunk generation around the camera
+        world.stream(cam, app.jobs);
 
-        // Particles update
-        particles.update(app.dt);
+        // Lighting build (lights culled to the view through the hash)
+        frame_sched.run(app.jobs);
+        gather_tile_lights(world, cam, lights); // emitting tiles (TileDef::emit / META layer)
+        lightmap.build(world, cam, lights, &app.jobs);
 
-        // Render
+        // Render (world/sprites/particles/lighting go through the tiled rasterizer)
+        raster.begin(app.fb);
         app.fb.clear(RGBA(14,15,18,255));
 
         // world
@@ -157,7 +222,7 @@ int main()
         }
 
         // entities (sprites)
-        sys_render_sprites(app.fb, ecs, cam);
+        sys_render_sprites(app.fb, ecs, cam, &hash, app.alpha);
 
         // particles
         particles.draw(app.fb, cam);
@@ -165,6 +230,8 @@ int main()
         // darkness overlay (affects everything)
         lightmap.draw_darkness_overlay(app.fb, world, cam);
 
+        raster.end(app.fb, app.jobs);
+
         // HUD
         if(show_debug){
             char buf[256];
@@ -189,6 +256,7 @@ int main()
             ui.label("Rendering / Debug");
             ui.checkbox("Show Debug HUD", show_debug);
             ui.checkbox("Show Tile Highlight", show_grid);
+            ui.checkbox("Tiled Renderer (MT)", raster.deferred);
 
             ui.label("Lighting");
             lightmap.ambient = (u8)ui.sliderf("Ambient", (f32)lightmap.ambient, 0, 120);
@@ -201,14 +269,22 @@ int main()
                 particles.emit_burst(at, 240, 140, 900, 0.30f, 1.10f, 2, 9,
                                      RGBA(255,180,80,230), RGBA(255,40,40,0));
             }
+            if(ui.button("Save World")) world.save_all(app.jobs);
+
+            ui.checkbox("Profiler", prof.open);
+            if(ui.button("Save Trace")) save_chrome_trace("trace.json");
 
             ui.window_end();
         }
+        prof.draw(ui);
         ui.end();
 
         app.frame_end();
     }
 
+    if(record_path) save_input_log(record_path, input_log);
+
+    assets.shutdown();
     app.shutdown();
     return 0;
 }
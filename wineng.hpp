@@ -3,16 +3,22 @@
 //
 // Build (MinGW g++):
 //   g++ main.cpp -O2 -std=c++17 -Wall -Wextra -lgdi32 -luser32 -lole32 -luuid -lwindowscodecs
+//   (-DWE_ENABLE_DXGI -ld3d11 -ldxgi for the DXGI present backend)
 //
 // Notes:
 // - Uses Win32 for window/input only.
 // - Software backbuffer rendering (manual pixels).
+// - Optional deferred mode: Canvas records a DrawList that TiledRasterizer replays per 64x64 tile on worker threads.
 // - Image loading uses WIC (built-in Windows codecs): png/jpg/bmp/...
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <objbase.h>
 #include <wincodec.h>
+#if defined(WE_ENABLE_DXGI)    // DXGI flip-model present backend (link -ld3d11 -ldxgi)
+  #include <d3d11.h>
+  #include <dxgi1_3.h>
+#endif
 #include <stdint.h>
 #include <stdbool.h>
 #include <wchar.h>
@@ -21,11 +27,37 @@
 #include <array>
 #include <string>
 #include <unordered_map>
+#include <memory>
 #include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cwchar>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <type_traits>
+#include <functional>
+#include <deque>
+#include <new>
+#include <cstddef>
+
+// SIMD span kernels: SSE2 baseline on x86/x64, AVX2 picked at runtime. Define WE_NO_SIMD for scalar only.
+#if !defined(WE_NO_SIMD) && (defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP>=2) || defined(__SSE2__))
+  #define WE_SIMD_X86 1
+  #include <emmintrin.h>
+  #include <immintrin.h>
+  #if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+    #define WE_TARGET_AVX2
+  #else
+    #define WE_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#else
+  #define WE_SIMD_X86 0
+#endif
 
 #ifndef WE_ASSERT
 #define WE_ASSERT(x) do { if(!(x)) { *(volatile int*)0=0; } } while(0)
@@ -40,6 +72,8 @@ using u8  = uint8_t;
 using u16 = uint16_t;
 using u32 = uint32_t;
 using i32 = int32_t;
+using u64 = uint64_t;
+using i64 = int64_t;
 using f32 = float;
 
 // ============================================================
@@ -62,6 +96,373 @@ static inline u32 blend_over(u32 dst, u32 src){
     return RGBA(rr,gg,bb,255);
 }
 
+// src is premultiplied (rgb already scaled by alpha): one multiply per channel.
+// An all-zero src leaves dst untouched; alpha 0 with rgb set adds (glow).
+static inline u32 blend_over_pm(u32 dst, u32 src){
+    u32 sa=A(src);
+    if(sa==255) return src;
+    if(src==0) return dst;
+    u32 inv=255u-sa;
+    u32 rr=std::min(R(src) + (R(dst)*inv)/255u, 255u);
+    u32 gg=std::min(G(src) + (G(dst)*inv)/255u, 255u);
+    u32 bb=std::min(B(src) + (B(dst)*inv)/255u, 255u);
+    return RGBA(rr,gg,bb,255);
+}
+
+// ============================================================
+// Span kernels (scalar + SSE2/AVX2, runtime dispatch)
+// ============================================================
+// SIMD paths are bit-exact with blend_over: for x<=65025, x/255 == ((x+1)*257)>>16.
+static inline void span_fill_scalar(u32* d,int n,u32 c){
+    for(int i=0;i<n;i++) d[i]=c;
+}
+static inline void span_blend_solid_scalar(u32* d,int n,u32 c){
+    for(int i=0;i<n;i++) d[i]=blend_over(d[i],c);
+}
+static inline void span_blend_scalar(u32* d,const u32* s,int n){
+    for(int i=0;i<n;i++) d[i]=blend_over(d[i],s[i]);
+}
+static inline void span_blend_pm_scalar(u32* d,const u32* s,int n){
+    for(int i=0;i<n;i++) d[i]=blend_over_pm(d[i],s[i]);
+}
+
+// d.rgb = d.rgb*m/255 (truncated like blend_over with black at alpha 255-m), alpha forced to 255
+static inline void span_mul_scalar(u32* d,const u8* m,int n){
+    for(int i=0;i<n;i++){
+        u32 c=d[i], k=m[i];
+        d[i]=RGBA(R(c)*k/255u, G(c)*k/255u, B(c)*k/255u, 255);
+    }
+}
+
+#if WE_SIMD_X86
+static inline void span_fill_sse2(u32* d,int n,u32 c){
+    __m128i v=_mm_set1_epi32((int)c);
+    int i=0;
+    for(; i+4<=n; i+=4) _mm_storeu_si128((__m128i*)(d+i), v);
+    for(; i<n; i++) d[i]=c;
+}
+
+// one 16-bit lane per channel: out = (s*sa + d*(255-sa) + 1)*257 >> 16, alpha forced to 255
+static inline __m128i blend4_const_sse2(__m128i p,__m128i S1,__m128i I){
+    const __m128i z=_mm_setzero_si128(), M=_mm_set1_epi16(257);
+    __m128i lo=_mm_unpacklo_epi8(p,z), hi=_mm_unpackhi_epi8(p,z);
+    lo=_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(lo,I),S1),M);
+    hi=_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(hi,I),S1),M);
+    return _mm_or_si128(_mm_packus_epi16(lo,hi), _mm_set1_epi32((int)0xFF000000u));
+}
+
+static inline void span_blend_solid_sse2(u32* d,int n,u32 c){
+    u32 sa=A(c);
+    if(sa==255){ span_fill_sse2(d,n,c); return; }
+    if(sa==0) return;
+    u32 inv=255u-sa;
+    short sb=(short)(B(c)*sa+1), sg=(short)(G(c)*sa+1), sr=(short)(R(c)*sa+1);
+    __m128i S1=_mm_setr_epi16(sb,sg,sr,0, sb,sg,sr,0);
+    __m128i I=_mm_set1_epi16((short)inv);
+    int i=0;
+    for(; i+4<=n; i+=4){
+        __m128i p=_mm_loadu_si128((const __m128i*)(d+i));
+        _mm_storeu_si128((__m128i*)(d+i), blend4_const_sse2(p,S1,I));
+    }
+    for(; i<n; i++) d[i]=blend_over(d[i],c);
+}
+
+static inline void span_blend_sse2(u32* d,const u32* s,int n){
+    const __m128i z=_mm_setzero_si128(), M=_mm_set1_epi16(257), one=_mm_set1_epi16(1);
+    const __m128i c255=_mm_set1_epi16(255), am=_mm_set1_epi32((int)0xFF000000u);
+    int i=0;
+    for(; i+4<=n; i+=4){
+        __m128i sp=_mm_loadu_si128((const __m128i*)(s+i));
+        __m128i sa=_mm_and_si128(sp,am);
+        __m128i opaque=_mm_cmpeq_epi32(sa,am);
+        if(_mm_movemask_epi8(opaque)==0xFFFF){ _mm_storeu_si128((__m128i*)(d+i), sp); continue; }
+        __m128i clear=_mm_cmpeq_epi32(sa,z);
+        if(_mm_movemask_epi8(clear)==0xFFFF) continue;
+
+        __m128i dp=_mm_loadu_si128((const __m128i*)(d+i));
+        __m128i slo=_mm_unpacklo_epi8(sp,z), shi=_mm_unpackhi_epi8(sp,z);
+        __m128i dlo=_mm_unpacklo_epi8(dp,z), dhi=_mm_unpackhi_epi8(dp,z);
+        __m128i alo=_mm_shufflehi_epi16(_mm_shufflelo_epi16(slo,0xFF),0xFF);
+        __m128i ahi=_mm_shufflehi_epi16(_mm_shufflelo_epi16(shi,0xFF),0xFF);
+        __m128i lo=_mm_add_epi16(_mm_mullo_epi16(slo,alo), _mm_mullo_epi16(dlo,_mm_sub_epi16(c255,alo)));
+        __m128i hi=_mm_add_epi16(_mm_mullo_epi16(shi,ahi), _mm_mullo_epi16(dhi,_mm_sub_epi16(c255,ahi)));
+        lo=_mm_mulhi_epu16(_mm_add_epi16(lo,one),M);
+        hi=_mm_mulhi_epu16(_mm_add_epi16(hi,one),M);
+        __m128i r=_mm_or_si128(_mm_packus_epi16(lo,hi), am);
+        r=_mm_or_si128(_mm_and_si128(clear,dp), _mm_andnot_si128(clear,r)); // sa==0 keeps dst untouched
+        _mm_storeu_si128((__m128i*)(d+i), r);
+    }
+    for(; i<n; i++) d[i]=blend_over(d[i],s[i]);
+}
+
+// premultiplied: out = s + d*(255-sa)/255 (saturating), alpha forced to 255
+static inline void span_blend_pm_sse2(u32* d,const u32* s,int n){
+    const __m128i z=_mm_setzero_si128(), M=_mm_set1_epi16(257), one=_mm_set1_epi16(1);
+    const __m128i c255=_mm_set1_epi16(255), am=_mm_set1_epi32((int)0xFF000000u);
+    int i=0;
+    for(; i+4<=n; i+=4){
+        __m128i sp=_mm_loadu_si128((const __m128i*)(s+i));
+        __m128i opaque=_mm_cmpeq_epi32(_mm_and_si128(sp,am),am);
+        if(_mm_movemask_epi8(opaque)==0xFFFF){ _mm_storeu_si128((__m128i*)(d+i), sp); continue; }
+        __m128i clear=_mm_cmpeq_epi32(sp,z);
+        if(_mm_movemask_epi8(clear)==0xFFFF) continue;
+
+        __m128i dp=_mm_loadu_si128((const __m128i*)(d+i));
+        __m128i slo=_mm_unpacklo_epi8(sp,z), shi=_mm_unpackhi_epi8(sp,z);
+        __m128i ilo=_mm_sub_epi16(c255,_mm_shufflehi_epi16(_mm_shufflelo_epi16(slo,0xFF),0xFF));
+        __m128i ihi=_mm_sub_epi16(c255,_mm_shufflehi_epi16(_mm_shufflelo_epi16(shi,0xFF),0xFF));
+        __m128i lo=_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dp,z),ilo),one),M);
+        __m128i hi=_mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dp,z),ihi),one),M);
+        __m128i r=_mm_or_si128(_mm_adds_epu8(_mm_packus_epi16(lo,hi),sp), am);
+        r=_mm_or_si128(_mm_and_si128(clear,dp), _mm_andnot_si128(clear,r)); // zero src keeps dst untouched
+        _mm_storeu_si128((__m128i*)(d+i), r);
+    }
+    for(; i<n; i++) d[i]=blend_over_pm(d[i],s[i]);
+}
+
+// m bytes are splatted into pixel layout (m,m,m,m) so they unpack like the pixels
+static inline void span_mul_sse2(u32* d,const u8* m,int n){
+    const __m128i z=_mm_setzero_si128(), M=_mm_set1_epi16(257), one=_mm_set1_epi16(1);
+    const __m128i am=_mm_set1_epi32((int)0xFF000000u);
+    int i=0;
+    for(; i+4<=n; i+=4){
+        int m4; std::memcpy(&m4, m+i, 4);
+        __m128i k=_mm_cvtsi32_si128(m4);
+        k=_mm_unpacklo_epi8(k,k);
+        k=_mm_unpacklo_epi16(k,k);
+        __m128i p=_mm_loadu_si128((const __m128i*)(d+i));
+        __m128i lo=_mm_mullo_epi16(_mm_unpacklo_epi8(p,z), _mm_unpacklo_epi8(k,z));
+        __m128i hi=_mm_mullo_epi16(_mm_unpackhi_epi8(p,z), _mm_unpackhi_epi8(k,z));
+        lo=_mm_mulhi_epu16(_mm_add_epi16(lo,one),M);
+        hi=_mm_mulhi_epu16(_mm_add_epi16(hi,one),M);
+        _mm_storeu_si128((__m128i*)(d+i), _mm_or_si128(_mm_packus_epi16(lo,hi), am));
+    }
+    span_mul_scalar(d+i,m+i,n-i);
+}
+
+WE_TARGET_AVX2 static inline void span_fill_avx2(u32* d,int n,u32 c){
+    if(n<8){ span_fill_sse2(d,n,c); return; }
+    __m256i v=_mm256_set1_epi32((int)c);
+    int i=0;
+    for(; i+8<=n; i+=8) _mm256_storeu_si256((__m256i*)(d+i), v);
+    for(; i<n; i++) d[i]=c;
+}
+
+WE_TARGET_AVX2 static inline void span_blend_solid_avx2(u32* d,int n,u32 c){
+    if(n<8){ span_blend_solid_sse2(d,n,c); return; } // short spans: skip ymm setup entirely
+    u32 sa=A(c);
+    if(sa==255){ span_fill_avx2(d,n,c); return; }
+    if(sa==0) return;
+    u32 inv=255u-sa;
+    short sb=(short)(B(c)*sa+1), sg=(short)(G(c)*sa+1), sr=(short)(R(c)*sa+1);
+    const __m256i z=_mm256_setzero_si256(), M=_mm256_set1_epi16(257);
+    const __m256i S1=_mm256_setr_epi16(sb,sg,sr,0, sb,sg,sr,0, sb,sg,sr,0, sb,sg,sr,0);
+    const __m256i I=_mm256_set1_epi16((short)inv), am=_mm256_set1_epi32((int)0xFF000000u);
+    int i=0;
+    for(; i+8<=n; i+=8){
+        __m256i p=_mm256_loadu_si256((const __m256i*)(d+i));
+        __m256i lo=_mm256_unpacklo_epi8(p,z), hi=_mm256_unpackhi_epi8(p,z);
+        lo=_mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(lo,I),S1),M);
+        hi=_mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(hi,I),S1),M);
+        _mm256_storeu_si256((__m256i*)(d+i), _mm256_or_si256(_mm256_packus_epi16(lo,hi),am));
+    }
+    span_blend_solid_sse2(d+i,n-i,c);
+}
+
+WE_TARGET_AVX2 static inline void span_blend_avx2(u32* d,const u32* s,int n){
+    if(n<8){ span_blend_sse2(d,s,n); return; }
+    const __m256i z=_mm256_setzero_si256(), M=_mm256_set1_epi16(257), one=_mm256_set1_epi16(1);
+    const __m256i c255=_mm256_set1_epi16(255), am=_mm256_set1_epi32((int)0xFF000000u);
+    int i=0;
+    for(; i+8<=n; i+=8){
+        __m256i sp=_mm256_loadu_si256((const __m256i*)(s+i));
+        __m256i sa=_mm256_and_si256(sp,am);
+        __m256i opaque=_mm256_cmpeq_epi32(sa,am);
+        if(_mm256_movemask_epi8(opaque)==-1){ _mm256_storeu_si256((__m256i*)(d+i), sp); continue; }
+        __m256i clear=_mm256_cmpeq_epi32(sa,z);
+        if(_mm256_movemask_epi8(clear)==-1) continue;
+
+        __m256i dp=_mm256_loadu_si256((const __m256i*)(d+i));
+        __m256i slo=_mm256_unpacklo_epi8(sp,z), shi=_mm256_unpackhi_epi8(sp,z);
+        __m256i dlo=_mm256_unpacklo_epi8(dp,z), dhi=_mm256_unpackhi_epi8(dp,z);
+        __m256i alo=_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo,0xFF),0xFF);
+        __m256i ahi=_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi,0xFF),0xFF);
+        __m256i lo=_mm256_add_epi16(_mm256_mullo_epi16(slo,alo), _mm256_mullo_epi16(dlo,_mm256_sub_epi16(c255,alo)));
+        __m256i hi=_mm256_add_epi16(_mm256_mullo_epi16(shi,ahi), _mm256_mullo_epi16(dhi,_mm256_sub_epi16(c255,ahi)));
+        lo=_mm256_mulhi_epu16(_mm256_add_epi16(lo,one),M);
+        hi=_mm256_mulhi_epu16(_mm256_add_epi16(hi,one),M);
+        __m256i r=_mm256_or_si256(_mm256_packus_epi16(lo,hi), am);
+        r=_mm256_blendv_epi8(r,dp,clear);
+        _mm256_storeu_si256((__m256i*)(d+i), r);
+    }
+    span_blend_sse2(d+i,s+i,n-i);
+}
+
+WE_TARGET_AVX2 static inline void span_blend_pm_avx2(u32* d,const u32* s,int n){
+    if(n<8){ span_blend_pm_sse2(d,s,n); return; }
+    const __m256i z=_mm256_setzero_si256(), M=_mm256_set1_epi16(257), one=_mm256_set1_epi16(1);
+    const __m256i c255=_mm256_set1_epi16(255), am=_mm256_set1_epi32((int)0xFF000000u);
+    int i=0;
+    for(; i+8<=n; i+=8){
+        __m256i sp=_mm256_loadu_si256((const __m256i*)(s+i));
+        __m256i opaque=_mm256_cmpeq_epi32(_mm256_and_si256(sp,am),am);
+        if(_mm256_movemask_epi8(opaque)==-1){ _mm256_storeu_si256((__m256i*)(d+i), sp); continue; }
+        __m256i clear=_mm256_cmpeq_epi32(sp,z);
+        if(_mm256_movemask_epi8(clear)==-1) continue;
+
+        __m256i dp=_mm256_loadu_si256((const __m256i*)(d+i));
+        __m256i slo=_mm256_unpacklo_epi8(sp,z), shi=_mm256_unpackhi_epi8(sp,z);
+        __m256i ilo=_mm256_sub_epi16(c255,_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo,0xFF),0xFF));
+        __m256i ihi=_mm256_sub_epi16(c255,_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi,0xFF),0xFF));
+        __m256i lo=_mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(dp,z),ilo),one),M);
+        __m256i hi=_mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(dp,z),ihi),one),M);
+        __m256i r=_mm256_or_si256(_mm256_adds_epu8(_mm256_packus_epi16(lo,hi),sp), am);
+        r=_mm256_blendv_epi8(r,dp,clear);
+        _mm256_storeu_si256((__m256i*)(d+i), r);
+    }
+    span_blend_pm_sse2(d+i,s+i,n-i);
+}
+
+WE_TARGET_AVX2 static inline void span_mul_avx2(u32* d,const u8* m,int n){
+    if(n<8){ span_mul_sse2(d,m,n); return; }
+    const __m256i z=_mm256_setzero_si256(), M=_mm256_set1_epi16(257), one=_mm256_set1_epi16(1);
+    const __m256i am=_mm256_set1_epi32((int)0xFF000000u), splat=_mm256_set1_epi32(0x01010101);
+    int i=0;
+    for(; i+8<=n; i+=8){
+        __m256i k=_mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(m+i))), splat);
+        __m256i p=_mm256_loadu_si256((const __m256i*)(d+i));
+        __m256i lo=_mm256_mullo_epi16(_mm256_unpacklo_epi8(p,z), _mm256_unpacklo_epi8(k,z));
+        __m256i hi=_mm256_mullo_epi16(_mm256_unpackhi_epi8(p,z), _mm256_unpackhi_epi8(k,z));
+        lo=_mm256_mulhi_epu16(_mm256_add_epi16(lo,one),M);
+        hi=_mm256_mulhi_epu16(_mm256_add_epi16(hi,one),M);
+        _mm256_storeu_si256((__m256i*)(d+i), _mm256_or_si256(_mm256_packus_epi16(lo,hi),am));
+    }
+    span_mul_sse2(d+i,m+i,n-i);
+}
+#endif
+
+enum class SimdLevel : u8 { Scalar=0, SSE2=1, AVX2=2 };
+
+struct SpanKernels {
+    SimdLevel level=SimdLevel::Scalar;
+    void (*fill)(u32* d,int n,u32 c)=span_fill_scalar;
+    void (*blend_solid)(u32* d,int n,u32 c)=span_blend_solid_scalar;    // blend_over(d[i], c)
+    void (*blend)(u32* d,const u32* s,int n)=span_blend_scalar;         // blend_over(d[i], s[i])
+    void (*blend_pm)(u32* d,const u32* s,int n)=span_blend_pm_scalar;   // blend_over_pm(d[i], s[i])
+    void (*mul)(u32* d,const u8* m,int n)=span_mul_scalar;              // d[i].rgb * m[i]/255
+};
+
+static inline SimdLevel simd_detect(){
+#if WE_SIMD_X86
+  #if defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r,0);
+    if(r[0]>=7){
+        __cpuid(r,1);
+        bool osxsave=(r[2]&(1<<27))!=0, avx=(r[2]&(1<<28))!=0;
+        if(osxsave && avx && (_xgetbv(0)&6)==6){
+            __cpuidex(r,7,0);
+            if(r[1]&(1<<5)) return SimdLevel::AVX2;
+        }
+    }
+    return SimdLevel::SSE2;
+  #else
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    return SimdLevel::SSE2;
+  #endif
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+static inline SpanKernels span_kernels_make(SimdLevel lv){
+    SpanKernels k{};
+#if WE_SIMD_X86
+    if(lv>=SimdLevel::SSE2){
+        k.level=SimdLevel::SSE2;
+        k.fill=span_fill_sse2; k.blend_solid=span_blend_solid_sse2; k.blend=span_blend_sse2; k.mul=span_mul_sse2;
+        k.blend_pm=span_blend_pm_sse2;
+    }
+    if(lv>=SimdLevel::AVX2){
+        k.level=SimdLevel::AVX2;
+        k.fill=span_fill_avx2; k.blend_solid=span_blend_solid_avx2; k.blend=span_blend_avx2; k.mul=span_mul_avx2;
+        k.blend_pm=span_blend_pm_avx2;
+    }
+#else
+    (void)lv;
+#endif
+    return k;
+}
+
+static inline SpanKernels& span_kernels(){
+    static SpanKernels k=span_kernels_make(simd_detect());
+    return k;
+}
+// Force a lower level (e.g. Scalar for reference screenshots). Clamped to what the CPU supports.
+static inline void span_set_level(SimdLevel lv){
+    SimdLevel hw=simd_detect();
+    span_kernels()=span_kernels_make(lv<hw?lv:hw);
+}
+static inline const char* simd_level_name(SimdLevel lv){
+    switch(lv){
+        case SimdLevel::AVX2: return "AVX2";
+        case SimdLevel::SSE2: return "SSE2";
+        default: return "scalar";
+    }
+}
+
+static inline void span_fill(u32* d,int n,u32 c){ if(n>0) span_kernels().fill(d,n,c); }
+static inline void span_blend_solid(u32* d,int n,u32 c){ if(n>0) span_kernels().blend_solid(d,n,c); }
+static inline void span_blend(u32* d,const u32* s,int n){ if(n>0) span_kernels().blend(d,s,n); }
+static inline void span_blend_pm(u32* d,const u32* s,int n){ if(n>0) span_kernels().blend_pm(d,s,n); }
+static inline void span_mul(u32* d,const u8* m,int n){ if(n>0) span_kernels().mul(d,m,n); }
+
+// Premultiplied layer destination: like blend_over / blend_over_pm but the destination
+// keeps its alpha, so the layer can be composited later with one premultiplied blit
+// (UI window surfaces). Scalar only: layers are re-rasterized rarely.
+static inline u32 layer_over(u32 dst, u32 src){
+    u32 sa=A(src);
+    if(sa==255) return src;
+    if(sa==0) return dst;
+    u32 inv=255u-sa;
+    u32 rr=(R(src)*sa + R(dst)*inv)/255u;
+    u32 gg=(G(src)*sa + G(dst)*inv)/255u;
+    u32 bb=(B(src)*sa + B(dst)*inv)/255u;
+    return RGBA(rr,gg,bb, sa + (A(dst)*inv)/255u);
+}
+static inline u32 layer_over_pm(u32 dst, u32 src){
+    u32 sa=A(src);
+    if(sa==255) return src;
+    if(src==0) return dst;
+    u32 inv=255u-sa;
+    u32 rr=std::min(R(src) + (R(dst)*inv)/255u, 255u);
+    u32 gg=std::min(G(src) + (G(dst)*inv)/255u, 255u);
+    u32 bb=std::min(B(src) + (B(dst)*inv)/255u, 255u);
+    return RGBA(rr,gg,bb, sa + (A(dst)*inv)/255u);
+}
+static inline void span_layer_solid(u32* d,int n,u32 c){
+    for(int i=0;i<n;i++) d[i]=layer_over(d[i],c);
+}
+static inline void span_layer_blend(u32* d,const u32* s,int n){
+    for(int i=0;i<n;i++) d[i]=layer_over(d[i],s[i]);
+}
+static inline void span_layer_blend_pm(u32* d,const u32* s,int n){
+    for(int i=0;i<n;i++) d[i]=layer_over_pm(d[i],s[i]);
+}
+
+// Kernel table for Canvas::kern on a premultiplied layer (fills/copies stay SIMD).
+static inline const SpanKernels& layer_kernels(){
+    static const SpanKernels k=[]{
+        SpanKernels t=span_kernels_make(simd_detect());
+        t.blend_solid=span_layer_solid;
+        t.blend=span_layer_blend;
+        t.blend_pm=span_layer_blend_pm;
+        return t;
+    }();
+    return k;
+}
+
 // ============================================================
 // Scary-looking math (useful, but intimidating 😈)
 // ============================================================
@@ -153,140 +554,1196 @@ static inline bool m3_inverse_affine(const m3& M, m3& out){
     return true;
 }
 
+// Batch affine transforms: out[i] = M*p[i] (points as v2, or as separate x/y arrays).
+// SSE2 evaluates (a*x + b*y) + t in the same order as m3_mul_v2, so results match it exactly.
+static_assert(sizeof(v2)==2*sizeof(f32), "v2 must be two packed floats");
+
+static inline void m3_transform(const m3& M, const v2* p, v2* out, size_t n){
+    f32 a=M.m[0][0], b=M.m[0][1], tx=M.m[0][2];
+    f32 c=M.m[1][0], d=M.m[1][1], ty=M.m[1][2];
+    size_t i=0;
+#if WE_SIMD_X86
+    const __m128 c0=_mm_setr_ps(a,c,a,c), c1=_mm_setr_ps(b,d,b,d), t=_mm_setr_ps(tx,ty,tx,ty);
+    for(; i+2<=n; i+=2){
+        __m128 v=_mm_loadu_ps(&p[i].x);                          // x0 y0 x1 y1
+        __m128 xx=_mm_shuffle_ps(v,v,_MM_SHUFFLE(2,2,0,0));
+        __m128 yy=_mm_shuffle_ps(v,v,_MM_SHUFFLE(3,3,1,1));
+        _mm_storeu_ps(&out[i].x, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0,xx), _mm_mul_ps(c1,yy)), t));
+    }
+#endif
+    for(; i<n; i++){
+        f32 x=p[i].x, y=p[i].y;
+        out[i]={a*x + b*y + tx, c*x + d*y + ty};
+    }
+}
+
+static inline void m3_transform(const m3& M, const f32* px, const f32* py, v2* out, size_t n){
+    f32 a=M.m[0][0], b=M.m[0][1], tx=M.m[0][2];
+    f32 c=M.m[1][0], d=M.m[1][1], ty=M.m[1][2];
+    size_t i=0;
+#if WE_SIMD_X86
+    const __m128 A=_mm_set1_ps(a), B=_mm_set1_ps(b), TX=_mm_set1_ps(tx);
+    const __m128 C=_mm_set1_ps(c), D=_mm_set1_ps(d), TY=_mm_set1_ps(ty);
+    for(; i+4<=n; i+=4){
+        __m128 x=_mm_loadu_ps(px+i), y=_mm_loadu_ps(py+i);
+        __m128 ox=_mm_add_ps(_mm_add_ps(_mm_mul_ps(A,x), _mm_mul_ps(B,y)), TX);
+        __m128 oy=_mm_add_ps(_mm_add_ps(_mm_mul_ps(C,x), _mm_mul_ps(D,y)), TY);
+        _mm_storeu_ps(&out[i].x,   _mm_unpacklo_ps(ox,oy));
+        _mm_storeu_ps(&out[i+2].x, _mm_unpackhi_ps(ox,oy));
+    }
+#endif
+    for(; i<n; i++){
+        f32 x=px[i], y=py[i];
+        out[i]={a*x + b*y + tx, c*x + d*y + ty};
+    }
+}
+
 // ============================================================
-// Input (edge-based, reliable buttons)
+// Memory (allocation counters, frame arena, per-thread scratch arenas)
 // ============================================================
-struct Input {
-    int mouse_x=0, mouse_y=0;
-    int mouse_dx=0, mouse_dy=0;
-    int wheel=0;
+// Heap allocation counters. They only move if exactly one translation unit defines
+// WE_ALLOC_HOOKS before including this header: that TU replaces the global operator
+// new/delete with counting versions. Profiler::frame_mark records the per-frame delta.
+struct AllocCounters {
+    static inline std::atomic<u64> count{0};   // operator new calls
+    static inline std::atomic<u64> bytes{0};
+    static inline std::atomic<u64> frees{0};
+    static inline bool hooked=false;           // WE_ALLOC_HOOKS is active
+};
+static inline u64 alloc_count(){ return AllocCounters::count.load(std::memory_order_relaxed); }
+static inline u64 alloc_bytes(){ return AllocCounters::bytes.load(std::memory_order_relaxed); }
+
+// Linear allocator: bumps through blocks and frees everything at once (reset) or back to
+// a mark (rewind). reset() merges the blocks of a busy frame into one, so after a warm-up
+// it stops touching the heap. Memory is uninitialized and destructors never run: only
+// trivially destructible data (or ArenaAlloc containers, whose frees are no-ops).
+struct Arena {
+    struct Block { u8* p=nullptr; size_t size=0; };
+    std::vector<Block> blocks;   // [cur] is being filled; later blocks are kept for reuse
+    size_t cur=0, off=0;
+    size_t min_block=64*1024;
+    size_t used=0, peak=0;       // bytes handed out since the last reset / most ever
+
+    struct Mark { size_t cur=0, off=0, used=0; };
+
+    Arena()=default;
+    Arena(const Arena&)=delete;
+    Arena& operator=(const Arena&)=delete;
+    ~Arena(){ release(); }
+
+    void* alloc(size_t bytes, size_t align=alignof(std::max_align_t)){
+        if(bytes==0) bytes=1;
+        for(;;){
+            if(cur<blocks.size()){
+                const Block& b=blocks[cur];
+                uintptr_t base=(uintptr_t)b.p;
+                size_t a=(size_t)(((base+off+align-1) & ~(uintptr_t)(align-1)) - base);
+                if(a+bytes<=b.size){
+                    off=a+bytes;
+                    used+=bytes; peak=std::max(peak,used);
+                    return b.p+a;
+                }
+                if(cur+1<blocks.size()){ cur++; off=0; continue; }
+            }
+            Block nb;
+            nb.size=std::max({min_block, bytes+align, capacity()}); // geometric growth
+            nb.p=(u8*)::operator new(nb.size);
+            blocks.push_back(nb);
+            cur=blocks.size()-1; off=0;
+        }
+    }
+    template<typename T> T* alloc_array(size_t n){
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        return (T*)alloc(n*sizeof(T), alignof(T));
+    }
 
-    std::array<bool,256> key{};
-    std::array<bool,256> key_pressed{};
-    std::array<bool,256> key_released{};
+    Mark mark() const { return Mark{cur, off, used}; }
+    void rewind(const Mark& m){ cur=m.cur; off=m.off; used=m.used; }
+
+    // Start over; several blocks in use are replaced by one covering them all.
+    void reset(){
+        if(blocks.size()>1 && cur>0){
+            size_t total=0;
+            for(const Block& b: blocks) total+=b.size;
+            release();
+            Block nb; nb.size=total; nb.p=(u8*)::operator new(total);
+            blocks.push_back(nb);
+        }
+        cur=0; off=0; used=0;
+    }
+    void release(){
+        for(Block& b: blocks) ::operator delete(b.p);
+        blocks.clear();
+        cur=0; off=0; used=0;
+    }
+    size_t capacity() const { size_t t=0; for(const Block& b: blocks) t+=b.size; return t; }
+};
 
-    std::array<bool,5> mouse{};
-    std::array<bool,5> mouse_pressed{};
-    std::array<bool,5> mouse_released{};
+// Pointer + length over arena (or any) memory.
+template<typename T>
+struct Span {
+    T* ptr=nullptr;
+    size_t n=0;
+    T* begin() const { return ptr; }
+    T* end() const { return ptr+n; }
+    T& operator[](size_t i) const { return ptr[i]; }
+    size_t size() const { return n; }
+    bool empty() const { return n==0; }
+};
+template<typename T>
+static inline Span<T> arena_span(Arena& a, size_t n){ return Span<T>{ a.alloc_array<T>(n), n }; }
 
-    void clear_edges(){
-        key_pressed.fill(false);
-        key_released.fill(false);
-        mouse_pressed.fill(false);
-        mouse_released.fill(false);
-        mouse_dx=0; mouse_dy=0; wheel=0;
-    }
+// std allocator over an Arena: containers allocate from it and never free (the arena does,
+// at reset/rewind). Reserve up front: growth leaves the old buffers behind.
+template<typename T>
+struct ArenaAlloc {
+    using value_type=T;
+    Arena* arena=nullptr;
+
+    ArenaAlloc()=default;
+    explicit ArenaAlloc(Arena& a) : arena(&a) {}
+    template<typename U> ArenaAlloc(const ArenaAlloc<U>& o) : arena(o.arena) {}
+
+    T* allocate(size_t n){ return (T*)arena->alloc(n*sizeof(T), alignof(T)); }
+    void deallocate(T*, size_t){}
+    template<typename U> bool operator==(const ArenaAlloc<U>& o) const { return arena==o.arena; }
+    template<typename U> bool operator!=(const ArenaAlloc<U>& o) const { return arena!=o.arena; }
+};
+template<typename T> using ArenaVec = std::vector<T, ArenaAlloc<T>>;
+
+// Frame arena: window-thread data that lives until the next App::frame_begin (e.g. buffers
+// referenced by recorded DrawCmds until the tiled rasterizer replays them). Without an
+// App, call frame_arena().reset() once per frame.
+static inline Arena& frame_arena(){ static Arena a; return a; }
+
+// Per-thread scratch (any thread, including workers). Take a ScratchScope around the use:
+// everything allocated inside is released when it ends, nested scopes are fine.
+static inline Arena& scratch_arena(){ static thread_local Arena a; return a; }
+struct ScratchScope {
+    Arena& a;
+    Arena::Mark m;
+    ScratchScope() : a(scratch_arena()), m(a.mark()) {}
+    ~ScratchScope(){ a.rewind(m); }
+    ScratchScope(const ScratchScope&)=delete;
+    ScratchScope& operator=(const ScratchScope&)=delete;
 };
 
 // ============================================================
-// Canvas + primitives
+// Profiler (scoped QPC zones, per-thread rings, rolling stats)
 // ============================================================
-struct RectI { int x0=0,y0=0,x1=0,y1=0; };
-
-struct Canvas {
-    u32* pix=nullptr;
-    int w=0,h=0,stride=0;
-    RectI clip{};
+// WE_ZONE("name") times the enclosing scope; names must be string literals (or outlive
+// the profiler). Each thread writes its own ring without locks; Profiler::frame_mark()
+// (App::frame_begin) collects the finished zones of every thread on the window thread.
+// Define WE_NO_PROFILE to compile the zones out; profiler().enabled turns them off at runtime.
+struct ProfEvent {
+    i64 t0=0, t1=0;         // QPC ticks
+    const char* name="";
+    u16 depth=0;            // nesting on its thread
+    u16 tid=0;              // index into Profiler::rings
+};
 
-    void set(u32* p,int W,int H,int S){
-        pix=p; w=W; h=H; stride=S;
-        clip = {0,0,w-1,h-1};
+// Single producer (the owning thread), single consumer (frame_mark).
+struct ProfRing {
+    static constexpr u32 CAP=1u<<14;   // events per thread between two frame_marks
+    static constexpr int MAX_DEPTH=64;
+    std::unique_ptr<ProfEvent[]> ev{new ProfEvent[CAP]};
+    std::atomic<u64> head{0};           // events written (owner: release, reader: acquire)
+    u64 read=0;                         // consumer position
+    u16 tid=0;
+    char name[32]="thread";
+
+    struct Open { const char* name; i64 t0; };
+    Open open[MAX_DEPTH];               // owner only
+    int depth=0;
+
+    void push(const ProfEvent& e){
+        u64 h=head.load(std::memory_order_relaxed);
+        ev[h & (CAP-1)]=e;
+        head.store(h+1, std::memory_order_release);
     }
-    void clip_reset(){ clip={0,0,w-1,h-1}; }
-    void clip_set(int x,int y,int W,int H){
-        RectI r{x,y,x+W-1,y+H-1};
-        r.x0=std::max(r.x0,0); r.y0=std::max(r.y0,0);
-        r.x1=std::min(r.x1,w-1); r.y1=std::min(r.y1,h-1);
-        clip=r;
+};
+
+static inline i64 prof_now(){ LARGE_INTEGER t; QueryPerformanceCounter(&t); return (i64)t.QuadPart; }
+
+// Hands the calling thread's ring back to Profiler::free_rings when the thread exits.
+struct Profiler;
+struct ProfRingLease {
+    Profiler* owner=nullptr;
+    ProfRing* r=nullptr;
+    ~ProfRingLease();
+};
+
+struct ProfStats {
+    const char* name="";
+    f32 last_ms=0, min_ms=0, avg_ms=0, p99_ms=0; // per-frame totals over the rolling window
+    int calls=0;                                   // in the last frame
+};
+
+struct Profiler {
+    std::atomic<bool> enabled{true};
+    i64 freq=1;
+    int history=240;                  // frames kept for stats, the overlay and trace export
+
+    mutable std::mutex rings_m;       // registration only
+    std::vector<std::unique_ptr<ProfRing>> rings; // never freed: zones may outlive threads
+    std::vector<ProfRing*> free_rings; // rings of exited threads, reused by new ones
+
+    struct Frame {
+        i64 t0=0, t1=0;
+        std::vector<ProfEvent> ev;
+        u64 allocs=0, alloc_bytes=0;  // heap allocations during the frame (WE_ALLOC_HOOKS)
+    };
+    std::deque<Frame> frames;         // oldest first, at most history
+    i64 frame_t0=0;
+    u64 dropped=0;                    // events lost to ring overflow
+    u64 alloc_mark=0, alloc_bytes_mark=0; // counters at the end of the last frame_mark
+    std::vector<ProfRing*> mark_rings;    // frame_mark scratch
+    std::vector<i64> mark_sum;
+    std::vector<int> mark_calls;
+
+    struct Zone {
+        const char* name="";
+        std::vector<f32> ms;          // per-frame totals, ring of history
+        size_t n=0, pos=0;
+        f32 last=0; int calls=0;
+    };
+    std::vector<Zone> zones;          // [0] = whole frame
+    std::unordered_map<const char*,size_t> zone_by_ptr;
+
+    static inline thread_local ProfRing* tl_ring=nullptr;
+    static inline thread_local ProfRingLease tl_lease;
+
+    Profiler(){
+        LARGE_INTEGER f; QueryPerformanceFrequency(&f);
+        freq=std::max<i64>((i64)f.QuadPart,1);
+        frame_t0=prof_now();
+        zones.emplace_back();
+        zones[0].name="frame";
     }
 
-    void clear(u32 c){
-        for(int y=0;y<h;y++){
-            u32* row=pix + y*stride;
-            for(int x=0;x<w;x++) row[x]=c;
+    ProfRing& ring(){
+        if(!tl_ring){
+            std::lock_guard<std::mutex> lk(rings_m);
+            if(!free_rings.empty()){
+                tl_ring=free_rings.back();
+                free_rings.pop_back();
+            }else{
+                rings.push_back(std::make_unique<ProfRing>());
+                tl_ring=rings.back().get();
+                tl_ring->tid=(u16)(rings.size()-1);
+            }
+            tl_lease.owner=this; tl_lease.r=tl_ring;
         }
+        return *tl_ring;
     }
 
-    void rect_fill(int x,int y,int W,int H,u32 c){
-        if(W==0||H==0) return;
-        int x0=x, y0=y, x1=x+W-1, y1=y+H-1;
-        if(x0>x1) std::swap(x0,x1);
-        if(y0>y1) std::swap(y0,y1);
+    // Unread events stay in the ring; frame_mark still collects them under the same tid.
+    // The name is kept until the next owner calls thread_name.
+    void release_ring(ProfRing* r){
+        std::lock_guard<std::mutex> lk(rings_m);
+        r->depth=0;
+        free_rings.push_back(r);
+    }
 
-        x0=std::max(x0,clip.x0); y0=std::max(y0,clip.y0);
-        x1=std::min(x1,clip.x1); y1=std::min(y1,clip.y1);
-        if(x0>x1||y0>y1) return;
+    void thread_name(const char* n){
+        ProfRing& r=ring();
+        std::snprintf(r.name, sizeof(r.name), "%s", n);
+    }
 
-        u32 a=A(c);
-        for(int yy=y0;yy<=y1;yy++){
-            u32* row=pix + yy*stride;
-            if(a==255){
-                for(int xx=x0;xx<=x1;xx++) row[xx]=c;
-            }else{
-                for(int xx=x0;xx<=x1;xx++) row[xx]=blend_over(row[xx],c);
+    // Zones are matched by pointer first, then by text (the same literal can differ per TU).
+    size_t zone_index(const char* name){
+        auto it=zone_by_ptr.find(name);
+        if(it!=zone_by_ptr.end()) return it->second;
+        size_t i=0;
+        while(i<zones.size() && std::strcmp(zones[i].name,name)!=0) i++;
+        if(i==zones.size()){ zones.emplace_back(); zones.back().name=name; }
+        zone_by_ptr.emplace(name,i);
+        return i;
+    }
+
+    static void zone_add(Zone& z,size_t history,f32 v){
+        if(z.ms.size()!=history){ z.ms.assign(history,0.0f); z.n=0; z.pos=0; }
+        z.ms[z.pos]=v;
+        z.pos=(z.pos+1)%history;
+        z.n=std::min(z.n+1,history);
+        z.last=v;
+    }
+
+    f32 ms(i64 ticks) const { return (f32)((double)ticks*1000.0/(double)freq); }
+
+    // Close the current frame (window thread): collect every ring, update the stats.
+    // Allocations are counted up to here; frame_mark's own bookkeeping is excluded.
+    void frame_mark(){
+        i64 now=prof_now();
+        u64 ac=alloc_count(), ab=alloc_bytes();
+        size_t hist=(size_t)std::max(history,1);
+        Frame f;
+        if(frames.size()>=hist){ f.ev.swap(frames.front().ev); f.ev.clear(); } // reuse the oldest buffer
+        f.t0=frame_t0; f.t1=now;
+        f.allocs=ac-alloc_mark; f.alloc_bytes=ab-alloc_bytes_mark;
+        frame_t0=now;
+        std::vector<ProfRing*>& rs=mark_rings;
+        rs.clear();
+        { std::lock_guard<std::mutex> lk(rings_m); for(auto& r: rings) rs.push_back(r.get()); }
+        for(ProfRing* rp: rs){
+            ProfRing& r=*rp;
+            u64 h=r.head.load(std::memory_order_acquire);
+            u64 from=r.read;
+            if(h-from>ProfRing::CAP){ dropped+=h-from-ProfRing::CAP; from=h-ProfRing::CAP; }
+            size_t base=f.ev.size();
+            for(u64 i=from;i<h;i++) f.ev.push_back(r.ev[i & (ProfRing::CAP-1)]);
+            // slots the writer lapped while we copied are torn: drop them
+            u64 h2=r.head.load(std::memory_order_acquire);
+            if(h2-from>ProfRing::CAP){
+                size_t bad=(size_t)std::min<u64>(h2-from-ProfRing::CAP, h-from);
+                f.ev.erase(f.ev.begin()+(std::ptrdiff_t)base, f.ev.begin()+(std::ptrdiff_t)(base+bad));
+                dropped+=bad;
             }
+            r.read=h;
+        }
+
+        std::vector<i64>& sum=mark_sum;
+        std::vector<int>& calls=mark_calls;
+        sum.assign(zones.size(),0);
+        calls.assign(zones.size(),0);
+        for(const ProfEvent& e: f.ev){
+            size_t zi=zone_index(e.name);
+            if(zi>=sum.size()){ sum.resize(zones.size(),0); calls.resize(zones.size(),0); }
+            sum[zi]+=e.t1-e.t0;
+            calls[zi]++;
         }
+        sum[0]=f.t1-f.t0; calls[0]=1;
+        for(size_t i=0;i<zones.size();i++){ zone_add(zones[i], hist, ms(sum[i])); zones[i].calls=calls[i]; }
+
+        frames.push_back(std::move(f));
+        while(frames.size()>hist) frames.pop_front();
+        alloc_mark=alloc_count(); alloc_bytes_mark=alloc_bytes();
     }
 
-    void rect_outline(int x,int y,int W,int H,int t,u32 c){
-        if(t<=0) return;
-        rect_fill(x,y,W,t,c);
-        rect_fill(x,y+H-t,W,t,c);
-        rect_fill(x,y,t,H,c);
-        rect_fill(x+W-t,y,t,H,c);
+    static ProfStats zone_stats(const Zone& z){
+        ProfStats s; s.name=z.name; s.last_ms=z.last; s.calls=z.calls;
+        if(z.n==0) return s;
+        ScratchScope scope;
+        Span<f32> v=arena_span<f32>(scope.a, z.n);
+        std::memcpy(v.begin(), z.ms.data(), z.n*sizeof(f32));
+        f32 sum=0; s.min_ms=v[0];
+        for(f32 x: v){ sum+=x; s.min_ms=std::min(s.min_ms,x); }
+        s.avg_ms=sum/(f32)v.size();
+        size_t k=(v.size()*99+99)/100 - 1; // ceil(0.99 n) - 1
+        std::nth_element(v.begin(), v.begin()+k, v.end());
+        s.p99_ms=v[k];
+        return s;
     }
 
-    void line(int x0,int y0,int x1,int y1,u32 c){
-        int dx=std::abs(x1-x0), sx=x0<x1?1:-1;
-        int dy=-std::abs(y1-y0), sy=y0<y1?1:-1;
-        int err=dx+dy;
-        for(;;){
-            if(x0>=clip.x0 && x0<=clip.x1 && y0>=clip.y0 && y0<=clip.y1){
-                u32* p = pix + y0*stride + x0;
-                *p = blend_over(*p,c);
-            }
-            if(x0==x1 && y0==y1) break;
-            int e2=2*err;
-            if(e2>=dy){ err+=dy; x0+=sx; }
-            if(e2<=dx){ err+=dx; y0+=sy; }
+    // Rolling stats of one zone ("frame" = whole frame); false if never seen.
+    bool stats(const char* name, ProfStats& out) const {
+        for(const Zone& z: zones) if(std::strcmp(z.name,name)==0){ out=zone_stats(z); return true; }
+        return false;
+    }
+    void all_stats(std::vector<ProfStats>& out) const {
+        out.clear();
+        for(const Zone& z: zones) out.push_back(zone_stats(z));
+    }
+
+    const Frame* last_frame() const { return frames.empty() ? nullptr : &frames.back(); }
+    // Heap allocations of the last frame (0 unless WE_ALLOC_HOOKS is defined somewhere).
+    u64 last_allocs() const { return frames.empty() ? 0 : frames.back().allocs; }
+    // Most allocations in any kept frame.
+    u64 max_allocs() const {
+        u64 m=0;
+        for(const Frame& f: frames) m=std::max(m,f.allocs);
+        return m;
+    }
+
+    // Forget the kept frames and every zone's history (e.g. between benchmark runs).
+    void reset(){
+        frames.clear();
+        for(Zone& z: zones){ z.ms.clear(); z.n=0; z.pos=0; z.last=0; z.calls=0; }
+    }
+
+    // Append s as a JSON string literal (quotes, backslashes and control bytes escaped).
+    static void json_str(std::string& out,const char* s){
+        out+='"';
+        for(;*s;s++){
+            unsigned char c=(unsigned char)*s;
+            if(c=='"' || c=='\\'){ out+='\\'; out+=(char)c; }
+            else if(c<0x20){ char e[8]; std::snprintf(e,sizeof(e),"\\u%04x",(unsigned)c); out+=e; }
+            else out+=(char)c;
         }
+        out+='"';
     }
 
-    void circle_fill(int cx,int cy,int r,u32 c){
-        if(r<=0) return;
-        int x0=std::max(cx-r,clip.x0), x1=std::min(cx+r,clip.x1);
-        int y0=std::max(cy-r,clip.y0), y1=std::min(cy+r,clip.y1);
-        int rr=r*r;
-        for(int y=y0;y<=y1;y++){
-            int dy=y-cy; int dy2=dy*dy;
-            u32* row=pix + y*stride;
-            for(int x=x0;x<=x1;x++){
-                int dx=x-cx;
-                if(dx*dx + dy2 <= rr) row[x]=blend_over(row[x],c);
+    // Chrome trace JSON (chrome://tracing, Perfetto) of the kept frames.
+    void chrome_trace(std::string& out) const {
+        out="{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        i64 base=frames.empty() ? 0 : frames.front().t0;
+        char num[64];
+        bool first=true;
+        auto sep=[&]{ if(!first) out+=",\n"; first=false; };
+        {
+            std::lock_guard<std::mutex> lk(rings_m);
+            for(const auto& r: rings){
+                sep();
+                std::snprintf(num,sizeof(num),"%u",(unsigned)r->tid);
+                out+="{\"ph\":\"M\",\"pid\":1,\"tid\":"; out+=num;
+                out+=",\"name\":\"thread_name\",\"args\":{\"name\":"; json_str(out,r->name); out+="}}";
             }
         }
+        auto us=[&](i64 t){ return (double)(t-base)*1e6/(double)freq; };
+        auto span=[&](unsigned tid,const char* name,i64 t0,i64 t1){
+            sep();
+            std::snprintf(num,sizeof(num),"%u",tid);
+            out+="{\"ph\":\"X\",\"pid\":1,\"tid\":"; out+=num;
+            out+=",\"name\":"; json_str(out,name);
+            std::snprintf(num,sizeof(num),",\"ts\":%.3f,\"dur\":%.3f}", us(t0), us(t1)-us(t0));
+            out+=num;
+        };
+        for(const Frame& f: frames){
+            span(0u,"frame",f.t0,f.t1);
+            for(const ProfEvent& e: f.ev) span((unsigned)e.tid,e.name,e.t0,e.t1);
+        }
+        out+="\n]}\n";
     }
 };
 
+static inline Profiler& profiler(){ static Profiler p; return p; }
+
+inline ProfRingLease::~ProfRingLease(){
+    if(r) owner->release_ring(r);
+    Profiler::tl_ring=nullptr;
+}
+
+// Manual begin/end pair (for passes split across calls, e.g. UI::begin / UI::end).
+#if defined(WE_NO_PROFILE)
+static inline void prof_begin(const char*){}
+static inline void prof_end(){}
+#else
+static inline void prof_begin(const char* name){
+    ProfRing& r=profiler().ring();
+    i64 t0=profiler().enabled.load(std::memory_order_relaxed) ? prof_now() : 0; // 0: disabled, no event
+    if(r.depth<ProfRing::MAX_DEPTH) r.open[r.depth]={name,t0};
+    r.depth++;
+}
+static inline void prof_end(){
+    ProfRing& r=profiler().ring();
+    if(r.depth<=0) return;
+    r.depth--;
+    if(r.depth>=ProfRing::MAX_DEPTH) return;
+    const ProfRing::Open& o=r.open[r.depth];
+    if(o.t0==0) return;
+    ProfEvent e; e.t0=o.t0; e.t1=prof_now(); e.name=o.name; e.depth=(u16)r.depth; e.tid=r.tid;
+    r.push(e);
+}
+#endif
+
+struct ProfZone {
+    explicit ProfZone(const char* name){ prof_begin(name); }
+    ~ProfZone(){ prof_end(); }
+    ProfZone(const ProfZone&)=delete;
+    ProfZone& operator=(const ProfZone&)=delete;
+};
+
+#define WE_PROF_CAT2(a,b) a##b
+#define WE_PROF_CAT(a,b) WE_PROF_CAT2(a,b)
+#if defined(WE_NO_PROFILE)
+  #define WE_ZONE(name) ((void)0)
+#else
+  #define WE_ZONE(name) ::we::ProfZone WE_PROF_CAT(we_zone_,__LINE__)(name)
+#endif
+
 // ============================================================
-// Built-in bitmap font (robust, spacing fixed, no random '?')
+// Job system (work-stealing workers, counters, continuations, main-thread queue)
 // ============================================================
-static inline void glyph5x7(char ch, u8 out[7]){
-    // uppercase
-    if(ch>='a' && ch<='z') ch = char(ch - 'a' + 'A');
-
-    // default '?'
-    u8 q[7]={0x0E,0x11,0x02,0x04,0x04,0x00,0x04};
-    std::memcpy(out,q,7);
+// Every thread that calls into the system owns a deque (queue 0: the thread that called
+// init, normally the window thread; other outside threads share it). Jobs are pushed
+// and popped at the back by their owner; idle workers steal from the front of others.
+// Waiting (wait / parallel_for) runs queued jobs while there are any, so nesting is fine,
+// then sleeps until the counter drops or more work arrives.
+// Background jobs (submit_background: streaming, disk I/O, decodes, presents) sit in a
+// separate queue that only workers take, so a wait never runs them on the waiting thread.
+struct JobCounter {
+    struct Next { std::function<void()> fn; bool background=false; };
+    std::atomic<int> n{0};
+    std::mutex m;                                // serializes finish() and continuations
+    std::vector<Next> next;                      // queued once n drops to 0 (submit_after)
+
+    bool done() const { return n.load()==0; }
+};
 
-    auto set=[&](std::initializer_list<u8> rows){
-        int i=0;
-        for(u8 v: rows){ out[i++]=v; }
+struct JobSystem {
+    struct Job {
+        std::function<void()> fn;
+        JobCounter* counter=nullptr;
+    };
+    // Growable ring (power-of-two capacity): the owner pushes/pops the back, thieves pop
+    // the front. It only grows, so a steady workload queues jobs without allocating.
+    struct JobRing {
+        std::vector<Job> buf;
+        size_t head=0, n=0;
+
+        bool empty() const { return n==0; }
+        size_t mask() const { return buf.size()-1; }
+        void push_back(Job&& j){
+            if(n==buf.size()) grow();
+            buf[(head+n)&mask()]=std::move(j);
+            n++;
+        }
+        Job pop_back(){
+            n--;
+            Job& s=buf[(head+n)&mask()];
+            Job j=std::move(s); s.fn=nullptr;
+            return j;
+        }
+        Job pop_front(){
+            Job& s=buf[head];
+            Job j=std::move(s); s.fn=nullptr;
+            head=(head+1)&mask(); n--;
+            return j;
+        }
+        void grow(){
+            std::vector<Job> nb(std::max<size_t>(64, buf.size()*2));
+            for(size_t i=0;i<n;i++) nb[i]=std::move(buf[(head+i)&mask()]);
+            buf.swap(nb);
+            head=0;
+        }
+    };
+    struct Queue {
+        std::mutex m;
+        JobRing q;
     };
 
-    switch(ch){
-        case ' ': set({0,0,0,0,0,0,0}); return;
-        case '.': set({0,0,0,0,0,0,0x04}); return;
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue>> queues;  // [0] main, [1..] workers
+    Queue bg;                                    // background jobs (workers only, FIFO)
+    std::atomic<int> pending{0};                 // jobs queued, not yet started
+    std::atomic<int> pending_bg{0};              // background jobs queued
+    std::atomic<int> waiters{0};                 // threads asleep in wait()
+    std::mutex sleep_m;
+    std::condition_variable cv;                  // workers and waiters
+    std::atomic<bool> quit{false};
+
+    std::mutex main_m;
+    std::vector<std::function<void()>> main_jobs; // run_main(), on the window thread
+
+    // per-thread identity (a thread can belong to one system at a time)
+    static inline thread_local const JobSystem* tl_owner=nullptr;
+    static inline thread_local int tl_index=0;
+
+    JobSystem()=default;
+    JobSystem(const JobSystem&)=delete;
+    JobSystem& operator=(const JobSystem&)=delete;
+    ~JobSystem(){ shutdown(); }
+
+    // workers: background threads (0 = everything runs inline on the caller).
+    void init(int workers){
+        shutdown();
+        quit=false;
+        queues.clear();
+        for(int i=0;i<=workers;i++) queues.emplace_back(new Queue());
+        tl_owner=this; tl_index=0;
+        for(int i=1;i<=workers;i++) threads.emplace_back([this,i]{ worker_main(i); });
+    }
+    // Runs queued jobs (and main-thread jobs, if called there) to completion, then joins.
+    void shutdown(){
+        if(!threads.empty()){
+            { std::lock_guard<std::mutex> lk(sleep_m); quit=true; }
+            cv.notify_all();
+            for(auto& t: threads) t.join();
+            threads.clear();
+        }
+        while(try_run(0,true)){}
+        run_main();
+    }
+    int size() const { return (int)threads.size()+1; }
+
+    // Queue f(); counter (if any) is incremented now and decremented when f returns.
+    // Runs inline when there are no workers.
+    void submit(std::function<void()> f, JobCounter* counter=nullptr){
+        if(counter) counter->n.fetch_add(1);
+        if(threads.empty()){
+            f();
+            if(counter) finish(*counter);
+            return;
+        }
+        push(Job{std::move(f), counter});
+    }
+
+    // Like submit, but only a worker runs f (inline when there are none): for jobs that
+    // block on disk, COM or the window, which must not stall a waiting frame.
+    void submit_background(std::function<void()> f, JobCounter* counter=nullptr){
+        if(counter) counter->n.fetch_add(1);
+        if(threads.empty()){
+            f();
+            if(counter) finish(*counter);
+            return;
+        }
+        { std::lock_guard<std::mutex> lk(bg.m); bg.q.push_back(Job{std::move(f), counter}); }
+        pending_bg.fetch_add(1);
+        { std::lock_guard<std::mutex> lk(sleep_m); }
+        cv.notify_all(); // a waiter may take the notification: make sure a worker sees it
+    }
+
+    // Queue f() once dep reaches zero (immediately if it already has).
+    void submit_after(JobCounter& dep, std::function<void()> f, JobCounter* counter=nullptr, bool background=false){
+        if(counter) counter->n.fetch_add(1);
+        std::function<void()> job = counter ? [this,f=std::move(f),counter]{ f(); finish(*counter); }
+                                            : std::move(f);
+        {
+            std::lock_guard<std::mutex> lk(dep.m);
+            if(!dep.done()){ dep.next.push_back({std::move(job), background}); return; }
+        }
+        if(background) submit_background(std::move(job));
+        else           submit(std::move(job));
+    }
+
+    // Block until c reaches zero, running other (non-background) jobs meanwhile.
+    void wait(JobCounter& c){
+        int self=my_index();
+        while(!c.done()){
+            if(try_run(self,false)) continue;
+            std::unique_lock<std::mutex> lk(sleep_m);
+            waiters.fetch_add(1);
+            cv.wait(lk,[&]{ return c.done() || pending.load()>0; });
+            waiters.fetch_sub(1);
+        }
+        std::lock_guard<std::mutex> lk(c.m); // let the last finish() release c
+    }
+
+    // Blocking: f(i) for i in [0,n).
+    template<typename F>
+    void parallel_for(int n, F&& f){
+        using Fn = std::remove_reference_t<F>;
+        run(n, 1, [](void* p,int i0,int i1){ for(int i=i0;i<i1;i++) (*(Fn*)p)(i); }, (void*)&f);
+    }
+    // Blocking: f(i0,i1) over [0,n) in ranges of up to grain.
+    template<typename F>
+    void parallel_range(int n, int grain, F&& f){
+        using Fn = std::remove_reference_t<F>;
+        run(n, grain, [](void* p,int i0,int i1){ (*(Fn*)p)(i0,i1); }, (void*)&f);
+    }
+
+    void run(int n, int grain, void (*f)(void*,int,int), void* ctx){
+        if(n<=0) return;
+        grain=std::max(grain,1);
+        int ranges=(n+grain-1)/grain;
+        if(threads.empty() || ranges==1){ f(ctx,0,n); return; }
+
+        std::atomic<int> next{0};
+        auto drain=[&]{
+            for(;;){
+                int r=next.fetch_add(1);
+                if(r>=ranges) break;
+                f(ctx, r*grain, std::min(n,(r+1)*grain));
+            }
+        };
+        JobCounter done;
+        int helpers=std::min(ranges-1, (int)threads.size());
+        for(int i=0;i<helpers;i++) submit([&drain]{ drain(); }, &done);
+        drain();
+        wait(done);
+    }
+
+    // Queue f() for the window thread (Win32/WIC calls); any thread.
+    void post_main(std::function<void()> f){
+        std::lock_guard<std::mutex> lk(main_m);
+        main_jobs.push_back(std::move(f));
+    }
+    // Window thread only (App::frame_begin). Jobs posted while running wait for the next call.
+    void run_main(){
+        std::vector<std::function<void()>> run;
+        { std::lock_guard<std::mutex> lk(main_m); run.swap(main_jobs); }
+        for(auto& f: run) f();
+    }
+
+private:
+    int my_index() const { return tl_owner==this ? tl_index : 0; }
+
+    void push(Job j){
+        Queue& q=*queues[(size_t)my_index()];
+        { std::lock_guard<std::mutex> lk(q.m); q.q.push_back(std::move(j)); }
+        pending.fetch_add(1);
+        { std::lock_guard<std::mutex> lk(sleep_m); }
+        cv.notify_one();
+    }
+
+    void finish(JobCounter& c){
+        std::vector<JobCounter::Next> next;
+        bool last;
+        {
+            std::lock_guard<std::mutex> lk(c.m);
+            last = c.n.fetch_sub(1)==1;
+            if(last) next.swap(c.next);
+        }
+        if(last && waiters.load()>0){
+            { std::lock_guard<std::mutex> lk(sleep_m); }
+            cv.notify_all();
+        }
+        for(auto& j: next){
+            if(j.background) submit_background(std::move(j.fn));
+            else             submit(std::move(j.fn));
+        }
+    }
+
+    // Own queue from the back, then steal from the front of the others; workers
+    // (background) then take the oldest background job.
+    bool try_run(int self,bool background){
+        Job j;
+        bool got=false, from_bg=false;
+        int nq=(int)queues.size();
+        for(int k=0;k<nq && !got;k++){
+            Queue& q=*queues[(size_t)((self+k)%nq)];
+            std::lock_guard<std::mutex> lk(q.m);
+            if(q.q.empty()) continue;
+            j = k==0 ? q.q.pop_back() : q.q.pop_front();
+            got=true;
+        }
+        if(!got && background){
+            std::lock_guard<std::mutex> lk(bg.m);
+            if(!bg.q.empty()){ j=bg.q.pop_front(); got=from_bg=true; }
+        }
+        if(!got) return false;
+        (from_bg ? pending_bg : pending).fetch_sub(1);
+        j.fn();
+        if(j.counter) finish(*j.counter);
+        return true;
+    }
+
+    void worker_main(int index){
+        tl_owner=this; tl_index=index;
+        char pname[32]; std::snprintf(pname,sizeof(pname),"worker %d",index);
+        profiler().thread_name(pname);
+        for(;;){
+            if(try_run(index,true)) continue;
+            std::unique_lock<std::mutex> lk(sleep_m);
+            cv.wait(lk,[&]{ return quit.load() || pending.load()>0 || pending_bg.load()>0; });
+            if(quit.load() && pending.load()==0 && pending_bg.load()==0) break;
+        }
+        tl_owner=nullptr;
+    }
+};
+
+// ============================================================
+// Input (edge-based, reliable buttons)
+// ============================================================
+struct Input {
+    int mouse_x=0, mouse_y=0;
+    int mouse_dx=0, mouse_dy=0;
+    int wheel=0;
+
+    std::array<bool,256> key{};
+    std::array<bool,256> key_pressed{};
+    std::array<bool,256> key_released{};
+
+    std::array<bool,5> mouse{};
+    std::array<bool,5> mouse_pressed{};
+    std::array<bool,5> mouse_released{};
+
+    void clear_edges(){
+        key_pressed.fill(false);
+        key_released.fill(false);
+        mouse_pressed.fill(false);
+        mouse_released.fill(false);
+        mouse_dx=0; mouse_dy=0; wheel=0;
+    }
+
+    // Fold one frame into this (held state copied, edges and deltas kept until cleared),
+    // so a fixed-step sim sees presses from frames in which no step ran.
+    void accumulate(const Input& f){
+        mouse_x=f.mouse_x; mouse_y=f.mouse_y;
+        mouse_dx+=f.mouse_dx; mouse_dy+=f.mouse_dy;
+        wheel+=f.wheel;
+        key=f.key; mouse=f.mouse;
+        for(size_t i=0;i<key.size();i++){ key_pressed[i]|=f.key_pressed[i]; key_released[i]|=f.key_released[i]; }
+        for(size_t i=0;i<mouse.size();i++){ mouse_pressed[i]|=f.mouse_pressed[i]; mouse_released[i]|=f.mouse_released[i]; }
+    }
+};
+
+// One record per frame: the Input the window delivered plus the frame time, so a replay
+// (App::replaying) drives the fixed-step sim exactly like the recorded run. Per frame:
+// f64 frame_time, i32 mouse x/y/dx/dy/wheel, u8 mouse held/pressed/released bits,
+// u16 n, then n x (u8 vk, u8 bits: 1 held, 2 pressed, 4 released) for keys with any state.
+struct InputLog {
+    std::vector<u8> data;
+    std::vector<u32> offs;   // start of each frame in data
+
+    int size() const { return (int)offs.size(); }
+    void clear(){ data.clear(); offs.clear(); }
+
+    template<typename T> void put(T v){
+        size_t o=data.size(); data.resize(o+sizeof(T)); std::memcpy(data.data()+o, &v, sizeof(T));
+    }
+    template<typename T> static bool get(const u8*& p, const u8* end, T& v){
+        if((size_t)(end-p)<sizeof(T)) return false;
+        std::memcpy(&v, p, sizeof(T)); p+=sizeof(T);
+        return true;
+    }
+
+    void record(const Input& in, double frame_time){
+        offs.push_back((u32)data.size());
+        put(frame_time);
+        put((i32)in.mouse_x); put((i32)in.mouse_y); put((i32)in.mouse_dx); put((i32)in.mouse_dy); put((i32)in.wheel);
+        u8 mb[3]={};
+        for(size_t i=0;i<in.mouse.size();i++){
+            mb[0]|=(u8)(in.mouse[i]<<i); mb[1]|=(u8)(in.mouse_pressed[i]<<i); mb[2]|=(u8)(in.mouse_released[i]<<i);
+        }
+        put(mb[0]); put(mb[1]); put(mb[2]);
+        size_t n_at=data.size();
+        put((u16)0);
+        u16 n=0;
+        for(size_t k=0;k<in.key.size();k++){
+            u8 bits=(u8)(in.key[k] | (in.key_pressed[k]<<1) | (in.key_released[k]<<2));
+            if(!bits) continue;
+            put((u8)k); put(bits);
+            n++;
+        }
+        std::memcpy(data.data()+n_at, &n, sizeof(n));
+    }
+
+    // Decode frame i into out (all fields overwritten). False if i is out of range.
+    bool frame(int i, Input& out, double& frame_time) const {
+        if(i<0 || i>=size()) return false;
+        const u8* p=data.data()+offs[(size_t)i];
+        const u8* end=data.data()+data.size();
+        return decode(p, end, out, frame_time);
+    }
+
+    static bool decode(const u8*& p, const u8* end, Input& out, double& frame_time){
+        out=Input{};
+        i32 v[5]; u8 mb[3]; u16 n=0;
+        if(!get(p,end,frame_time)) return false;
+        for(i32& x: v) if(!get(p,end,x)) return false;
+        for(u8& b: mb) if(!get(p,end,b)) return false;
+        if(!get(p,end,n)) return false;
+        out.mouse_x=v[0]; out.mouse_y=v[1]; out.mouse_dx=v[2]; out.mouse_dy=v[3]; out.wheel=v[4];
+        for(size_t i=0;i<out.mouse.size();i++){
+            out.mouse[i]=(mb[0]>>i)&1; out.mouse_pressed[i]=(mb[1]>>i)&1; out.mouse_released[i]=(mb[2]>>i)&1;
+        }
+        for(u16 j=0;j<n;j++){
+            u8 k=0, bits=0;
+            if(!get(p,end,k) || !get(p,end,bits)) return false;
+            out.key[k]=bits&1; out.key_pressed[k]=(bits>>1)&1; out.key_released[k]=(bits>>2)&1;
+        }
+        return true;
+    }
+
+    // Rebuilds data/offs from a serialized stream (validates every frame).
+    bool assign(const u8* p, size_t bytes, int frames){
+        clear();
+        const u8* b=p; const u8* end=p+bytes;
+        Input tmp; double ft=0;
+        for(int i=0;i<frames;i++){
+            u32 o=(u32)(p-b);
+            if(!decode(p,end,tmp,ft)){ clear(); return false; }
+            offs.push_back(o);
+        }
+        if(p!=end){ clear(); return false; }
+        data.assign(b, end);
+        return true;
+    }
+};
+
+// ============================================================
+// Canvas + primitives
+// ============================================================
+struct RectI { int x0=0,y0=0,x1=0,y1=0; };
+
+static inline bool rect_intersect(RectI a, RectI b, RectI& out){
+    out.x0=std::max(a.x0,b.x0); out.y0=std::max(a.y0,b.y0);
+    out.x1=std::min(a.x1,b.x1); out.y1=std::min(a.y1,b.y1);
+    return out.x0<=out.x1 && out.y0<=out.y1;
+}
+
+struct Image;
+
+// Filled disc for batched drawing (Canvas::discs); same pixels as circle_fill.
+struct Disc { int x=0, y=0, r=0; u32 col=0; };
+
+// Row half-widths of filled discs up to DISC_MAX: widest dx with dx*dx + dy*dy <= r*r.
+static constexpr int DISC_MAX=64;
+struct DiscTable { u8 hw[DISC_MAX+1][DISC_MAX+1]; }; // [r][|dy|]
+
+static inline const DiscTable& disc_table(){
+    static const DiscTable t=[]{
+        DiscTable d{};
+        for(int r=0;r<=DISC_MAX;r++)
+            for(int dy=0;dy<=r;dy++){
+                int rem=r*r-dy*dy, hw=0;
+                while((hw+1)*(hw+1)<=rem) hw++;
+                d.hw[r][dy]=(u8)hw;
+            }
+        return d;
+    }();
+    return t;
+}
+
+// Deferred draw command: recorded by Canvas while Canvas::rec is set,
+// replayed later per screen tile (see TiledRasterizer).
+enum class DrawOp : u8 { Clear, Rect, Line, Circle, Blit, Shade, Discs };
+
+// Screen-space multiply by a bilinearly upsampled u8 grid (255 = unchanged, 0 = black).
+// Pixel (x,y) samples the grid at u = u0 + x*dudx + y*dudy, v = v0 + x*dvdx + y*dvdy
+// (16.16 fixed point, cell centers at integers, clamped at the edges).
+struct ShadeGrid {
+    const u8* m=nullptr;
+    int w=0, h=0;
+    i32 u0=0, v0=0, dudx=0, dvdx=0, dudy=0, dvdy=0;
+};
+
+// Sample n pixels of row y starting at x into out.
+static inline void shade_grid_row(const ShadeGrid& g,int x,int y,int n,u8* out){
+    i32 u=(i32)((i64)g.u0 + (i64)x*g.dudx + (i64)y*g.dudy);
+    i32 v=(i32)((i64)g.v0 + (i64)x*g.dvdx + (i64)y*g.dvdy);
+    int wm=g.w-1, hm=g.h-1;
+    for(int i=0;i<n;i++, u+=g.dudx, v+=g.dvdx){
+        int ix=u>>16, iy=v>>16;
+        u32 fx=(u32)(u>>8)&255u, fy=(u32)(v>>8)&255u;
+        int x0=clampi(ix,0,wm), x1=clampi(ix+1,0,wm);
+        const u8* r0=g.m + (size_t)clampi(iy,0,hm)*(size_t)g.w;
+        const u8* r1=g.m + (size_t)clampi(iy+1,0,hm)*(size_t)g.w;
+        u32 top=r0[x0]*(256u-fx) + r0[x1]*fx;
+        u32 bot=r1[x0]*(256u-fx) + r1[x1]*fx;
+        out[i]=(u8)((top*(256u-fy) + bot*fy) >> 16);
+    }
+}
+
+struct DrawCmd {
+    DrawOp op=DrawOp::Rect;
+    RectI clip{};          // canvas clip at record time
+    RectI bb{};            // pixels this command can touch (already clipped)
+    int x=0,y=0,w=0,h=0;   // rect / blit dst; line: (x,y)->(w,h); circle: center (x,y), radius w
+    u32 col=0;             // color (or tint for blit)
+    const Image* img=nullptr;
+    const ShadeGrid* shade=nullptr; // must outlive the DrawList replay
+    const Disc* discs=nullptr;      // Discs: count entries, must outlive the replay
+    int count=0;
+    int sx=0,sy=0,sw=0,sh=0;
+    bool blend=true, bilinear=true;
+};
+
+struct DrawList {
+    std::vector<DrawCmd> cmds;
+
+    void clear(){ cmds.clear(); }
+    bool empty() const { return cmds.empty(); }
+    size_t size() const { return cmds.size(); }
+};
+
+// Move a recorded command by (dx,dy) (Shade grids and Disc arrays are not moved).
+static inline void draw_cmd_translate(DrawCmd& d,int dx,int dy){
+    d.clip={d.clip.x0+dx, d.clip.y0+dy, d.clip.x1+dx, d.clip.y1+dy};
+    d.bb={d.bb.x0+dx, d.bb.y0+dy, d.bb.x1+dx, d.bb.y1+dy};
+    d.x+=dx; d.y+=dy;
+    if(d.op==DrawOp::Line){ d.w+=dx; d.h+=dy; }
+}
+
+struct Canvas {
+    u32* pix=nullptr;
+    int w=0,h=0,stride=0;
+    RectI clip{};
+    DrawList* rec=nullptr; // when set, primitives record commands instead of drawing
+    const SpanKernels* kern=nullptr; // kernel override (layer_kernels), nullptr = span_kernels()
+
+    const SpanKernels& kernels() const { return kern ? *kern : span_kernels(); }
+
+    // Record d (bb = touched pixels before clipping); always "consumes" the draw.
+    void record(DrawCmd d){
+        if(!rect_intersect(d.bb, clip, d.bb)) return;
+        d.clip=clip;
+        rec->cmds.push_back(d);
+    }
+
+    void set(u32* p,int W,int H,int S){
+        pix=p; w=W; h=H; stride=S;
+        clip = {0,0,w-1,h-1};
+    }
+    void clip_reset(){ clip={0,0,w-1,h-1}; }
+    void clip_set(int x,int y,int W,int H){
+        RectI r{x,y,x+W-1,y+H-1};
+        r.x0=std::max(r.x0,0); r.y0=std::max(r.y0,0);
+        r.x1=std::min(r.x1,w-1); r.y1=std::min(r.y1,h-1);
+        clip=r;
+    }
+
+    void clear(u32 c){
+        if(rec){
+            DrawCmd d{}; d.op=DrawOp::Clear; d.col=c;
+            d.bb={0,0,w-1,h-1};
+            if(d.bb.x0>d.bb.x1||d.bb.y0>d.bb.y1) return;
+            d.clip=d.bb; // clear ignores clip
+            rec->cmds.push_back(d);
+            return;
+        }
+        const SpanKernels& k=kernels();
+        if(stride==w){ if(w*h>0) k.fill(pix, w*h, c); return; }
+        if(w>0) for(int y=0;y<h;y++) k.fill(pix + y*stride, w, c);
+    }
+
+    void rect_fill(int x,int y,int W,int H,u32 c){
+        if(W==0||H==0) return;
+        int x0=x, y0=y, x1=x+W-1, y1=y+H-1;
+        if(x0>x1) std::swap(x0,x1);
+        if(y0>y1) std::swap(y0,y1);
+
+        x0=std::max(x0,clip.x0); y0=std::max(y0,clip.y0);
+        x1=std::min(x1,clip.x1); y1=std::min(y1,clip.y1);
+        if(x0>x1||y0>y1) return;
+
+        if(rec){
+            DrawCmd d{}; d.op=DrawOp::Rect; d.x=x; d.y=y; d.w=W; d.h=H; d.col=c;
+            d.bb={x0,y0,x1,y1};
+            record(d);
+            return;
+        }
+
+        u32 a=A(c);
+        if(a==0) return;
+        const SpanKernels& k=kernels();
+        int n=x1-x0+1;
+        for(int yy=y0;yy<=y1;yy++){
+            u32* row=pix + yy*stride + x0;
+            if(a==255) k.fill(row,n,c);
+            else       k.blend_solid(row,n,c);
+        }
+    }
+
+    // Multiply the clip rect by g, one sampled span per row (see ShadeGrid).
+    void shade(const ShadeGrid& g){
+        if(!g.m || g.w<=0 || g.h<=0) return;
+        if(rec){
+            DrawCmd d{}; d.op=DrawOp::Shade; d.shade=&g;
+            d.bb=clip;
+            record(d);
+            return;
+        }
+        u8 buf[256];
+        for(int y=clip.y0;y<=clip.y1;y++){
+            u32* row=pix + y*stride;
+            for(int x=clip.x0;x<=clip.x1;x+=256){
+                int n=std::min(256, clip.x1-x+1);
+                shade_grid_row(g,x,y,n,buf);
+                kernels().mul(row+x,buf,n);
+            }
+        }
+    }
+
+    void rect_outline(int x,int y,int W,int H,int t,u32 c){
+        if(t<=0) return;
+        rect_fill(x,y,W,t,c);
+        rect_fill(x,y+H-t,W,t,c);
+        rect_fill(x,y,t,H,c);
+        rect_fill(x+W-t,y,t,H,c);
+    }
+
+    void line(int x0,int y0,int x1,int y1,u32 c){
+        if(rec){
+            DrawCmd d{}; d.op=DrawOp::Line; d.x=x0; d.y=y0; d.w=x1; d.h=y1; d.col=c;
+            d.bb={std::min(x0,x1),std::min(y0,y1),std::max(x0,x1),std::max(y0,y1)};
+            record(d);
+            return;
+        }
+        int dx=std::abs(x1-x0), sx=x0<x1?1:-1;
+        int dy=-std::abs(y1-y0), sy=y0<y1?1:-1;
+        int err=dx+dy;
+        for(;;){
+            if(x0>=clip.x0 && x0<=clip.x1 && y0>=clip.y0 && y0<=clip.y1){
+                u32* p = pix + y0*stride + x0;
+                if(kern) kern->blend_solid(p,1,c);
+                else     *p = blend_over(*p,c);
+            }
+            if(x0==x1 && y0==y1) break;
+            int e2=2*err;
+            if(e2>=dy){ err+=dy; x0+=sx; }
+            if(e2<=dx){ err+=dx; y0+=sy; }
+        }
+    }
+
+    void circle_fill(int cx,int cy,int r,u32 c){
+        if(r<=0) return;
+        if(rec){
+            int x0=std::max(cx-r,clip.x0), x1=std::min(cx+r,clip.x1);
+            int y0=std::max(cy-r,clip.y0), y1=std::min(cy+r,clip.y1);
+            DrawCmd d{}; d.op=DrawOp::Circle; d.x=cx; d.y=cy; d.w=r; d.col=c;
+            d.bb={x0,y0,x1,y1};
+            record(d);
+            return;
+        }
+        disc_spans(cx,cy,r,c);
+    }
+
+    // Draw n discs in order (one DrawCmd for the batch while recording).
+    void discs(const Disc* d,int n){
+        if(n<=0) return;
+        if(rec){
+            DrawCmd cmd{}; cmd.op=DrawOp::Discs; cmd.discs=d; cmd.count=n;
+            RectI bb{d[0].x-d[0].r, d[0].y-d[0].r, d[0].x+d[0].r, d[0].y+d[0].r};
+            for(int i=1;i<n;i++){
+                bb.x0=std::min(bb.x0,d[i].x-d[i].r); bb.y0=std::min(bb.y0,d[i].y-d[i].r);
+                bb.x1=std::max(bb.x1,d[i].x+d[i].r); bb.y1=std::max(bb.y1,d[i].y+d[i].r);
+            }
+            cmd.bb=bb;
+            record(cmd);
+            return;
+        }
+        for(int i=0;i<n;i++) if(d[i].r>0) disc_spans(d[i].x,d[i].y,d[i].r,d[i].col);
+    }
+
+    // Immediate disc: one blend span per row, half-widths from disc_table up to DISC_MAX.
+    void disc_spans(int cx,int cy,int r,u32 c){
+        int x0=std::max(cx-r,clip.x0), x1=std::min(cx+r,clip.x1);
+        int y0=std::max(cy-r,clip.y0), y1=std::min(cy+r,clip.y1);
+        if(x0>x1 || y0>y1 || A(c)==0) return;
+        const SpanKernels& k=kernels();
+        const u8* tab = r<=DISC_MAX ? disc_table().hw[r] : nullptr;
+        int rr=r*r;
+        for(int y=y0;y<=y1;y++){
+            int dy=y-cy;
+            int hw;
+            if(tab) hw=tab[dy<0?-dy:dy];
+            else{
+                // widest dx with dx*dx <= rem (exact integer sqrt)
+                int rem=rr-dy*dy;
+                hw=(int)std::sqrt((f32)rem);
+                while(hw*hw>rem) hw--;
+                while((hw+1)*(hw+1)<=rem) hw++;
+            }
+            int sx0=std::max(cx-hw,x0), sx1=std::min(cx+hw,x1);
+            if(sx0>sx1) continue;
+            k.blend_solid(pix + y*stride + sx0, sx1-sx0+1, c);
+        }
+    }
+};
+
+// FNV-1a 64 over the visible w x h pixels (stride padding ignored): a cheap fingerprint
+// for comparing frames across kernel levels, thread counts and raster modes.
+static inline u64 canvas_hash(const Canvas& c){
+    u64 h=1469598103934665603ull;
+    for(int y=0;y<c.h;y++){
+        const u32* row=c.pix+(size_t)y*(size_t)c.stride;
+        for(int x=0;x<c.w;x++){ h^=row[x]; h*=1099511628211ull; }
+    }
+    h^=(u64)c.w<<32 | (u64)(u32)c.h;
+    return h*1099511628211ull;
+}
+
+// ============================================================
+// Built-in bitmap font (robust, spacing fixed, no random '?')
+// ============================================================
+static inline void glyph5x7(char ch, u8 out[7]){
+    // uppercase
+    if(ch>='a' && ch<='z') ch = char(ch - 'a' + 'A');
+
+    // default '?'
+    u8 q[7]={0x0E,0x11,0x02,0x04,0x04,0x00,0x04};
+    std::memcpy(out,q,7);
+
+    auto set=[&](std::initializer_list<u8> rows){
+        int i=0;
+        for(u8 v: rows){ out[i++]=v; }
+    };
+
+    switch(ch){
+        case ' ': set({0,0,0,0,0,0,0}); return;
+        case '.': set({0,0,0,0,0,0,0x04}); return;
         case ',': set({0,0,0,0,0x04,0x04,0x08}); return;
         case '!': set({0x04,0x04,0x04,0x04,0x04,0,0x04}); return;
         case '-': set({0,0,0,0x1F,0,0,0}); return;
@@ -334,6 +1791,40 @@ static inline void glyph5x7(char ch, u8 out[7]){
     }
 }
 
+// glyph5x7 for every byte, resolved once, plus the horizontal runs of each row.
+struct FontGlyph {
+    u8 rows[7];       // bit 4 = left column
+    u8 nrun[7];       // runs per row (at most 3 in 5 columns)
+    u8 rx0[7][3], rx1[7][3]; // run columns [rx0,rx1)
+    bool blank;
+};
+struct FontTable { FontGlyph g[256]; };
+
+static inline const FontTable& font_table(){
+    static const FontTable t=[]{
+        FontTable f{};
+        for(int ch=0; ch<256; ch++){
+            FontGlyph& g=f.g[ch];
+            glyph5x7((char)ch, g.rows);
+            g.blank=true;
+            for(int ry=0; ry<7; ry++){
+                u8 bits=g.rows[ry];
+                g.nrun[ry]=0;
+                for(int rx=0; rx<5;){
+                    if(!(bits & (0x10u>>rx))){ rx++; continue; }
+                    int e=rx+1;
+                    while(e<5 && (bits & (0x10u>>e))) e++;
+                    g.rx0[ry][g.nrun[ry]]=(u8)rx; g.rx1[ry][g.nrun[ry]]=(u8)e; g.nrun[ry]++;
+                    rx=e;
+                }
+                if(bits) g.blank=false;
+            }
+        }
+        return f;
+    }();
+    return t;
+}
+
 static inline int text_width(const char* s,int scale){
     int adv=6*scale;
     int w=0, best=0;
@@ -349,52 +1840,35 @@ static inline int text_width(const char* s,int scale){
 }
 static inline int text_line_h(int scale){ return 7*scale; }
 
-static inline void draw_text(Canvas& c,int x,int y,int scale,u32 col,const char* s){
-    int adv=6*scale;
-    int lh=text_line_h(scale);
-    int gap=2*scale;
+// ============================================================
+// WIC image loader (PNG/JPG/BMP/...)
+// ============================================================
 
-    int cx=x, cy=y;
-    for(const char* p=s; *p; ++p){
-        char ch=*p;
-        if(ch=='\r') continue;
-        if(ch=='\n'){ cx=x; cy += lh + gap; continue; }
-        if(ch=='\t'){ cx += 4*adv; continue; }
+struct Image {
+    int w=0,h=0;
+    std::vector<u32> px; // AARRGGBB
+    bool premul=false;        // rgb already multiplied by alpha (premultiply): cheaper blend path
+    std::vector<Image> mips;  // mips[i] is level i+1, half the size of the one before (build_mips)
+    u64 gen=0;                // content generation: touch() after writing px so caches see it
 
-        u8 rows[7]; glyph5x7(ch, rows);
-
-        for(int ry=0; ry<7; ry++){
-            u8 bits=rows[ry];
-            for(int rx=0; rx<5; rx++){
-                bool on = (bits & (1u << (4-rx))) != 0;
-                if(on){
-                    c.rect_fill(cx + rx*scale, cy + ry*scale, scale, scale, col);
-                }
-            }
-        }
-        cx += adv;
-    }
-}
-
-// ============================================================
-// WIC image loader (PNG/JPG/BMP/...)
-// ============================================================
-
-struct Image {
-    int w=0,h=0;
-    std::vector<u32> px; // AARRGGBB
-
-    bool empty() const { return w<=0 || h<=0 || px.empty(); }
-};
+    bool empty() const { return w<=0 || h<=0 || px.empty(); }
+    void touch(){ static std::atomic<u64> next{0}; gen=++next; } // process-wide unique
+};
 
 struct WIC {
     IWICImagingFactory* fac = nullptr;
     bool com_inited = false;
     bool com_need_uninit = false;
 
-    bool init() {
+    WIC() = default;
+    WIC(const WIC&) = delete;
+    WIC& operator=(const WIC&) = delete;
+    ~WIC() { shutdown(); } // must run on the thread that called init (CoUninitialize is per thread)
+
+    // coinit: COINIT_APARTMENTTHREADED on the window thread, COINIT_MULTITHREADED on workers.
+    bool init(DWORD coinit = COINIT_APARTMENTTHREADED) {
         if (!com_inited) {
-            HRESULT hr = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
+            HRESULT hr = CoInitializeEx(nullptr, coinit);
             com_inited = true;
             if (SUCCEEDED(hr)) com_need_uninit = true;
         }
@@ -428,17 +1902,31 @@ struct WIC {
         MultiByteToWideChar(cp, 0, src, -1, out.data(), need);
         return true;
     }
+    // Same, into arena memory (nullptr on failure).
+    static const wchar_t* mb_to_wide(const char* src, Arena& a) {
+        UINT cp = CP_UTF8;
+        int need = MultiByteToWideChar(cp, 0, src, -1, nullptr, 0);
+        if (need == 0) {
+            cp = CP_ACP;
+            need = MultiByteToWideChar(cp, 0, src, -1, nullptr, 0);
+            if (need == 0) return nullptr;
+        }
+        wchar_t* w = a.alloc_array<wchar_t>((size_t)need);
+        MultiByteToWideChar(cp, 0, src, -1, w, need);
+        return w;
+    }
 
     bool load(Image& out, const char* path) {
         out = {};
         if (!init()) return false;
 
-        std::wstring wpath;
-        if (!mb_to_wide(path, wpath)) return false;
+        ScratchScope scope;
+        const wchar_t* wpath = mb_to_wide(path, scope.a);
+        if (!wpath) return false;
 
         IWICBitmapDecoder* dec = nullptr;
         HRESULT hr = fac->CreateDecoderFromFilename(
-            wpath.c_str(),
+            wpath,
             nullptr,
             GENERIC_READ,
             WICDecodeMetadataCacheOnLoad,
@@ -473,28 +1961,18 @@ struct WIC {
 
         out.w = (int)W;
         out.h = (int)H;
-        out.px.assign((size_t)W * (size_t)H, 0);
+        out.px.resize((size_t)W * (size_t)H);
+        out.touch();
 
+        // 32bppBGRA bytes are AARRGGBB little-endian: decode straight into px
         const UINT stride = W * 4u;
-        std::vector<u8> tmp((size_t)stride * (size_t)H);
-
-        hr = conv->CopyPixels(nullptr, stride, (UINT)tmp.size(), tmp.data());
+        hr = conv->CopyPixels(nullptr, stride, (UINT)(out.px.size() * 4u), (BYTE*)out.px.data());
         if (FAILED(hr)) {
             conv->Release(); frame->Release(); dec->Release();
             out = {};
             return false;
         }
 
-        // BGRA -> AARRGGBB
-        for (UINT y = 0; y < H; y++) {
-            const u8* row = tmp.data() + (size_t)y * stride;
-            for (UINT x = 0; x < W; x++) {
-                const u8* p = row + x * 4u;
-                u8 B_ = p[0], G_ = p[1], R_ = p[2], A_ = p[3];
-                out.px[(size_t)y * (size_t)W + x] = RGBA(R_, G_, B_, A_);
-            }
-        }
-
         conv->Release();
         frame->Release();
         dec->Release();
@@ -530,15 +2008,88 @@ static inline u32 sample_bilinear(const Image& img,f32 u,f32 v){
     u32 aa=(u32)lerp(a0,a1,ty);
     return RGBA(rr,gg,bb,aa);
 }
+static inline u32 div255(u32 x){ return ((x+1u)*257u)>>16; } // exact floor(x/255) for x<=65025
+
 static inline u32 mul_color(u32 c,u32 tint){
     // multiply RGB, alpha keeps src alpha * tint alpha
-    u32 rr=(R(c)*R(tint))/255u;
-    u32 gg=(G(c)*G(tint))/255u;
-    u32 bb=(B(c)*B(tint))/255u;
-    u32 aa=(A(c)*A(tint))/255u;
+    u32 rr=div255(R(c)*R(tint));
+    u32 gg=div255(G(c)*G(tint));
+    u32 bb=div255(B(c)*B(tint));
+    u32 aa=div255(A(c)*A(tint));
     return RGBA(rr,gg,bb,aa);
 }
 
+// 4-channel lerp with an 8-bit weight (t=0..255), two channels per multiply
+static inline u32 lerp8x4(u32 a,u32 b,u32 t){
+    u32 it=256u-t;
+    u32 rb=((a&0x00FF00FFu)*it + (b&0x00FF00FFu)*t)>>8;
+    u32 ag=(((a>>8)&0x00FF00FFu)*it + ((b>>8)&0x00FF00FFu)*t)>>8;
+    return (rb&0x00FF00FFu) | ((ag&0x00FF00FFu)<<8);
+}
+
+// One destination row of a blit, in 16.16 source space.
+struct BlitRow {
+    const u32* r0=nullptr;   // source row (nearest) / top row (bilinear)
+    const u32* r1=nullptr;   // bottom row (bilinear)
+    u32 fy=0;                // vertical weight 0..255
+    i64 u=0, du=0;           // source x of the first pixel, step per pixel
+    int ia=0, ib=0;          // pixels [ia,ib) need no horizontal clamping
+    int w=0;                 // source width
+    u32 tint=0xFFFFFFFFu;
+};
+
+template<bool Bilinear,bool Clamp>
+static inline u32 blit_fetch(const BlitRow& r,i64 u){
+    if constexpr(Bilinear){
+        int x0=(int)(u>>16), x1=x0+1;
+        u32 fx=(u32)(u>>8)&255u;
+        if constexpr(Clamp){ x0=clampi(x0,0,r.w-1); x1=clampi(x1,0,r.w-1); }
+        return lerp8x4(lerp8x4(r.r0[x0],r.r0[x1],fx), lerp8x4(r.r1[x0],r.r1[x1],fx), r.fy);
+    }else{
+        int x=(int)((u+0x8000)>>16);
+        if constexpr(Clamp) x=clampi(x,0,r.w-1);
+        return r.r0[x];
+    }
+}
+
+template<bool Bilinear,bool Tint,bool Clamp>
+static inline void blit_run(u32* out,int a,int b,const BlitRow& r){
+    i64 u=r.u + (i64)a*r.du;
+    for(int i=a;i<b;i++,u+=r.du){
+        u32 c=blit_fetch<Bilinear,Clamp>(r,u);
+        if constexpr(Tint) c=mul_color(c,r.tint);
+        out[i]=c;
+    }
+}
+
+// Border pixels clamp, the interior reads straight from the source rows.
+template<bool Bilinear,bool Tint>
+static inline void blit_row(u32* out,int n,const BlitRow& r){
+    blit_run<Bilinear,Tint,true >(out,0,r.ia,r);
+    blit_run<Bilinear,Tint,false>(out,r.ia,r.ib,r);
+    blit_run<Bilinear,Tint,true >(out,r.ib,n,r);
+}
+
+using BlitRowFn = void(*)(u32* out,int n,const BlitRow& r);
+
+// Pixels i in [0,n) with lo <= u0 + i*du <= hi, as a half-open range [ia,ib).
+static inline void blit_interior(i64 u0,i64 du,i64 lo,i64 hi,int n,int& ia,int& ib){
+    i64 a=0, b=0;
+    if(du>0){
+        a = (u0>=lo) ? 0 : (lo-u0+du-1)/du;
+        b = (u0>hi)  ? 0 : (hi-u0)/du + 1;
+    }else if(du<0){
+        i64 nd=-du;
+        a = (u0<=hi) ? 0 : (u0-hi+nd-1)/nd;
+        b = (u0<lo)  ? 0 : (u0-lo)/nd + 1;
+    }else{
+        b = (u0>=lo && u0<=hi) ? n : 0;
+    }
+    a=std::min<i64>(std::max<i64>(a,0),n);
+    b=std::min<i64>(std::max<i64>(b,a),n);
+    ia=(int)a; ib=(int)b;
+}
+
 static inline void blit(Canvas& dst, int dx,int dy,int dw,int dh,
                         const Image& img, int sx,int sy,int sw,int sh,
                         bool blend=true, bool bilinear=true, u32 tint=RGBA(255,255,255,255))
@@ -546,6 +2097,16 @@ static inline void blit(Canvas& dst, int dx,int dy,int dw,int dh,
     if(img.empty()) return;
     if(dw==0||dh==0||sw<=0||sh<=0) return;
 
+    // minified: sample the smallest mip level that still covers the destination size
+    if(!img.mips.empty()){
+        int adw=std::abs(dw), adh=std::abs(dh), L=0;
+        while(L<(int)img.mips.size() && (sw>>(L+1))>=adw && (sh>>(L+1))>=adh) L++;
+        if(L>0){
+            blit(dst, dx,dy,dw,dh, img.mips[(size_t)L-1], sx>>L,sy>>L, sw>>L,sh>>L, blend,bilinear,tint);
+            return;
+        }
+    }
+
     int x0=dx, y0=dy, x1=dx+dw-1, y1=dy+dh-1;
     if(x0>x1) std::swap(x0,x1);
     if(y0>y1) std::swap(y0,y1);
@@ -554,55 +2115,807 @@ static inline void blit(Canvas& dst, int dx,int dy,int dw,int dh,
     x1=std::min(x1,dst.clip.x1); y1=std::min(y1,dst.clip.y1);
     if(x0>x1||y0>y1) return;
 
+    if(dst.rec){
+        DrawCmd d{}; d.op=DrawOp::Blit;
+        d.x=dx; d.y=dy; d.w=dw; d.h=dh; d.col=tint;
+        d.img=&img; d.sx=sx; d.sy=sy; d.sw=sw; d.sh=sh;
+        d.blend=blend; d.bilinear=bilinear;
+        d.bb={x0,y0,x1,y1};
+        dst.record(d);
+        return;
+    }
+
+    const SpanKernels& k=dst.kernels();
+    const bool tinted = tint!=0xFFFFFFFFu;
+    const int n=x1-x0+1;
+    auto blend_fn = img.premul ? k.blend_pm : k.blend;
+    if(img.premul) tint=RGBA(div255(R(tint)*A(tint)), div255(G(tint)*A(tint)), div255(B(tint)*A(tint)), A(tint));
+
+    // exact 1:1 copy: both samplers land on texel centers, so rows are copied/blended as-is
+    if(dw==sw && dh==sh && !tinted && sx>=0 && sy>=0 && sx+sw<=img.w && sy+sh<=img.h){
+        for(int y=y0;y<=y1;y++){
+            const u32* src=img.px.data() + (size_t)(sy+y-dy)*(size_t)img.w + (size_t)(sx+x0-dx);
+            u32* row=dst.pix + y*dst.stride + x0;
+            if(blend) blend_fn(row,src,n);
+            else      std::memcpy(row,src,(size_t)n*sizeof(u32));
+        }
+        return;
+    }
+
+    // pick the sampler once per call
+    BlitRowFn fn = bilinear ? (tinted ? blit_row<true,true>  : blit_row<true,false>)
+                            : (tinted ? blit_row<false,true> : blit_row<false,false>);
+
+    // 16.16 source coordinates: u(x) = sx + (x-dx)*du. Depends only on x (never on the
+    // clipped start), so tiles of the deferred rasterizer sample exactly like one big blit.
+    BlitRow r{};
+    r.w=img.w; r.tint=tint;
+    r.du=((i64)sw<<16)/dw;
+    r.u=((i64)sx<<16) + (i64)(x0-dx)*r.du;
+    i64 lo = bilinear ? 0 : -0x8000;
+    i64 hi = bilinear ? ((i64)(img.w-1)<<16)-1 : ((i64)(img.w-1)<<16)+0x7FFF;
+    blit_interior(r.u,r.du,lo,hi,n,r.ia,r.ib);
+
+    u32 span[256];
     for(int y=y0;y<=y1;y++){
-        f32 v=(f32)(y-dy)/(f32)dh;
-        f32 py=(f32)sy + v*(f32)sh;
-        u32* row = dst.pix + y*dst.stride;
+        i64 v=((i64)sy<<16) + (((i64)(y-dy)*(i64)sh)<<16)/dh;
+        if(bilinear){
+            int ty0=clampi((int)(v>>16),0,img.h-1), ty1=clampi((int)(v>>16)+1,0,img.h-1);
+            r.r0=img.px.data() + (size_t)ty0*(size_t)img.w;
+            r.r1=img.px.data() + (size_t)ty1*(size_t)img.w;
+            r.fy=(u32)(v>>8)&255u;
+        }else{
+            int ty=clampi((int)((v+0x8000)>>16),0,img.h-1);
+            r.r0=r.r1=img.px.data() + (size_t)ty*(size_t)img.w;
+        }
+
+        u32* row=dst.pix + y*dst.stride + x0;
+        if(!blend){ fn(row,n,r); continue; } // no-blend: sample straight into the destination
+
+        // blend: sample 256-pixel chunks into a stack span, then blend with the span kernel
+        for(int off=0; off<n; off+=256){
+            int m=std::min(256, n-off);
+            BlitRow c=r;
+            c.u = r.u + (i64)off*r.du;
+            c.ia=clampi(r.ia-off,0,m);
+            c.ib=clampi(r.ib-off,c.ia,m);
+            fn(span,m,c);
+            blend_fn(row+off, span, m);
+        }
+    }
+}
+
+// ============================================================
+// Premultiplied alpha, mip chains, texture atlas
+// ============================================================
+// Call premultiply before build_mips (premultiplied levels average with plain shifts).
+static inline void premultiply(Image& img){
+    if(!img.premul){
+        for(u32& c: img.px){
+            u32 a=A(c);
+            if(a!=255) c=RGBA(div255(R(c)*a), div255(G(c)*a), div255(B(c)*a), a);
+        }
+        img.premul=true;
+        img.touch();
+    }
+    for(Image& m: img.mips) premultiply(m);
+}
+
+// 2x2 box filter down to 1x1 (or max_levels). Straight alpha is alpha-weighted so
+// transparent texels don't darken the edges; premultiplied levels are a plain average.
+static inline void build_mips(Image& img,int max_levels=16){
+    img.mips.clear();
+    if(img.empty()) return;
+    int n=0;
+    for(int w=img.w,h=img.h; (w>1||h>1) && n<max_levels; w=std::max(w>>1,1), h=std::max(h>>1,1)) n++;
+    img.mips.reserve((size_t)n); // src points into mips
+    const Image* src=&img;
+    for(int l=0;l<n;l++){
+        Image m;
+        m.w=std::max(src->w>>1,1); m.h=std::max(src->h>>1,1);
+        m.premul=img.premul;
+        m.px.resize((size_t)m.w*(size_t)m.h);
+        m.touch();
+        for(int y=0;y<m.h;y++){
+            const u32* r0=src->px.data() + (size_t)std::min(2*y,  src->h-1)*(size_t)src->w;
+            const u32* r1=src->px.data() + (size_t)std::min(2*y+1,src->h-1)*(size_t)src->w;
+            for(int x=0;x<m.w;x++){
+                int xa=std::min(2*x,src->w-1), xb=std::min(2*x+1,src->w-1);
+                u32 q[4]={ r0[xa], r0[xb], r1[xa], r1[xb] };
+                u32 sa=0, sr=0, sg=0, sb=0;
+                if(img.premul){
+                    for(u32 c: q){ sa+=A(c); sr+=R(c); sg+=G(c); sb+=B(c); }
+                    m.px[(size_t)y*(size_t)m.w + (size_t)x]=RGBA((sr+2)>>2, (sg+2)>>2, (sb+2)>>2, (sa+2)>>2);
+                }else{
+                    for(u32 c: q){ u32 a=A(c); sa+=a; sr+=R(c)*a; sg+=G(c)*a; sb+=B(c)*a; }
+                    u32 o = sa ? RGBA((sr+sa/2)/sa, (sg+sa/2)/sa, (sb+sa/2)/sa, (sa+2)>>2) : 0u;
+                    m.px[(size_t)y*(size_t)m.w + (size_t)x]=o;
+                }
+            }
+        }
+        img.mips.push_back(std::move(m));
+        src=&img.mips.back();
+    }
+}
+
+struct AtlasRect { int x=0,y=0,w=0,h=0; };
+
+struct Atlas {
+    Image img;
+    std::vector<AtlasRect> rects; // by AtlasBuilder::add handle (w=h=0: source was empty)
+
+    const AtlasRect& rect(int handle) const { return rects[(size_t)handle]; }
+};
+
+// Shelf packer: tallest first, left to right, a new shelf when the row is full.
+// Each rect gets a border of its own edge texels so bilinear taps never reach a neighbour.
+struct AtlasBuilder {
+    int pad=1;        // border texels around every rect
+    int align=1;      // rect origins/sizes snap to this: 1<<levels keeps each mip level inside its rect
+    int max_w=2048;   // atlas width limit (height grows as needed)
+
+    struct Src { const Image* img=nullptr; int sx=0,sy=0,sw=0,sh=0; };
+    std::vector<Src> srcs;
+
+    // Queue img (or its sub-rect; sw/sh<=0 means to the edge). Returns the handle.
+    // img must stay alive until build().
+    int add(const Image* img,int sx=0,int sy=0,int sw=0,int sh=0){
+        Src s{};
+        if(img && !img->empty()){
+            s.img=img;
+            s.sx=clampi(sx,0,img->w); s.sy=clampi(sy,0,img->h);
+            s.sw=(sw>0)? std::min(sw,img->w-s.sx) : img->w-s.sx;
+            s.sh=(sh>0)? std::min(sh,img->h-s.sy) : img->h-s.sy;
+            if(s.sw<=0||s.sh<=0) s=Src{};
+        }
+        srcs.push_back(s);
+        return (int)srcs.size()-1;
+    }
+
+    void clear(){ srcs.clear(); }
+
+    // False if some rect (plus border) is wider than max_w.
+    bool build(Atlas& out) const {
+        int al=std::max(align,1);
+        auto up=[&](int v){ return (v+al-1)/al*al; };
+        int pd=up(std::max(pad,0));
+
+        std::vector<int> order;
+        for(int i=0;i<(int)srcs.size();i++) if(srcs[(size_t)i].img) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&](int a,int b){
+            const Src& x=srcs[(size_t)a]; const Src& y=srcs[(size_t)b];
+            return x.sh!=y.sh ? x.sh>y.sh : x.sw>y.sw;
+        });
+
+        out.img=Image{};
+        out.rects.assign(srcs.size(), AtlasRect{});
+        int x=0, y=0, shelf=0, W=0;
+        for(int i: order){
+            const Src& s=srcs[(size_t)i];
+            int cw=up(s.sw+2*pd), ch=up(s.sh+2*pd);
+            if(cw>max_w) return false;
+            if(x+cw>max_w){ y+=shelf; x=0; shelf=0; }
+            out.rects[(size_t)i]=AtlasRect{x+pd, y+pd, s.sw, s.sh};
+            x+=cw; shelf=std::max(shelf,ch); W=std::max(W,x);
+        }
+        int H=y+shelf;
+        if(W==0||H==0) return true;
+
+        out.img.w=W; out.img.h=H;
+        out.img.px.assign((size_t)W*(size_t)H, 0);
+        out.img.touch();
+        for(int i: order){
+            const Src& s=srcs[(size_t)i];
+            const AtlasRect& r=out.rects[(size_t)i];
+            for(int y2=-pd; y2<s.sh+pd; y2++){
+                const u32* src=s.img->px.data() + (size_t)(s.sy+clampi(y2,0,s.sh-1))*(size_t)s.img->w + (size_t)s.sx;
+                u32* dst=out.img.px.data() + (size_t)(r.y+y2)*(size_t)W + (size_t)r.x;
+                for(int x2=-pd; x2<s.sw+pd; x2++) dst[x2]=src[clampi(x2,0,s.sw-1)];
+            }
+        }
+        return true;
+    }
+};
+
+// ============================================================
+// Text (glyph runs, glyph atlas, cached layouts)
+// ============================================================
+// Calls fn(glyph, x, y) for every visible glyph cell of s drawn at (x,y).
+template<class F>
+static inline void text_each(const char* s,int x,int y,int scale,F&& fn){
+    const FontTable& f=font_table();
+    int adv=6*scale;
+    int lh=text_line_h(scale);
+    int gap=2*scale;
+    int cx=x, cy=y;
+    for(const char* p=s; *p; ++p){
+        char ch=*p;
+        if(ch=='\r') continue;
+        if(ch=='\n'){ cx=x; cy += lh + gap; continue; }
+        if(ch=='\t'){ cx += 4*adv; continue; }
+        const FontGlyph& g=f.g[(u8)ch];
+        if(!g.blank) fn(g, cx, cy);
+        cx += adv;
+    }
+}
+
+// One glyph as clipped spans: each run covers scale pixels per font column, and
+// identical consecutive rows are merged into one taller block.
+// fill: store col as-is (building a layout surface) instead of blending.
+static inline void glyph_spans(Canvas& c,int x,int y,int scale,u32 col,const FontGlyph& g,bool fill){
+    if(!fill && A(col)==0) return;
+    const SpanKernels& k=c.kernels();
+    bool solid = fill || A(col)==255;
+    for(int ry=0; ry<7;){
+        int re=ry+1;
+        while(re<7 && g.rows[re]==g.rows[ry]) re++;
+        int y0=std::max(y+ry*scale, c.clip.y0), y1=std::min(y+re*scale-1, c.clip.y1);
+        for(int r=0; r<g.nrun[ry] && y0<=y1; r++){
+            int x0=std::max(x+g.rx0[ry][r]*scale, c.clip.x0), x1=std::min(x+g.rx1[ry][r]*scale-1, c.clip.x1);
+            if(x0>x1) continue;
+            for(int yy=y0; yy<=y1; yy++){
+                u32* row=c.pix + yy*c.stride + x0;
+                if(solid) k.fill(row,x1-x0+1,col);
+                else      k.blend_solid(row,x1-x0+1,col);
+            }
+        }
+        ry=re;
+    }
+}
+
+// All 256 glyphs at one scale, white on transparent (16x16 cells); colour comes from
+// the blit tint, so one atlas serves every colour. Used when the canvas records.
+struct GlyphAtlas {
+    int scale=0, cw=0, ch=0;
+    Image img;
+};
+
+static inline const GlyphAtlas& glyph_atlas(int scale){
+    static std::mutex mu;
+    static std::vector<std::unique_ptr<GlyphAtlas>> cache; // by scale, never freed (draw lists point in)
+    std::lock_guard<std::mutex> lk(mu);
+    if((int)cache.size()<=scale) cache.resize((size_t)scale+1);
+    auto& slot=cache[(size_t)scale];
+    if(!slot){
+        slot=std::make_unique<GlyphAtlas>();
+        GlyphAtlas& a=*slot;
+        a.scale=scale; a.cw=5*scale; a.ch=7*scale;
+        a.img.w=16*a.cw; a.img.h=16*a.ch;
+        a.img.px.assign((size_t)a.img.w*(size_t)a.img.h, 0);
+        a.img.touch();
+        Canvas ac{};
+        ac.set(a.img.px.data(), a.img.w, a.img.h, a.img.w);
+        const FontTable& f=font_table();
+        for(int gi=0; gi<256; gi++)
+            glyph_spans(ac, (gi&15)*a.cw, (gi>>4)*a.ch, scale, 0xFFFFFFFFu, f.g[gi], true);
+    }
+    return *slot;
+}
+
+// Immediate: one span per glyph run. Recording: one 1:1 tinted atlas blit per glyph
+// (white*tint == col, so the replay matches the immediate image exactly).
+static inline void draw_text(Canvas& c,int x,int y,int scale,u32 col,const char* s){
+    if(scale<=0) return;
+    if(c.rec){
+        const GlyphAtlas& ga=glyph_atlas(scale);
+        const FontGlyph* g0=font_table().g;
+        text_each(s,x,y,scale,[&](const FontGlyph& g,int cx,int cy){
+            int gi=(int)(&g-g0);
+            blit(c, cx,cy, ga.cw,ga.ch, ga.img, (gi&15)*ga.cw, (gi>>4)*ga.ch, ga.cw,ga.ch, true,false,col);
+        });
+        return;
+    }
+    text_each(s,x,y,scale,[&](const FontGlyph& g,int cx,int cy){ glyph_spans(c,cx,cy,scale,col,g,false); });
+}
+
+// Retained text: s pre-rendered once in col on transparent; draw is one 1:1 blit
+// (pixel-identical to draw_text). set() only rebuilds when the text or style changes.
+struct TextLayout {
+    std::string text;
+    int scale=0;
+    u32 col=0;
+    int w=0, h=0;
+    Image surf;
+
+    bool set(const char* s,int sc,u32 c){
+        if(sc==scale && c==col && text==s) return false;
+        text=s; scale=sc; col=c;
+        int lines=1;
+        for(const char* p=s; *p; ++p) if(*p=='\n') lines++;
+        w = sc>0 ? text_width(s,sc) : 0;
+        h = sc>0 ? lines*(text_line_h(sc)+2*sc) - 2*sc : 0;
+        surf=Image{};
+        if(w<=0 || h<=0) return true;
+        surf.w=w; surf.h=h;
+        surf.px.assign((size_t)w*(size_t)h, 0);
+        surf.touch();
+        Canvas tc{};
+        tc.set(surf.px.data(), w,h,w);
+        text_each(s,0,0,sc,[&](const FontGlyph& g,int cx,int cy){ glyph_spans(tc,cx,cy,sc,c,g,true); });
+        return true;
+    }
 
-        for(int x=x0;x<=x1;x++){
-            f32 u=(f32)(x-dx)/(f32)dw;
-            f32 px=(f32)sx + u*(f32)sw;
+    void draw(Canvas& dst,int x,int y) const {
+        if(!surf.empty()) blit(dst, x,y, surf.w,surf.h, surf, 0,0,surf.w,surf.h, true,false);
+    }
+};
+
+// Per-string cache for static labels: memoized text_width and retained layouts keyed by
+// (text, scale[, col]). Strings unused for a frame are dropped once over max_entries.
+// A string is only cached from its second sighting: one-off per-frame text (counters,
+// coordinates) is measured and drawn uncached instead of churning the maps.
+struct TextCache {
+    struct Width  { int w=0; u32 used=0; };
+    struct Layout { TextLayout lay; u32 used=0; };
+    std::unordered_map<std::string,Width>  widths;
+    std::unordered_map<std::string,Layout> layouts; // nodes are stable: recorded blits stay valid
+    size_t max_entries=512;
+    u32 frame=0;
+    std::string key; // lookup buffer, keeps its capacity
+    u64 seen[256]={}; // key hashes met once, direct-mapped
+
+    // True if key was met before; otherwise remember it.
+    bool seen_before(){
+        u64 h=14695981039346656037ull;
+        for(char ch: key){ h^=(u8)ch; h*=1099511628211ull; }
+        u64& slot=seen[h & 255];
+        if(slot==h) return true;
+        slot=h;
+        return false;
+    }
 
-            u32 src = bilinear ? sample_bilinear(img,px,py) : texel_clamp(img,(int)(px+0.5f),(int)(py+0.5f));
-            src = mul_color(src,tint);
+    void make_key(const char* s,int scale,u32 col,bool with_col){
+        key.assign(s);
+        key.push_back('\0');
+        key.append((const char*)&scale, sizeof(scale));
+        if(with_col) key.append((const char*)&col, sizeof(col));
+    }
+
+    int width(const char* s,int scale){
+        make_key(s,scale,0,false);
+        auto it=widths.find(key);
+        if(it==widths.end()){
+            if(!seen_before()) return text_width(s,scale);
+            it=widths.emplace(key, Width{text_width(s,scale),0}).first;
+        }
+        it->second.used=frame;
+        return it->second.w;
+    }
 
-            if(!blend || A(src)==255) row[x]=src;
-            else row[x]=blend_over(row[x],src);
+    // Always caches (the layout is returned by reference).
+    const TextLayout& layout(const char* s,int scale,u32 col){
+        make_key(s,scale,col,true);
+        auto it=layouts.find(key);
+        if(it==layouts.end()){
+            it=layouts.emplace(key, Layout{}).first;
+            it->second.lay.set(s,scale,col);
         }
+        it->second.used=frame;
+        return it->second.lay;
+    }
+
+    // Uncached draw_text on a string's first sighting (same pixels).
+    void draw(Canvas& c,int x,int y,int scale,u32 col,const char* s){
+        make_key(s,scale,col,true);
+        if(!layouts.count(key) && !seen_before()){ draw_text(c,x,y,scale,col,s); return; }
+        layout(s,scale,col).draw(c,x,y);
+    }
+
+    // Call once per frame. Only strings not used this frame are dropped, so blits
+    // recorded this frame stay valid until the draw list is replayed.
+    void end_frame(){
+        auto trim=[&](auto& m){
+            if(m.size()<=max_entries) return;
+            for(auto it=m.begin(); it!=m.end();) it = (it->second.used!=frame) ? m.erase(it) : std::next(it);
+        };
+        trim(widths); trim(layouts);
+        frame++;
+    }
+
+    void clear(){ widths.clear(); layouts.clear(); std::memset(seen,0,sizeof(seen)); }
+};
+
+// ============================================================
+// Tiled rasterizer (replays a DrawList over screen tiles in parallel)
+// ============================================================
+// Every primitive is a pure function of (x,y) + destination pixel, so replaying
+// the list in order inside each tile gives exactly the immediate-mode image.
+static inline void draw_cmd_exec(Canvas& t, const DrawCmd& d){
+    switch(d.op){
+        case DrawOp::Clear:
+            for(int y=t.clip.y0;y<=t.clip.y1;y++){
+                u32* row=t.pix + y*t.stride;
+                for(int x=t.clip.x0;x<=t.clip.x1;x++) row[x]=d.col;
+            }
+            break;
+        case DrawOp::Rect:   t.rect_fill(d.x,d.y,d.w,d.h,d.col); break;
+        case DrawOp::Line:   t.line(d.x,d.y,d.w,d.h,d.col); break;
+        case DrawOp::Circle: t.circle_fill(d.x,d.y,d.w,d.col); break;
+        case DrawOp::Blit:
+            blit(t, d.x,d.y,d.w,d.h, *d.img, d.sx,d.sy,d.sw,d.sh, d.blend,d.bilinear,d.col);
+            break;
+        case DrawOp::Shade:  t.shade(*d.shade); break;
+        case DrawOp::Discs:  t.discs(d.discs, d.count); break;
     }
 }
 
+struct TiledRasterizer {
+    DrawList list;
+    int tile=64;          // screen tile size in pixels
+    bool deferred=true;   // false: immediate mode (debug fallback)
+
+    int tiles_x=0, tiles_y=0;
+    std::vector<u32> bin_start;  // tile t's commands are bin_cmds[bin_start[t], bin_start[t+1])
+    std::vector<u32> bin_cmds;   // command indices, in record order per tile
+
+    // Start recording into list (no-op in immediate mode).
+    void begin(Canvas& c){
+        c.rec=nullptr;
+        if(!deferred) return;
+        list.clear();
+        c.rec=&list;
+    }
+
+    // Stop recording and rasterize all tiles on the pool.
+    void end(Canvas& c, JobSystem& pool){
+        WE_ZONE("TiledRasterizer::end");
+        if(c.rec!=&list){ c.rec=nullptr; return; }
+        c.rec=nullptr;
+        if(list.empty() || c.w<=0 || c.h<=0) return;
+
+        int ts=std::max(tile,8);
+        tiles_x=(c.w+ts-1)/ts;
+        tiles_y=(c.h+ts-1)/ts;
+        // two passes (count, then place) into one flat array: no per-tile vectors to grow
+        size_t nt=(size_t)tiles_x*(size_t)tiles_y;
+        bin_start.assign(nt+1, 0);
+        auto each_tile=[&](const RectI& bb, auto&& f){
+            int bx0=bb.x0/ts, bx1=bb.x1/ts;
+            int by0=bb.y0/ts, by1=bb.y1/ts;
+            for(int by=by0; by<=by1; by++)
+                for(int bx=bx0; bx<=bx1; bx++) f((size_t)by*(size_t)tiles_x+(size_t)bx);
+        };
+        for(const DrawCmd& d: list.cmds) each_tile(d.bb, [&](size_t t){ bin_start[t+1]++; });
+        for(size_t t=0;t<nt;t++) bin_start[t+1]+=bin_start[t];
+        if(bin_cmds.size()<bin_start[nt]) bin_cmds.resize(std::max<size_t>(bin_start[nt], bin_cmds.size()*2));
+        {
+            ScratchScope scope;
+            Span<u32> fill=arena_span<u32>(scope.a, nt);
+            std::memcpy(fill.begin(), bin_start.data(), nt*sizeof(u32));
+            for(size_t i=0;i<list.cmds.size();i++)
+                each_tile(list.cmds[i].bb, [&](size_t t){ bin_cmds[fill[t]++]=(u32)i; });
+        }
+
+        pool.parallel_for(tiles_x*tiles_y, [&](int ti){
+            const u32* b0=bin_cmds.data()+bin_start[(size_t)ti];
+            const u32* b1=bin_cmds.data()+bin_start[(size_t)ti+1];
+            if(b0==b1) return;
+            int bx=ti % tiles_x, by=ti / tiles_x;
+            RectI tr{bx*ts, by*ts, std::min(bx*ts+ts, c.w)-1, std::min(by*ts+ts, c.h)-1};
+
+            Canvas tc=c;
+            tc.rec=nullptr;
+            for(const u32* ci=b0; ci<b1; ci++){
+                const DrawCmd& d=list.cmds[*ci];
+                if(!rect_intersect(d.clip, tr, tc.clip)) continue;
+                draw_cmd_exec(tc, d);
+            }
+        });
+    }
+};
+
 // ============================================================
 // Camera2D (fixed zoom + perfect screen_to_world)
 // ============================================================
+// Screen positions of the world grid points (i*cell, j*cell), relative to the grid's origin
+// point (i0,j0): at(i-i0, j-j0). Small relative indices keep precision far from the origin.
+struct ScreenGrid {
+    v2 o{}, dx{}, dy{};
+    v2 at(int i,int j) const {
+        return V2(o.x + (f32)i*dx.x + (f32)j*dy.x, o.y + (f32)i*dx.y + (f32)j*dy.y);
+    }
+};
+
+// view()/inv_view() are cached and rebuilt when pos/zoom/rot/viewport differ from what they
+// were built from, so the plain fields can still be assigned directly. The rebuild is not
+// synchronized: touch the camera on its owning thread before sharing it with jobs.
 struct Camera2D {
     v2 pos{0,0};
     f32 zoom=1.0f;
     f32 rot=0.0f;
     v2 viewport{1280,720};
 
-    m3 view() const {
-        // screen = T(vp/2) * R(rot) * S(zoom) * T(-pos)
-        m3 T1=m3_translate(viewport.x*0.5f, viewport.y*0.5f);
-        m3 R_=m3_rotate(rot);
-        m3 S_=m3_scale(zoom, zoom);
-        m3 T0=m3_translate(-pos.x, -pos.y);
-        return m3_mul(T1, m3_mul(R_, m3_mul(S_, T0)));
-    }
-    m3 inv_view() const {
-        m3 V=view();
-        m3 inv{};
-        bool ok=m3_inverse_affine(V, inv);
-        if(!ok) return m3_identity();
-        return inv;
-    }
+    // screen = T(vp/2) * R(rot) * S(zoom) * T(-pos)
+    const m3& view() const { refresh(); return cache_v; }
+    const m3& inv_view() const { refresh(); return cache_iv; }
+
     v2 screen_to_world(int sx,int sy) const {
         return m3_mul_v2(inv_view(), V2((f32)sx,(f32)sy));
     }
     v2 world_to_screen(v2 wp) const {
         return m3_mul_v2(view(), wp);
     }
+    void world_to_screen(const v2* wp, v2* out, size_t n) const { m3_transform(view(), wp, out, n); }
+    void world_to_screen(const f32* wx, const f32* wy, v2* out, size_t n) const { m3_transform(view(), wx, wy, out, n); }
+
+    ScreenGrid grid(f32 cell, int i0, int j0) const {
+        const m3& V=view();
+        ScreenGrid g;
+        g.o=m3_mul_v2(V, V2((f32)i0*cell, (f32)j0*cell));
+        g.dx=V2(V.m[0][0]*cell, V.m[1][0]*cell);
+        g.dy=V2(V.m[0][1]*cell, V.m[1][1]*cell);
+        return g;
+    }
+
+    // World-space bounds of the (rotated) view rectangle.
+    void view_bounds(f32& left,f32& top,f32& right,f32& bottom) const {
+        refresh();
+        f32 invz = (zoom!=0)? (1.0f/zoom) : 1.0f;
+        f32 hw=viewport.x*0.5f*invz, hh=viewport.y*0.5f*invz;
+        f32 c=std::fabs(cache_cos), s=std::fabs(cache_sin);
+        f32 ex=c*hw + s*hh, ey=s*hw + c*hh;
+        left=pos.x-ex; right=pos.x+ex;
+        top=pos.y-ey;  bottom=pos.y+ey;
+    }
+
+    // cached view (see above)
+    mutable m3 cache_v{}, cache_iv{};
+    mutable f32 cache_cos=1, cache_sin=0;
+    mutable v2 built_pos{}, built_vp{};
+    mutable f32 built_zoom=0, built_rot=0;
+    mutable bool built=false;
+
+    void refresh() const {
+        if(built && pos.x==built_pos.x && pos.y==built_pos.y && zoom==built_zoom && rot==built_rot &&
+           viewport.x==built_vp.x && viewport.y==built_vp.y) return;
+        if(!built || rot!=built_rot){ cache_cos=std::cos(rot); cache_sin=std::sin(rot); }
+        f32 a=zoom*cache_cos, b=zoom*cache_sin;
+        m3 V=m3_identity();
+        V.m[0][0]=a; V.m[0][1]=-b; V.m[0][2]=viewport.x*0.5f - (a*pos.x - b*pos.y);
+        V.m[1][0]=b; V.m[1][1]= a; V.m[1][2]=viewport.y*0.5f - (b*pos.x + a*pos.y);
+        cache_v=V;
+        if(!m3_inverse_affine(V, cache_iv)) cache_iv=m3_identity();
+        built_pos=pos; built_vp=viewport; built_zoom=zoom; built_rot=rot; built=true;
+    }
+};
+
+// ============================================================
+// Presentation backends (CPU framebuffers -> window)
+// ============================================================
+// A presenter owns `buffers` CPU framebuffers (grow-only: shrinking reuses the storage, rows
+// keep the allocated stride) and shows one of them. DibSection renders straight into DIB
+// sections and BitBlts them through the window's own DC; present() may run on a worker,
+// so frame N is presented while N+1 is drawn. GdiStretch is the old StretchDIBits path.
+// Dxgi (WE_ENABLE_DXGI) uploads into a flip-model swap chain with a frame-latency waitable.
+enum class PresentBackend { GdiStretch, DibSection, Dxgi, Headless };
+
+struct Presenter {
+    virtual ~Presenter()=default;
+    virtual bool init(HWND hwnd, int buffers)=0;
+    virtual bool resize(int w,int h)=0;           // client size; buffers cover at least w x h
+    virtual u32* buffer(int i, int& stride)=0;    // CPU framebuffer i
+    virtual void present(int i, int w, int h)=0;  // show the top-left w x h of buffer i
+    virtual void wait_latency(){}                 // block until a new frame can be queued
+    virtual bool threaded() const { return false; } // present() may run off the window thread
+    virtual void shutdown()=0;
+};
+
+static constexpr int PRESENT_MAX_BUFFERS=3;
+
+// Grow-only capacity: at least w x h, never smaller than before.
+static inline void present_grow(int& cap_w,int& cap_h,int w,int h){
+    cap_w=std::max(cap_w,w);
+    cap_h=std::max(cap_h,h);
+}
+
+struct GdiStretchPresenter : Presenter {
+    HWND hwnd=nullptr;
+    int n=1, cap_w=0, cap_h=0;
+    std::array<u32*,PRESENT_MAX_BUFFERS> px{};
+
+    bool init(HWND h, int buffers) override { hwnd=h; n=buffers; return true; }
+    bool resize(int w,int h) override {
+        if(w<=cap_w && h<=cap_h) return true;
+        release();
+        present_grow(cap_w,cap_h,w,h);
+        for(int i=0;i<n;i++){
+            px[(size_t)i]=(u32*)VirtualAlloc(nullptr, (size_t)cap_w*(size_t)cap_h*4u, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+            if(!px[(size_t)i]) return false;
+        }
+        return true;
+    }
+    u32* buffer(int i, int& stride) override { stride=cap_w; return px[(size_t)i]; }
+    void present(int i, int w, int h) override {
+        BITMAPINFO bmi{};
+        bmi.bmiHeader.biSize=sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth=cap_w;   // row pitch
+        bmi.bmiHeader.biHeight=-h;     // top-down: the first h rows
+        bmi.bmiHeader.biPlanes=1;
+        bmi.bmiHeader.biBitCount=32;
+        bmi.bmiHeader.biCompression=BI_RGB;
+
+        HDC dc=GetDC(hwnd);
+        RECT cr{}; GetClientRect(hwnd,&cr);
+        StretchDIBits(dc, 0,0,cr.right-cr.left,cr.bottom-cr.top, 0,0, w,h, px[(size_t)i], &bmi, DIB_RGB_COLORS, SRCCOPY);
+        ReleaseDC(hwnd, dc);
+    }
+    void release(){
+        for(auto& p: px) if(p){ VirtualFree(p,0,MEM_RELEASE); p=nullptr; }
+    }
+    void shutdown() override { release(); cap_w=cap_h=0; }
+};
+
+// Offscreen buffers, no window: present() only counts frames (tests, benchmarks,
+// servers). The pixels stay readable in App::fb after frame_end.
+struct HeadlessPresenter : Presenter {
+    int n=1, cap_w=0, cap_h=0;
+    std::array<std::vector<u32>,PRESENT_MAX_BUFFERS> px;
+    u64 presented=0;
+
+    bool init(HWND, int buffers) override { n=buffers; return true; }
+    bool resize(int w,int h) override {
+        if(w<=cap_w && h<=cap_h) return true;
+        present_grow(cap_w,cap_h,w,h);
+        for(int i=0;i<n;i++) px[(size_t)i].assign((size_t)cap_w*(size_t)cap_h, 0u);
+        return true;
+    }
+    u32* buffer(int i, int& stride) override { stride=cap_w; return px[(size_t)i].data(); }
+    void present(int, int, int) override { presented++; }
+    void shutdown() override { for(auto& v: px){ v.clear(); v.shrink_to_fit(); } cap_w=cap_h=0; }
+};
+
+struct DibPresenter : Presenter {
+    struct Buf { HBITMAP bmp=nullptr; HDC dc=nullptr; HGDIOBJ old=nullptr; u32* px=nullptr; };
+    HWND hwnd=nullptr;
+    // Window DC, kept for the window's lifetime (CS_OWNDC). GDI lets any thread use a DC
+    // as long as only one does at a time: after init only present() touches it, presents
+    // are chained one after another, and WM_PAINT/WM_ERASEBKGND never reach GDI (App::wndproc).
+    HDC wdc=nullptr;
+    int n=1, cap_w=0, cap_h=0;
+    std::array<Buf,PRESENT_MAX_BUFFERS> b{};
+
+    bool init(HWND h, int buffers) override {
+        hwnd=h; n=buffers;
+        wdc=GetDC(hwnd);
+        return wdc!=nullptr;
+    }
+    bool resize(int w,int h) override {
+        if(w<=cap_w && h<=cap_h) return true;
+        release();
+        present_grow(cap_w,cap_h,w,h);
+
+        BITMAPINFO bmi{};
+        bmi.bmiHeader.biSize=sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth=cap_w;
+        bmi.bmiHeader.biHeight=-cap_h; // top-down
+        bmi.bmiHeader.biPlanes=1;
+        bmi.bmiHeader.biBitCount=32;
+        bmi.bmiHeader.biCompression=BI_RGB;
+        for(int i=0;i<n;i++){
+            Buf& f=b[(size_t)i];
+            void* bits=nullptr;
+            f.bmp=CreateDIBSection(wdc, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+            if(!f.bmp) return false;
+            f.px=(u32*)bits;
+            f.dc=CreateCompatibleDC(wdc);
+            f.old=SelectObject(f.dc, f.bmp);
+        }
+        return true;
+    }
+    u32* buffer(int i, int& stride) override { stride=cap_w; return b[(size_t)i].px; }
+    void present(int i, int w, int h) override {
+        BitBlt(wdc, 0,0,w,h, b[(size_t)i].dc, 0,0, SRCCOPY);
+        GdiFlush(); // the blit has read the bits before the buffer is drawn into again
+    }
+    bool threaded() const override { return true; }
+    void release(){
+        for(Buf& f: b){
+            if(f.dc){ SelectObject(f.dc, f.old); DeleteDC(f.dc); }
+            if(f.bmp) DeleteObject(f.bmp);
+            f=Buf{};
+        }
+    }
+    void shutdown() override {
+        release(); cap_w=cap_h=0;
+        if(wdc){ ReleaseDC(hwnd, wdc); wdc=nullptr; }
+    }
+};
+
+#if defined(WE_ENABLE_DXGI)
+struct DxgiPresenter : Presenter {
+    HWND hwnd=nullptr;
+    int n=2, cap_w=0, cap_h=0, sc_w=0, sc_h=0;
+    bool vsync=true;
+    std::array<u32*,PRESENT_MAX_BUFFERS> px{};
+    ID3D11Device* dev=nullptr;
+    ID3D11DeviceContext* ctx=nullptr;
+    IDXGISwapChain2* sc=nullptr;
+    ID3D11Texture2D* back=nullptr;
+    HANDLE waitable=nullptr;
+    static constexpr UINT SC_FLAGS=DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
+    bool init(HWND h, int buffers) override {
+        hwnd=h; n=buffers;
+        if(FAILED(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+                                    nullptr, 0, D3D11_SDK_VERSION, &dev, nullptr, &ctx))) return false;
+
+        IDXGIDevice* xdev=nullptr; IDXGIAdapter* adapter=nullptr; IDXGIFactory2* factory=nullptr;
+        bool ok = SUCCEEDED(dev->QueryInterface(__uuidof(IDXGIDevice), (void**)&xdev))
+               && SUCCEEDED(xdev->GetAdapter(&adapter))
+               && SUCCEEDED(adapter->GetParent(__uuidof(IDXGIFactory2), (void**)&factory));
+        if(ok){
+            RECT cr{}; GetClientRect(hwnd,&cr);
+            DXGI_SWAP_CHAIN_DESC1 d{};
+            d.Width=(UINT)std::max<LONG>(cr.right-cr.left,1);
+            d.Height=(UINT)std::max<LONG>(cr.bottom-cr.top,1);
+            d.Format=DXGI_FORMAT_B8G8R8A8_UNORM; // == AARRGGBB in memory
+            d.SampleDesc.Count=1;
+            d.BufferUsage=DXGI_USAGE_RENDER_TARGET_OUTPUT;
+            d.BufferCount=(UINT)std::max(n,2);
+            d.SwapEffect=DXGI_SWAP_EFFECT_FLIP_DISCARD;
+            d.Flags=SC_FLAGS;
+            IDXGISwapChain1* sc1=nullptr;
+            HRESULT hr=factory->CreateSwapChainForHwnd(dev, hwnd, &d, nullptr, nullptr, &sc1);
+            if(FAILED(hr)){ // pre-Windows 10
+                d.SwapEffect=DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+                hr=factory->CreateSwapChainForHwnd(dev, hwnd, &d, nullptr, nullptr, &sc1);
+            }
+            ok = SUCCEEDED(hr) && SUCCEEDED(sc1->QueryInterface(__uuidof(IDXGISwapChain2), (void**)&sc));
+            if(sc1) sc1->Release();
+            if(ok){
+                factory->MakeWindowAssociation(hwnd, DXGI_MWA_NO_ALT_ENTER);
+                sc->SetMaximumFrameLatency(1);
+                waitable=sc->GetFrameLatencyWaitableObject();
+                sc_w=(int)d.Width; sc_h=(int)d.Height;
+                ok = SUCCEEDED(sc->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&back));
+            }
+        }
+        if(factory) factory->Release();
+        if(adapter) adapter->Release();
+        if(xdev) xdev->Release();
+        if(!ok) shutdown();
+        return ok;
+    }
+    bool resize(int w,int h) override {
+        if(w!=sc_w || h!=sc_h){
+            if(back){ back->Release(); back=nullptr; }
+            ctx->ClearState();
+            if(FAILED(sc->ResizeBuffers(0, (UINT)w, (UINT)h, DXGI_FORMAT_UNKNOWN, SC_FLAGS))) return false;
+            if(FAILED(sc->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)&back))) return false;
+            sc_w=w; sc_h=h;
+        }
+        if(w<=cap_w && h<=cap_h) return true;
+        release();
+        present_grow(cap_w,cap_h,w,h);
+        for(int i=0;i<n;i++){
+            px[(size_t)i]=(u32*)VirtualAlloc(nullptr, (size_t)cap_w*(size_t)cap_h*4u, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+            if(!px[(size_t)i]) return false;
+        }
+        return true;
+    }
+    u32* buffer(int i, int& stride) override { stride=cap_w; return px[(size_t)i]; }
+    void present(int i, int w, int h) override {
+        if(!back) return;
+        D3D11_BOX box{0,0,0,(UINT)std::min(w,sc_w),(UINT)std::min(h,sc_h),1};
+        ctx->UpdateSubresource(back, 0, &box, px[(size_t)i], (UINT)cap_w*4u, 0);
+        sc->Present(vsync ? 1 : 0, 0);
+    }
+    void wait_latency() override {
+        if(waitable) WaitForSingleObjectEx(waitable, 1000, TRUE);
+    }
+    void release(){
+        for(auto& p: px) if(p){ VirtualFree(p,0,MEM_RELEASE); p=nullptr; }
+    }
+    void shutdown() override {
+        release(); cap_w=cap_h=0;
+        if(waitable){ CloseHandle(waitable); waitable=nullptr; }
+        if(back){ back->Release(); back=nullptr; }
+        if(sc){ sc->Release(); sc=nullptr; }
+        if(ctx){ ctx->Release(); ctx=nullptr; }
+        if(dev){ dev->Release(); dev=nullptr; }
+    }
 };
+#endif
 
 // ============================================================
 // Win32 App (window, backbuffer, timing, input)
@@ -611,25 +2924,59 @@ struct AppConfig {
     int w=1100, h=700;
     const wchar_t* title=L"wineng++";
     bool resizable=true;
+    int worker_threads=-1;   // job system workers; -1: hardware threads - 1
+    PresentBackend present=PresentBackend::DibSection; // Dxgi needs WE_ENABLE_DXGI (falls back to DibSection)
+                             // Headless: no window, fb is an offscreen buffer of w x h
+    int buffers=2;           // CPU framebuffers (2: draw N+1 while N is presented, 3: two in flight)
+    bool vsync=true;         // Dxgi only
+    int sim_hz=120;          // fixed simulation rate (App::sim_step)
+    int max_sim_steps=8;     // per frame; time beyond that is dropped (no spiral of death)
+    double fixed_dt=0;       // > 0: every frame takes this long (deterministic runs); 0: measured
 };
 
 struct App {
     HWND hwnd=nullptr;
     bool running=true;
 
-    BITMAPINFO bmi{};
-    Canvas fb{};
+    Canvas fb{};             // the buffer being drawn this frame (rotates with buffers > 1)
 
     LARGE_INTEGER qpf{};
     LARGE_INTEGER qpc_last{};
-    f32 dt=0;
+    f32 dt=0;                // frame time, clamped to 0.05 (rendering / smoothing)
+    double frame_time=0;     // unclamped
+    double fixed_dt=0;       // AppConfig::fixed_dt
+    u64 frame_index=0;       // frame_begin calls that returned true
 
     Input in{};
 
-    void* backbuf_mem=nullptr;
-    size_t backbuf_bytes=0;
+    // Input log: frame_begin appends the frame's input to recording, or replaces the
+    // window's input (and frame time) with replaying's next frame, stopping at its end.
+    InputLog* recording=nullptr;
+    const InputLog* replaying=nullptr;
+    int replay_pos=0;
+
+    // Fixed timestep: while(app.sim_step()){ update with sim_dt and sim_in }, then render
+    // with alpha (time past the last step, in steps) to interpolate prev -> current state.
+    f32 sim_dt=1.0f/120.0f;
+    int max_sim_steps=8;
+    double time_scale=1.0;   // sim seconds per real second (0 pauses)
+    double sim_accum=0;
+    u64 sim_tick=0;          // steps run so far
+    int sim_steps=0;         // steps run this frame
+    f32 alpha=0;
+    Input sim_in{};          // input as the sim sees it (edges since the last step)
+    bool sim_edges_used=false;
+
+    std::unique_ptr<Presenter> presenter;
+    int buf_count=1, buf_cur=0;
+    std::array<JobCounter,PRESENT_MAX_BUFFERS> present_busy; // buffer i is being presented
+
+    // WM_SIZE only records the size; it is applied once the drag ends (frame_begin)
+    int pending_w=0, pending_h=0;
+    bool resize_pending=false, in_sizemove=false;
 
     WIC wic{};
+    JobSystem jobs{};
 
     static LRESULT CALLBACK wndproc(HWND hwnd, UINT msg, WPARAM wp, LPARAM lp){
         App* app=(App*)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
@@ -651,11 +2998,27 @@ struct App {
 
             case WM_SIZE:
                 if(app){
-                    int cw=LOWORD(lp), ch=HIWORD(lp);
-                    app->resize_backbuffer(cw,ch);
+                    app->pending_w=LOWORD(lp); app->pending_h=HIWORD(lp);
+                    app->resize_pending=true;
                 }
                 return 0;
 
+            case WM_ENTERSIZEMOVE:
+                if(app) app->in_sizemove=true;
+                return 0;
+
+            case WM_EXITSIZEMOVE:
+                if(app) app->in_sizemove=false;
+                return 0;
+
+            // Every frame repaints the client area; validating here keeps the window thread
+            // off the window DC, which the present job may be using on a worker.
+            case WM_ERASEBKGND:
+                return 1;
+            case WM_PAINT:
+                ValidateRect(hwnd, nullptr);
+                return 0;
+
             case WM_MOUSEMOVE:
                 if(app){
                     int x=(short)LOWORD(lp), y=(short)HIWORD(lp);
@@ -715,38 +3078,69 @@ struct App {
         return DefWindowProcW(hwnd,msg,wp,lp);
     }
 
-    void resize_backbuffer(int w,int h){
-        if(w<=0||h<=0) return;
-        if(backbuf_mem){
-            VirtualFree(backbuf_mem,0,MEM_RELEASE);
-            backbuf_mem=nullptr;
-        }
-        backbuf_bytes = (size_t)w*(size_t)h*4u;
-        backbuf_mem = VirtualAlloc(nullptr, backbuf_bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
-        WE_ASSERT(backbuf_mem);
+    void wait_presents(){
+        for(auto& c: present_busy) jobs.wait(c);
+    }
 
-        std::memset(&bmi,0,sizeof(bmi));
-        bmi.bmiHeader.biSize=sizeof(BITMAPINFOHEADER);
-        bmi.bmiHeader.biWidth=w;
-        bmi.bmiHeader.biHeight=-h;
-        bmi.bmiHeader.biPlanes=1;
-        bmi.bmiHeader.biBitCount=32;
-        bmi.bmiHeader.biCompression=BI_RGB;
+    void bind_buffer(int i, int w, int h){
+        int stride=0;
+        u32* px=presenter->buffer(i, stride);
+        fb.set(px, w, h, stride);
+    }
+
+    // Grow-only: shrinking or re-growing within the old size keeps the buffers.
+    void resize_backbuffer(int w,int h){
+        if(w<=0||h<=0||!presenter) return;
+        wait_presents();
+        bool ok=presenter->resize(w,h);
+        WE_ASSERT(ok);
+        bind_buffer(buf_cur, w, h);
+    }
 
-        fb.set((u32*)backbuf_mem, w, h, w);
+    bool make_presenter(const AppConfig& cfg){
+        buf_count=std::clamp(cfg.buffers, 1, PRESENT_MAX_BUFFERS);
+        if(cfg.present==PresentBackend::Headless){
+            presenter=std::make_unique<HeadlessPresenter>();
+            return presenter->init(nullptr, buf_count);
+        }
+#if defined(WE_ENABLE_DXGI)
+        if(cfg.present==PresentBackend::Dxgi){
+            auto p=std::make_unique<DxgiPresenter>();
+            p->vsync=cfg.vsync;
+            if(p->init(hwnd, buf_count)){ presenter=std::move(p); return true; }
+        }
+#endif
+        if(cfg.present==PresentBackend::GdiStretch) presenter=std::make_unique<GdiStretchPresenter>();
+        else presenter=std::make_unique<DibPresenter>();
+        return presenter->init(hwnd, buf_count);
     }
 
     bool init(const AppConfig& cfg){
         wic.init();
+        profiler().thread_name("main");
+
+        int hw=(int)std::thread::hardware_concurrency();
+        jobs.init(cfg.worker_threads>=0 ? cfg.worker_threads : std::max(hw-1,0));
+
+        sim_dt=1.0f/(f32)std::max(cfg.sim_hz,1);
+        max_sim_steps=std::max(cfg.max_sim_steps,1);
+        fixed_dt=cfg.fixed_dt;
 
         QueryPerformanceFrequency(&qpf);
         QueryPerformanceCounter(&qpc_last);
 
+        if(cfg.present==PresentBackend::Headless){
+            if(!make_presenter(cfg)) return false;
+            resize_backbuffer(cfg.w, cfg.h);
+            running=true;
+            return fb.pix!=nullptr;
+        }
+
         HINSTANCE inst=GetModuleHandleW(nullptr);
 
         WNDCLASSEXW wc{};
         wc.cbSize=sizeof(wc);
-        wc.style=CS_HREDRAW|CS_VREDRAW;
+        wc.style=CS_HREDRAW|CS_VREDRAW|CS_OWNDC; // DibPresenter keeps the window DC
         wc.lpfnWndProc=wndproc;
         wc.hInstance=inst;
         wc.hCursor=LoadCursor(nullptr, IDC_ARROW);
@@ -764,29 +3158,38 @@ struct App {
                                r.right-r.left, r.bottom-r.top,
                                nullptr,nullptr,inst,(void*)this);
         if(!hwnd) return false;
+        if(!make_presenter(cfg)) return false;
 
         RECT cr{};
         GetClientRect(hwnd,&cr);
         resize_backbuffer(cr.right-cr.left, cr.bottom-cr.top);
+        resize_pending=false;
 
         running=true;
         return true;
     }
 
     void shutdown(){
-        if(backbuf_mem){
-            VirtualFree(backbuf_mem,0,MEM_RELEASE);
-            backbuf_mem=nullptr;
+        if(presenter){
+            wait_presents();
+            presenter->shutdown();
+            presenter.reset();
         }
         if(hwnd){
             DestroyWindow(hwnd);
             hwnd=nullptr;
         }
+        jobs.shutdown();
         wic.shutdown();
     }
 
     bool frame_begin(){
         if(!running) return false;
+        profiler().frame_mark(); // closes the previous frame's zones
+        frame_arena().reset();   // the previous frame's transient buffers are done
+
+        // swap chain backends: sleep here, before input is read, not inside Present
+        if(presenter) presenter->wait_latency();
 
         in.clear_edges();
 
@@ -796,26 +3199,71 @@ struct App {
             TranslateMessage(&msg);
             DispatchMessageW(&msg);
         }
+        jobs.run_main(); // work posted from jobs that must run on the window thread
+
+        if(resize_pending && !in_sizemove){
+            resize_pending=false;
+            resize_backbuffer(pending_w, pending_h);
+        }
 
         LARGE_INTEGER now{};
         QueryPerformanceCounter(&now);
         double d=(double)(now.QuadPart - qpc_last.QuadPart) / (double)qpf.QuadPart;
         qpc_last=now;
+        if(fixed_dt>0) d=fixed_dt;
+        if(replaying){
+            if(!replaying->frame(replay_pos, in, d)){ running=false; return false; }
+            replay_pos++;
+        }else if(recording){
+            recording->record(in, d);
+        }
+        frame_time=d;
         dt=(f32)d;
         if(dt>0.05f) dt=0.05f;
 
+        sim_accum+=std::min(d,0.25)*time_scale;
+        sim_steps=0;
+        sim_edges_used=false;   // sim_step cleared them after the step that saw them
+        sim_in.accumulate(in);
+        alpha=(f32)(sim_accum/(double)sim_dt);
+
+        if(running) frame_index++;
         return running;
     }
 
-    void frame_end(){
-        if(!hwnd || !fb.pix) return;
-
-        HDC dc=GetDC(hwnd);
-        RECT cr{}; GetClientRect(hwnd,&cr);
-        int dw=cr.right-cr.left, dh=cr.bottom-cr.top;
+    // Consume one fixed step from the accumulator (false when caught up). Caps the steps
+    // per frame at max_sim_steps and updates alpha.
+    bool sim_step(){
+        if(sim_steps>0 && !sim_edges_used){ sim_in.clear_edges(); sim_edges_used=true; } // edges fire once
+        if(sim_accum<(double)sim_dt || sim_steps>=max_sim_steps){
+            if(sim_accum>=(double)sim_dt) sim_accum=std::fmod(sim_accum,(double)sim_dt); // drop the backlog
+            alpha=(f32)(sim_accum/(double)sim_dt);
+            return false;
+        }
+        sim_accum-=(double)sim_dt;
+        sim_steps++;
+        sim_tick++;
+        return true;
+    }
 
-        StretchDIBits(dc, 0,0,dw,dh, 0,0, fb.w,fb.h, fb.pix, &bmi, DIB_RGB_COLORS, SRCCOPY);
-        ReleaseDC(hwnd, dc);
+    // Present fb, then move fb to the next buffer (waiting only if it is still on screen).
+    // With buffers > 1 the next frame starts on a buffer holding older contents.
+    void frame_end(){
+        WE_ZONE("App::frame_end");
+        if(!fb.pix || !presenter) return;
+
+        int i=buf_cur, w=fb.w, h=fb.h;
+        if(presenter->threaded() && buf_count>1){
+            Presenter* p=presenter.get();
+            int prev=(i+buf_count-1)%buf_count; // presents stay in order
+            // background: a worker presents while the next frame is drawn (waits never pick it up)
+            jobs.submit_after(present_busy[(size_t)prev], [p,i,w,h]{ p->present(i,w,h); }, &present_busy[(size_t)i], true);
+        }else{
+            presenter->present(i,w,h);
+        }
+        buf_cur=(i+1)%buf_count;
+        jobs.wait(present_busy[(size_t)buf_cur]);
+        bind_buffer(buf_cur, w, h);
     }
 };
 
@@ -850,34 +3298,128 @@ struct UI {
         int drag_off_x=0, drag_off_y=0;
     } win;
 
-    std::array<RectI,16> clip_stack{};
-    int clip_top=0;
+    std::vector<RectI> clip_stack; // [0] = canvas clip at begin; grows with nesting
+
+    TextCache text; // repeated labels reuse widths and layouts across frames
+
+    // Window surfaces: between window_begin/window_end widgets record into the window's
+    // DrawList. window_end hashes the window-local stream (hot/active/drag state only
+    // shows through the commands) and re-rasterizes the premultiplied surface only when
+    // the hash changes; every frame the window is composited with one blit.
+    struct WindowCache {
+        DrawList list;
+        u64 hash=0;    // stream the surface was built from, 0 = none
+        Image surf;    // premultiplied layer, window-sized
+        u32 used=0;
+    };
+    std::unordered_map<u32,WindowCache> windows; // by window id, dropped when not drawn
+    bool cache_windows=true;                     // false: draw straight into the canvas
+    u32 frame=0;
+    int rebuilds=0;         // window surfaces re-rasterized this frame
+    Canvas* screen=nullptr; // real target while a window records into rc
+    Canvas rc{};
+    WindowCache* cur=nullptr;
 
     void begin(Canvas& canvas,const Input& input){
         c=&canvas; in=&input;
         mx=input.mouse_x; my=input.mouse_y;
         md=input.mouse[0]; mp=input.mouse_pressed[0]; mr=input.mouse_released[0];
-        hot=0; counter=0;
+        hot=0; counter=0; rebuilds=0;
+        prof_begin("UI");
 
-        clip_top=0;
-        clip_stack[clip_top++] = c->clip;
+        clip_stack.clear();
+        clip_stack.push_back(c->clip);
     }
     void end(){
+        if(screen){ c=screen; screen=nullptr; cur=nullptr; } // window_begin without window_end
         // restore clip
-        if(clip_top>0) c->clip = clip_stack[0];
+        if(!clip_stack.empty()) c->clip = clip_stack[0];
         if(mr) active=0;
         if(!md) active=0;
+        for(auto it=windows.begin(); it!=windows.end();) it = (it->second.used!=frame) ? windows.erase(it) : std::next(it);
+        text.end_frame();
+        frame++;
+        prof_end();
     }
 
+    // Nested clips intersect with the current one.
     void push_clip(int x,int y,int w,int h){
-        if(clip_top>= (int)clip_stack.size()) return;
-        clip_stack[clip_top++] = c->clip;
+        RectI parent=c->clip;
+        clip_stack.push_back(parent);
         c->clip_set(x,y,w,h);
+        if(!rect_intersect(c->clip, parent, c->clip)) c->clip={0,0,-1,-1};
     }
     void pop_clip(){
-        if(clip_top<=1) return;
-        clip_top--;
-        c->clip = clip_stack[clip_top-1];
+        if(clip_stack.size()<=1) return;
+        c->clip = clip_stack.back();
+        clip_stack.pop_back();
+    }
+
+    static u64 hash_cmd(u64 h,const DrawCmd& d){
+        auto mix=[&](u64 v){ h=(h ^ v) * 0x100000001B3ull; };
+        mix((u64)d.op);
+        mix((u64)(u32)d.clip.x0 | ((u64)(u32)d.clip.y0<<32)); mix((u64)(u32)d.clip.x1 | ((u64)(u32)d.clip.y1<<32));
+        mix((u64)(u32)d.x | ((u64)(u32)d.y<<32)); mix((u64)(u32)d.w | ((u64)(u32)d.h<<32));
+        mix((u64)d.col | ((u64)d.blend<<32) | ((u64)d.bilinear<<33));
+        mix((u64)(uintptr_t)d.img);
+        if(d.img) mix(d.img->gen); // same Image rewritten in place
+        mix((u64)(u32)d.sx | ((u64)(u32)d.sy<<32)); mix((u64)(u32)d.sw | ((u64)(u32)d.sh<<32));
+        mix((u64)(u32)d.count);
+        if(d.shade){ // grids and disc batches are rebuilt in place: hash what they hold
+            const ShadeGrid& g=*d.shade;
+            mix((u64)(u32)g.w | ((u64)(u32)g.h<<32));
+            mix((u64)(u32)g.u0 | ((u64)(u32)g.v0<<32)); mix((u64)(u32)g.dudx | ((u64)(u32)g.dvdx<<32));
+            mix((u64)(u32)g.dudy | ((u64)(u32)g.dvdy<<32));
+            if(g.m) for(size_t i=0, n=(size_t)g.w*(size_t)g.h; i<n; i++) mix(g.m[i]);
+        }
+        if(d.discs)
+            for(int i=0;i<d.count;i++){
+                const Disc& q=d.discs[i];
+                mix((u64)(u32)q.x | ((u64)(u32)q.y<<32)); mix((u64)(u32)q.r | ((u64)q.col<<32));
+            }
+        return h;
+    }
+
+    // Redirect drawing of the window at (x,y,w,h) into its command list.
+    void window_record(u32 id,int x,int y,int w,int h){
+        screen=c;
+        cur=&windows[id];
+        cur->used=frame;
+        cur->list.clear();
+        rc=Canvas{};
+        rc.w=c->w; rc.h=c->h;
+        rc.rec=&cur->list;
+        if(!rect_intersect(c->clip, RectI{x,y,x+w-1,y+h-1}, rc.clip)) rc.clip={0,0,-1,-1};
+        c=&rc;
+    }
+
+    // Rebuild the window surface if its stream changed, then composite it.
+    void window_composite(){
+        c=screen; screen=nullptr;
+        WindowCache& wc=*cur; cur=nullptr;
+        int ox=win.x, oy=win.y, ww=win.w, wh=win.h;
+
+        u64 h=0xCBF29CE484222325ull;
+        h=(h ^ ((u64)(u32)ww | ((u64)(u32)wh<<32))) * 0x100000001B3ull;
+        for(DrawCmd& d: wc.list.cmds){ draw_cmd_translate(d,-ox,-oy); h=hash_cmd(h,d); }
+        if(h==0) h=1;
+
+        if(h!=wc.hash || wc.surf.w!=ww || wc.surf.h!=wh){
+            wc.surf.w=ww; wc.surf.h=wh; wc.surf.premul=true;
+            wc.surf.px.assign((size_t)ww*(size_t)wh, 0);
+            wc.surf.touch();
+            Canvas lc{};
+            lc.set(wc.surf.px.data(), ww,wh,ww);
+            lc.kern=&layer_kernels();
+            for(const DrawCmd& d: wc.list.cmds){
+                Canvas t=lc;
+                if(!rect_intersect(d.clip, lc.clip, t.clip)) continue;
+                draw_cmd_exec(t,d);
+            }
+            wc.hash=h;
+            rebuilds++;
+        }
+        blit(*c, ox,oy, ww,wh, wc.surf, 0,0,ww,wh, true,false);
     }
 
     bool window_begin(const char* title, int& x,int& y,int& w,int& h, bool& open){
@@ -920,237 +3462,1547 @@ struct UI {
             y = my - win.drag_off_y;
         }
 
-        // draw
-        c->rect_fill(x,y,w,h, RGBA(24,26,32,235));
-        c->rect_fill(x,y,w,th, RGBA(32,35,44,245));
-        c->rect_outline(x,y,w,h,1, RGBA(10,10,12,255));
+        if(cache_windows) window_record(id,x,y,w,h);
+
+        // draw
+        c->rect_fill(x,y,w,h, RGBA(24,26,32,235));
+        c->rect_fill(x,y,w,th, RGBA(32,35,44,245));
+        c->rect_outline(x,y,w,h,1, RGBA(10,10,12,255));
+
+        // title
+        text.draw(*c, x+pad, y+6, 2, RGBA(235,235,240,255), title);
+
+        // close visuals
+        u32 cbc = close_hot ? RGBA(255,120,120,240) : RGBA(200,90,90,200);
+        c->rect_fill(cbx,cby,cbw,cbh,cbc);
+        c->rect_outline(cbx,cby,cbw,cbh,1,RGBA(10,10,12,255));
+        text.draw(*c, cbx+5, cby+3, 2, RGBA(20,20,24,255), "X");
+
+        // content
+        int cx = x+pad;
+        int cy = y+th+pad;
+        int cw = w - 2*pad;
+        int ch = h - th - 2*pad;
+
+        push_clip(cx,cy,cw,ch);
+
+        win.x=x; win.y=y; win.w=w; win.h=h;
+        win.cx=cx; win.cy=cy;
+        return true;
+    }
+
+    void window_end(){
+        pop_clip();
+        if(cur) window_composite();
+    }
+
+    void next_line(int h){
+        win.cy += h + 6;
+    }
+
+    void label(const char* s, int scale=2){
+        text.draw(*c, win.cx, win.cy, scale, RGBA(225,225,235,255), s);
+        next_line(text_line_h(scale));
+    }
+
+    // Claim a w x h area at the cursor for custom drawing through c.
+    RectI reserve(int w,int h){
+        RectI r{win.cx, win.cy, win.cx+w-1, win.cy+h-1};
+        next_line(h);
+        return r;
+    }
+
+    bool button(const char* label, int w=160, int h=28){
+        if(w<=0) w=160;
+        if(h<=0) h=28;
+        int x=win.cx, y=win.cy;
+
+        u32 id = fnv1a(label) ^ (win.id*0x9E3779B1u) ^ (++counter);
+        bool inside = pt_in(mx,my,x,y,w,h);
+
+        if(inside) hot=id;
+        if(mp && inside) active=id;
+
+        bool clicked=false;
+        if(mr && active==id && inside) clicked=true;
+
+        u32 bg=RGBA(50,50,62,220);
+        if(hot==id) bg=RGBA(70,70,88,235);
+        if(active==id) bg=RGBA(90,90,112,245);
+
+        c->rect_fill(x,y,w,h,bg);
+        c->rect_outline(x,y,w,h,1,RGBA(10,10,12,255));
+
+        int tw=text.width(label,2);
+        int tx=x + (w-tw)/2;
+        int ty=y + (h-text_line_h(2))/2;
+        text.draw(*c, tx,ty,2, RGBA(235,235,240,255), label);
+
+        next_line(h);
+        return clicked;
+    }
+
+    bool checkbox(const char* label, bool& v){
+        int box=18;
+        int x=win.cx, y=win.cy;
+        int w = box + 10 + text.width(label,2);
+        int h = box;
+
+        u32 id = fnv1a(label) ^ (win.id*0x85EBCA77u) ^ (++counter);
+        bool inside = pt_in(mx,my,x,y,w,h);
+        if(inside) hot=id;
+        if(mp && inside) active=id;
+
+        bool toggled=false;
+        if(mr && active==id && inside){
+            v=!v; toggled=true;
+        }
+
+        c->rect_fill(x,y,box,box,RGBA(36,38,45,230));
+        c->rect_outline(x,y,box,box,1,RGBA(10,10,12,255));
+        if(v) c->rect_fill(x+4,y+4,box-8,box-8,RGBA(120,200,255,245));
+
+        text.draw(*c, x+box+10,y+2,2,RGBA(225,225,235,255), label);
+        next_line(box);
+        return toggled;
+    }
+
+    f32 sliderf(const char* label, f32 v, f32 vmin, f32 vmax, int w=240, int h=18){
+        if(w<=0) w=240;
+        if(h<=0) h=18;
+
+        int x=win.cx, y=win.cy;
+        text.draw(*c, x,y-18,2,RGBA(220,220,230,255), label);
+
+        u32 id = fnv1a(label) ^ (win.id*0x27D4EB2Du) ^ (++counter);
+        bool inside = pt_in(mx,my,x,y,w,h);
+        if(inside) hot=id;
+        if(mp && inside) active=id;
+
+        f32 t = (v - vmin) / (vmax - vmin);
+        t = clampf(t,0,1);
+
+        if(active==id && md){
+            f32 nt = (f32)(mx - x)/(f32)w;
+            nt = clampf(nt,0,1);
+            v = vmin + nt*(vmax-vmin);
+            t = nt;
+        }
+
+        c->rect_fill(x,y,w,h,RGBA(36,38,45,230));
+        int knob = std::max(h,10);
+        int kx = x + (int)((w-knob)*t);
+        u32 kc = (active==id)?RGBA(190,230,255,255):((hot==id)?RGBA(160,215,255,245):RGBA(120,200,255,235));
+        c->rect_fill(kx,y,knob,h,kc);
+        c->rect_outline(x,y,w,h,1,RGBA(10,10,12,255));
+
+        next_line(h+18);
+        return v;
+    }
+};
+
+// ============================================================
+// World (chunked tiles) + physics helper
+// ============================================================
+static constexpr int CHUNK = 32;
+static constexpr u16 TILE_UNKNOWN = 0xFFFF; // World::peek of a chunk that is not loaded (solid)
+static constexpr int CHUNK_SHIFT = 5; // log2(CHUNK): tile->chunk is a shift, tile->local a mask
+static_assert((1<<CHUNK_SHIFT)==CHUNK, "CHUNK must be 1<<CHUNK_SHIFT");
+
+struct Tileset {
+    const Image* img=nullptr;
+    int tile_w=16, tile_h=16;
+    int cols=0, rows=0;
+    int ox=0, oy=0;  // sheet origin inside img (atlas sub-rect)
+
+    int src_x(int id) const { return ox + (id % cols)*tile_w; }
+    int src_y(int id) const { return oy + (id / cols)*tile_h; }
+};
+
+static inline Tileset make_tileset(const Image* img,int tw,int th){
+    Tileset t{};
+    t.img=img; t.tile_w=tw; t.tile_h=th;
+    if(img && tw>0 && th>0){
+        t.cols = img->w / tw;
+        t.rows = img->h / th;
+    }
+    return t;
+}
+
+// Tile sheet packed into an atlas (AtlasBuilder::add of the whole sheet).
+static inline Tileset make_tileset(const Atlas& atlas,int handle,int tw,int th){
+    Tileset t{};
+    const AtlasRect& r=atlas.rect(handle);
+    t.tile_w=tw; t.tile_h=th;
+    if(r.w>0 && r.h>0 && tw>0 && th>0){
+        t.img=&atlas.img; t.ox=r.x; t.oy=r.y;
+        t.cols = r.w / tw;
+        t.rows = r.h / th;
+    }
+    return t;
+}
+
+// Tile definitions, indexed by tile id (World::tile_defs). Id 0 is air and never drawn;
+// ids past the table (and TILE_UNKNOWN) use World::unknown_def.
+enum : u8 {
+    TILE_SOLID  = 1u<<0,  // collides (World::solid)
+    TILE_OPAQUE = 1u<<1,  // covers its whole cell: the BG wall behind it is not drawn
+};
+
+struct TileDef {
+    u8 flags=TILE_SOLID|TILE_OPAQUE;
+    u8 decay=18;          // light lost spreading out of the tile (LightMap::flood)
+    u8 emit=0;            // light emitted by the tile (gather_tile_lights), 0 = none
+    u16 sprite=0;         // tileset cell on the foreground layer
+    u16 wall=0;           // tileset cell on the background layer
+    u32 color=RGBA(92,72,56,255); // debug color when there is no tileset
+};
+
+// The built-in terrain: 0 air, 1 dirt, 2 stone, 4 grass; every id draws tileset cell id.
+static inline std::vector<TileDef> default_tile_defs(){
+    std::vector<TileDef> d(256);
+    for(size_t i=0;i<d.size();i++){ d[i].sprite=(u16)i; d[i].wall=(u16)i; }
+    d[0].flags=0; d[0].decay=12;
+    d[2].color=RGBA(110,110,120,255);
+    d[4].color=RGBA(70,160,80,255);
+    return d;
+}
+
+// Layers of a chunk. FG holds the colliding tiles, BG walls drawn behind them, META
+// per-tile overrides: low byte light decay (0 = from the FG definition), high byte emission.
+enum : int { LAYER_FG=0, LAYER_BG=1, LAYER_META=2, LAYERS=3 };
+static constexpr u16 META_DECAY_MASK = 0x00FF;
+static constexpr int META_EMIT_SHIFT = 8;
+
+// Dense layers are CHUNK*CHUNK blocks carved from slabs (stable addresses) and recycled
+// through a free list. Locked: workers allocate while filling chunks, the main thread frees.
+struct TileBlockPool {
+    static constexpr int SLAB=64;
+    std::mutex m;
+    std::vector<std::unique_ptr<u16[]>> slabs;
+    std::vector<u16*> free_list;
+    size_t live=0;
+
+    u16* alloc(){
+        std::lock_guard<std::mutex> lk(m);
+        if(free_list.empty()){
+            slabs.emplace_back(new u16[(size_t)SLAB*CHUNK*CHUNK]);
+            u16* b=slabs.back().get();
+            for(int i=SLAB-1;i>=0;i--) free_list.push_back(b + (size_t)i*CHUNK*CHUNK);
+        }
+        u16* p=free_list.back();
+        free_list.pop_back();
+        live++;
+        return p;
+    }
+    void release(u16* p){
+        std::lock_guard<std::mutex> lk(m);
+        free_list.push_back(p);
+        live--;
+    }
+};
+
+// One layer: uniform (a single value, e.g. all-air sky or all-stone rock) or dense. A uniform
+// layer keeps one row of its value, so row access reads the same either way.
+struct ChunkLayer {
+    u16* dense=nullptr;   // CHUNK*CHUNK tiles (TileBlockPool), nullptr = uniform
+    u16 row[CHUNK]{};     // uniform value, repeated
+
+    bool uniform() const { return !dense; }
+    u16 fill() const { return row[0]; }
+    const u16* row_ptr(int ly) const { return dense ? dense + (size_t)ly*CHUNK : row; }
+    u16 at(int lx,int ly) const { return dense ? dense[(size_t)ly*CHUNK + (size_t)lx] : row[0]; }
+};
+
+struct Chunk {
+    int cx=0, cy=0;
+    ChunkLayer layers[LAYERS];
+    bool dirty=false;         // changed by World::set since last persisted
+    bool recheck=false;       // dense layers may have become uniform (World::compact_chunk)
+    bool emits=false;         // may hold emitting tiles (gather_tile_lights)
+    u32 touch=0;              // World::frame of the last lookup (LRU clock)
+
+    // pre-composited surface of all CHUNK x CHUNK tiles (World::draw)
+    Image surf;
+    u32 surf_key=0;         // level/mode the surface was built for, 0 = none
+    bool surf_dirty=true;   // tiles changed since the last build
+    bool surf_empty=true;   // nothing visible: skip the blit
+    u32 surf_frame=0;       // last World::draw frame that used it
+
+    // FG and BG are all air: nothing to draw.
+    bool empty() const {
+        return layers[LAYER_FG].uniform() && layers[LAYER_FG].fill()==0 &&
+               layers[LAYER_BG].uniform() && layers[LAYER_BG].fill()==0;
+    }
+};
+
+static inline int floor_div(int a,int b){
+    int q=a/b;
+    return (a%b!=0 && ((a<0)!=(b<0))) ? q-1 : q;
+}
+
+// Chunks live in fixed blocks (stable addresses), recycled through a free list.
+struct ChunkPool {
+    static constexpr int BLOCK=64;
+    std::vector<std::unique_ptr<Chunk[]>> blocks;
+    std::vector<Chunk*> free_list;
+    size_t live=0;
+
+    Chunk* alloc(){
+        if(free_list.empty()){
+            blocks.emplace_back(new Chunk[BLOCK]);
+            Chunk* b=blocks.back().get();
+            for(int i=BLOCK-1;i>=0;i--) free_list.push_back(b+i);
+        }
+        Chunk* c=free_list.back();
+        free_list.pop_back();
+        live++;
+        return c;
+    }
+    void release(Chunk* c){
+        *c=Chunk{};
+        free_list.push_back(c);
+        live--;
+    }
+};
+
+// Read-only snapshot of a rectangular tile region (row-major, world tile coords),
+// filled with one memcpy per chunk row segment instead of per-tile lookups.
+struct TileRegion {
+    int x0=0,y0=0,w=0,h=0;
+    std::vector<u16> t;
+
+    bool contains(int wx,int wy) const { return wx>=x0 && wy>=y0 && wx<x0+w && wy<y0+h; }
+    const u16* row(int wy) const { return t.data() + (size_t)(wy-y0)*(size_t)w; }
+    u16 at(int wx,int wy) const { return t[(size_t)(wy-y0)*(size_t)w + (size_t)(wx-x0)]; }
+};
+
+static inline long long chunk_key(int cx,int cy){
+    return ( (long long)(u32)cx << 32 ) ^ (long long)(u32)cy;
+}
+
+// ============================================================
+// File I/O (memory-mapped reads, replace-by-rename writes)
+// ============================================================
+struct MappedFile {
+    HANDLE file=INVALID_HANDLE_VALUE;
+    HANDLE mapping=nullptr;
+    const u8* data=nullptr;
+    size_t size=0;
+
+    MappedFile()=default;
+    MappedFile(const MappedFile&)=delete;
+    MappedFile& operator=(const MappedFile&)=delete;
+    ~MappedFile(){ close(); }
+
+    bool open(const wchar_t* path){
+        close();
+        file=CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file==INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz{};
+        if(!GetFileSizeEx(file,&sz) || sz.QuadPart<=0){ close(); return false; }
+        size=(size_t)sz.QuadPart;
+        mapping=CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping){ close(); return false; }
+        data=(const u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(!data){ close(); return false; }
+        return true;
+    }
+    void close(){
+        if(data){ UnmapViewOfFile(data); data=nullptr; }
+        if(mapping){ CloseHandle(mapping); mapping=nullptr; }
+        if(file!=INVALID_HANDLE_VALUE){ CloseHandle(file); file=INVALID_HANDLE_VALUE; }
+        size=0;
+    }
+};
+
+// Write to path.tmp, then rename over path (readers never see a half-written file).
+static inline bool write_file_replace(const std::wstring& path, const void* data, size_t bytes){
+    std::wstring tmp=path+L".tmp";
+    HANDLE f=CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(f==INVALID_HANDLE_VALUE) return false;
+    const u8* p=(const u8*)data;
+    bool ok=true;
+    while(bytes>0 && ok){
+        DWORD chunk=(DWORD)std::min<size_t>(bytes, 1u<<30), wrote=0;
+        ok = WriteFile(f, p, chunk, &wrote, nullptr) && wrote==chunk;
+        p+=chunk; bytes-=chunk;
+    }
+    CloseHandle(f);
+    if(!ok) return false;
+    return MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)!=0;
+}
+
+// Input log file: "WEIN", u32 version (1), u32 frames, u32 reserved, then InputLog::data.
+static inline bool save_input_log(const char* path, const InputLog& log){
+    std::wstring wpath;
+    if(!WIC::mb_to_wide(path, wpath)) return false;
+    u32 hdr[4]={ 0x4E494557u /* "WEIN" */, 1u, (u32)log.size(), 0u };
+    std::vector<u8> file(sizeof(hdr)+log.data.size());
+    std::memcpy(file.data(), hdr, sizeof(hdr));
+    if(!log.data.empty()) std::memcpy(file.data()+sizeof(hdr), log.data.data(), log.data.size());
+    return write_file_replace(wpath, file.data(), file.size());
+}
+static inline bool load_input_log(const char* path, InputLog& log){
+    std::wstring wpath;
+    if(!WIC::mb_to_wide(path, wpath)) return false;
+    MappedFile f;
+    if(!f.open(wpath.c_str()) || f.size<16) return false;
+    u32 hdr[4];
+    std::memcpy(hdr, f.data, sizeof(hdr));
+    if(hdr[0]!=0x4E494557u || hdr[1]!=1u) return false;
+    return log.assign(f.data+sizeof(hdr), f.size-sizeof(hdr), (int)hdr[2]);
+}
+
+// ============================================================
+// Profiler overlay + Chrome trace export
+// ============================================================
+// Writes the frames the profiler keeps (Profiler::history) as Chrome trace JSON.
+static inline bool save_chrome_trace(const char* path, const Profiler& p=profiler()){
+    std::wstring wpath;
+    if(!WIC::mb_to_wide(path, wpath)) return false;
+    std::string json;
+    p.chrome_trace(json);
+    return write_file_replace(wpath, json.data(), json.size());
+}
+
+// UI window with min/avg/p99 per zone and flame bars of one frame (a row per thread).
+// Numbers are snapshotted every refresh frames, so the cached window surface is only
+// rebuilt then.
+struct ProfOverlay {
+    int x=20, y=380, w=560, h=330;
+    bool open=true;
+    int refresh=15;
+    int max_rows=14;
+    int bar_h=6;
+
+    int tick=0;
+    std::vector<ProfStats> st;
+    std::vector<std::string> lines;
+    Profiler::Frame flame;
+    std::vector<std::string> thread_names;
+
+    void snapshot(const Profiler& p){
+        p.all_stats(st);
+        std::sort(st.begin()+ (st.empty()?0:1), st.end(), [](const ProfStats& a,const ProfStats& b){ return a.avg_ms>b.avg_ms; });
+        size_t nl=0;
+        auto line=[&](const char* t){ if(nl==lines.size()) lines.emplace_back(); lines[nl++].assign(t); }; // keeps capacity
+        char buf[128];
+        std::snprintf(buf,sizeof(buf),"%-30s %7s %7s %7s %5s","zone (ms per frame)","min","avg","p99","calls");
+        line(buf);
+        for(size_t i=0;i<st.size() && (int)i<max_rows;i++){
+            std::snprintf(buf,sizeof(buf),"%-30.30s %7.3f %7.3f %7.3f %5d", st[i].name, st[i].min_ms, st[i].avg_ms, st[i].p99_ms, st[i].calls);
+            line(buf);
+        }
+        if(AllocCounters::hooked){
+            std::snprintf(buf,sizeof(buf),"heap allocs per frame: last %llu, max %llu",
+                          (unsigned long long)p.last_allocs(), (unsigned long long)p.max_allocs());
+            line(buf);
+        }
+        if(p.dropped){ std::snprintf(buf,sizeof(buf),"dropped events: %llu",(unsigned long long)p.dropped); line(buf); }
+        lines.resize(nl);
+        if(const Profiler::Frame* f=p.last_frame()) flame=*f;
+        std::lock_guard<std::mutex> lk(p.rings_m);
+        thread_names.clear();
+        for(const auto& r: p.rings) thread_names.push_back(r->name);
+    }
+
+    void draw(UI& ui, const Profiler& p=profiler()){
+        if(tick++ % std::max(refresh,1) == 0) snapshot(p);
+        if(!ui.window_begin("Profiler", x,y,w,h, open)) return;
+        for(const std::string& l: lines) ui.label(l.c_str(), 1);
+
+        // flame bars: x = time within the frame, one band per thread, one bar row per depth
+        int depth=1;
+        ScratchScope scope;
+        Span<int> band=arena_span<int>(scope.a, thread_names.size());
+        for(int& b: band) b=-1;
+        int bands=0;
+        for(const ProfEvent& e: flame.ev){
+            depth=std::max(depth,(int)e.depth+1);
+            if(e.tid<band.size() && band[e.tid]<0) band[e.tid]=bands++;
+        }
+        const int label_w=60, band_h=depth*bar_h+4;
+        int cw=ui.win.w-16;
+        RectI r=ui.reserve(cw, std::max(bands,1)*band_h);
+        i64 span=std::max<i64>(flame.t1-flame.t0,1);
+        int bw=std::max(cw-label_w,1);
+        for(size_t t=0;t<band.size();t++){
+            if(band[t]<0) continue;
+            int by=r.y0 + band[t]*band_h;
+            draw_text(*ui.c, r.x0, by, 1, RGBA(200,200,210,255), thread_names[t].c_str());
+            ui.c->rect_fill(r.x0+label_w, by, bw, band_h-2, RGBA(40,42,50,200));
+        }
+        for(const ProfEvent& e: flame.ev){
+            if(e.tid>=band.size() || band[e.tid]<0) continue;
+            i64 a=std::max<i64>(e.t0-flame.t0,0), b=std::min<i64>(e.t1-flame.t0,span);
+            if(b<a) continue;
+            int x0=(int)(a*bw/span), x1=std::max((int)(b*bw/span), x0+1);
+            u32 hsh=fnv1a(e.name);
+            u32 col=RGBA(90+(hsh&127), 90+((hsh>>8)&127), 90+((hsh>>16)&127), 255);
+            ui.c->rect_fill(r.x0+label_w+x0, r.y0 + band[e.tid]*band_h + e.depth*bar_h, x1-x0, bar_h-1, col);
+        }
+        ui.window_end();
+    }
+};
+
+// ============================================================
+// Asset manager (async WIC decode, dedupe/refcount by path, baked texture cache)
+// ============================================================
+// load(path) returns a shared Asset right away. On a cache hit (source unchanged, or
+// gone) the pixels are copied out of the memory-mapped cache file and it is ready at
+// once; otherwise a worker decodes it (its own MTA WIC factory) and the image is
+// published on the window thread (App::frame_begin runs post_main), so asset->img never
+// changes while it is drawn. save_cache() bakes every loaded image for the next run.
+//
+// Cache file: "WTC1", u32 count, count x CacheEntry, then path bytes and 16-byte
+// aligned AARRGGBB pixels.
+enum class AssetState { Loading, Ready, Failed };
+
+struct Asset {
+    std::string path;
+    Image img;                      // window thread only; empty until Ready
+    AssetState state=AssetState::Loading;
+    int refs=0;
+    u64 src_size=0, src_time=0;     // source file stamp (0 if unknown)
+    JobCounter decoding;
+
+    const Image* image() const { return state==AssetState::Ready ? &img : nullptr; }
+};
+
+struct AssetManager {
+    struct CacheEntry {
+        u64 src_size, src_time;
+        u32 w, h;
+        u64 px_off;
+        u32 path_off, path_len;
+    };
+    static constexpr u32 CACHE_MAX_DIM=1u<<15; // larger entries are treated as corrupt
+
+    JobSystem* jobs=nullptr;
+    std::unordered_map<std::string, std::shared_ptr<Asset>> assets;
+
+    std::wstring cache_path;
+    MappedFile cache;
+    std::unordered_map<std::string, const CacheEntry*> cache_index;
+    int cache_hits=0, decodes=0;
+
+    AssetManager()=default;
+    AssetManager(const AssetManager&)=delete;
+    AssetManager& operator=(const AssetManager&)=delete;
+    ~AssetManager(){ shutdown(); }
+
+    // cache_file: baked cache to read (and write in save_cache), nullptr for none.
+    void init(JobSystem& js, const char* cache_file=nullptr){
+        jobs=&js;
+        cache_path.clear();
+        if(cache_file){
+            WIC::mb_to_wide(cache_file, cache_path);
+            while(!cache_path.empty() && cache_path.back()==L'\0') cache_path.pop_back();
+            open_cache();
+        }
+    }
+
+    void shutdown(){
+        wait_all();
+        assets.clear();
+        cache_index.clear();
+        cache.close();
+    }
+
+    // One shared Asset per path; every load() needs a matching release().
+    std::shared_ptr<Asset> load(const char* path){
+        auto it=assets.find(path);
+        if(it!=assets.end()){ it->second->refs++; return it->second; }
+
+        auto a=std::make_shared<Asset>();
+        a->path=path;
+        a->refs=1;
+        assets.emplace(a->path, a);
+
+        bool have_src=file_stamp(path, a->src_size, a->src_time);
+        auto ce=cache_index.find(a->path);
+        if(ce!=cache_index.end()){
+            const CacheEntry& e=*ce->second;
+            if(!have_src || (e.src_size==a->src_size && e.src_time==a->src_time)){
+                a->img.w=(int)e.w; a->img.h=(int)e.h;
+                a->img.px.resize((size_t)e.w*(size_t)e.h);
+                a->img.touch();
+                std::memcpy(a->img.px.data(), cache.data+e.px_off, a->img.px.size()*4u);
+                a->src_size=e.src_size; a->src_time=e.src_time;
+                a->state=AssetState::Ready;
+                cache_hits++;
+                return a;
+            }
+        }
+        if(!have_src){ a->state=AssetState::Failed; return a; }
+
+        decodes++;
+        JobSystem* js=jobs;
+        jobs->submit_background([a,js]{
+            static thread_local WIC wic; // per worker, MTA; released when the worker exits
+            Image img;
+            bool ok = wic.init(COINIT_MULTITHREADED) && wic.load(img, a->path.c_str());
+            auto im=std::make_shared<Image>(std::move(img));
+            js->post_main([a,im,ok]{
+                a->img=std::move(*im);
+                a->state = ok ? AssetState::Ready : AssetState::Failed;
+            });
+        }, &a->decoding);
+        return a;
+    }
+
+    void release(const std::shared_ptr<Asset>& a){
+        if(!a || --a->refs>0) return;
+        auto it=assets.find(a->path);
+        if(it!=assets.end() && it->second==a) assets.erase(it); // an in-flight decode keeps it alive
+    }
+
+    // Window thread: block until a (or everything) has finished loading.
+    void wait(const std::shared_ptr<Asset>& a){
+        if(!a || a->state!=AssetState::Loading) return;
+        jobs->wait(a->decoding);
+        jobs->run_main();
+    }
+    void wait_all(){
+        if(!jobs) return;
+        for(auto& kv: assets) jobs->wait(kv.second->decoding);
+        jobs->run_main();
+    }
+
+    // Bake all ready images (plus cache entries not loaded this run) into cache_path.
+    bool save_cache(){
+        if(cache_path.empty()) return false;
+        struct Out { std::string path; u64 size, time; u32 w, h; const u32* px; };
+        std::vector<Out> out;
+        for(auto& kv: assets){
+            const Asset& a=*kv.second;
+            if(a.state==AssetState::Ready && !a.img.empty() && (u32)a.img.w<=CACHE_MAX_DIM && (u32)a.img.h<=CACHE_MAX_DIM)
+                out.push_back(Out{a.path, a.src_size, a.src_time, (u32)a.img.w, (u32)a.img.h, a.img.px.data()});
+        }
+        for(auto& kv: cache_index){
+            if(assets.count(kv.first)) continue;
+            const CacheEntry& e=*kv.second;
+            out.push_back(Out{kv.first, e.src_size, e.src_time, e.w, e.h, (const u32*)(cache.data+e.px_off)});
+        }
+
+        size_t head=8+out.size()*sizeof(CacheEntry), names=0, pixels=0;
+        for(auto& o: out){ names+=o.path.size(); pixels+=(size_t)o.w*(size_t)o.h*4u; }
+        auto align16=[](size_t v){ return (v+15)&~(size_t)15; };
+        std::vector<u8> file(align16(head+names), 0);
+        u32 magic=0x31435457u, count=(u32)out.size(); // "WTC1"
+        std::memcpy(file.data(), &magic, 4);
+        std::memcpy(file.data()+4, &count, 4);
+        size_t name_at=head;
+        file.reserve(file.size()+pixels+out.size()*16);
+        for(size_t i=0;i<out.size();i++){
+            const Out& o=out[i];
+            CacheEntry e{o.size, o.time, o.w, o.h, (u64)file.size(), (u32)name_at, (u32)o.path.size()};
+            std::memcpy(file.data()+8+i*sizeof(CacheEntry), &e, sizeof(e));
+            std::memcpy(file.data()+name_at, o.path.data(), o.path.size());
+            name_at+=o.path.size();
+            size_t bytes=(size_t)o.w*(size_t)o.h*4u;
+            const u8* src=(const u8*)o.px;
+            file.insert(file.end(), src, src+bytes);
+            file.resize(align16(file.size()), 0);
+        }
+
+        cache_index.clear();
+        cache.close(); // the mapping would block the rename
+        bool ok=write_file_replace(cache_path, file.data(), file.size());
+        open_cache();
+        return ok;
+    }
+
+private:
+    void open_cache(){
+        cache_index.clear();
+        if(!cache.open(cache_path.c_str())) return;
+        u32 magic=0, count=0;
+        if(cache.size<8){ cache.close(); return; }
+        std::memcpy(&magic, cache.data, 4);
+        std::memcpy(&count, cache.data+4, 4);
+        if(magic!=0x31435457u || 8+(size_t)count*sizeof(CacheEntry) > cache.size){ cache.close(); return; }
+        const CacheEntry* es=(const CacheEntry*)(cache.data+8);
+        for(u32 i=0;i<count;i++){
+            const CacheEntry& e=es[i];
+            if((size_t)e.path_off+e.path_len > cache.size) continue;
+            if(e.w>CACHE_MAX_DIM || e.h>CACHE_MAX_DIM || e.px_off>(u64)cache.size) continue;
+            if((u64)e.w*(u64)e.h*4u > (u64)cache.size-e.px_off) continue;
+            cache_index[std::string((const char*)cache.data+e.path_off, e.path_len)]=&e;
+        }
+    }
+
+    static bool file_stamp(const char* path, u64& size, u64& time){
+        std::wstring w;
+        if(!WIC::mb_to_wide(path, w)) return false;
+        WIN32_FILE_ATTRIBUTE_DATA fa{};
+        if(!GetFileAttributesExW(w.c_str(), GetFileExInfoStandard, &fa)) return false;
+        size=((u64)fa.nFileSizeHigh<<32) | fa.nFileSizeLow;
+        time=((u64)fa.ftLastWriteTime.dwHighDateTime<<32) | fa.ftLastWriteTime.dwLowDateTime;
+        return true;
+    }
+};
+
+// ============================================================
+// Chunk store (region files: REGION x REGION chunks, RLE u16 tile layers)
+// ============================================================
+// File "r.<rx>.<ry>.wrg":
+//   u32 magic 'WRG1', u32 slots (=REGION*REGION), u32 off[slots], u32 len[slots], payloads...
+//   payload = (u16 run, u16 tile) pairs covering LAYERS*CHUNK*CHUNK tiles (layer-major);
+//   len 0 = chunk absent. Payloads of CHUNK*CHUNK tiles (before layers) hold FG only.
+static inline void rle_encode_u16(const u16* t,int n,std::vector<u8>& out){
+    out.clear();
+    for(int i=0;i<n;){
+        u16 v=t[i];
+        int run=1;
+        while(i+run<n && t[i+run]==v && run<0xFFFF) run++;
+        u16 pair[2]={(u16)run, v};
+        const u8* b=(const u8*)pair;
+        out.insert(out.end(), b, b+4);
+        i+=run;
+    }
+}
+static inline bool rle_decode_u16(const u8* p,size_t bytes,u16* t,int n){
+    int i=0;
+    for(size_t o=0; o+4<=bytes; o+=4){
+        u16 pair[2];
+        std::memcpy(pair, p+o, 4);
+        if(pair[0]==0 || i+pair[0]>n) return false;
+        std::fill(t+i, t+i+pair[0], pair[1]);
+        i+=pair[0];
+    }
+    return i==n;
+}
+
+struct ChunkStore {
+    static constexpr int REGION=16;
+    static constexpr int SLOTS=REGION*REGION;
+    static constexpr u32 MAGIC=0x31475257u; // "WRG1"
+
+    std::wstring dir; // empty: persistence off
+
+    // encoded chunks not yet written to their region file
+    struct Pending { int cx=0, cy=0; u32 ver=0; std::vector<u8> data; };
+    std::mutex m;     // guards overlay/ver
+    std::unordered_map<long long, Pending> overlay;
+    u32 ver=0;
+
+    std::mutex flush_m;   // one flush at a time
+    std::mutex locks_m;   // guards region_locks
+    std::unordered_map<long long, std::unique_ptr<std::mutex>> region_locks; // per region file: reads vs its rewrite
+    std::atomic<u32> flush_req{0};
+    std::atomic<bool> flushing{false};
+    std::atomic<int> io_inflight{0}; // dropped under io_wait_m
+    std::mutex io_wait_m;
+    std::condition_variable io_cv;   // signalled when io_inflight reaches 0
+
+    bool enabled() const { return !dir.empty(); }
+
+    static int region_of(int c){ return floor_div(c, REGION); }
+    static int slot_of(int cx,int cy){
+        return (cy-region_of(cy)*REGION)*REGION + (cx-region_of(cx)*REGION);
+    }
+    std::mutex& region_lock(int rx,int ry){
+        std::lock_guard<std::mutex> lk(locks_m);
+        auto& lock=region_locks[chunk_key(rx,ry)];
+        if(!lock) lock.reset(new std::mutex());
+        return *lock;
+    }
+
+    std::wstring region_path(int rx,int ry) const {
+        wchar_t name[64];
+        swprintf(name, 64, L"\\r.%d.%d.wrg", rx, ry);
+        return dir+name;
+    }
+
+    // Queue the LAYERS*CHUNK*CHUNK tiles of chunk (cx,cy) for writing (copy is taken).
+    void put(int cx,int cy,const u16* tiles){
+        Pending p;
+        p.cx=cx; p.cy=cy;
+        rle_encode_u16(tiles, LAYERS*CHUNK*CHUNK, p.data);
+        std::lock_guard<std::mutex> lk(m);
+        p.ver=++ver;
+        overlay[chunk_key(cx,cy)]=std::move(p);
+    }
+
+    // Load chunk tiles from the overlay or its memory-mapped region file. Any thread.
+    bool load(int cx,int cy,u16* tiles){
+        if(!enabled()) return false;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            auto it=overlay.find(chunk_key(cx,cy));
+            if(it!=overlay.end())
+                return decode(it->second.data.data(), it->second.data.size(), tiles);
+        }
+        int rx=region_of(cx), ry=region_of(cy);
+        std::lock_guard<std::mutex> io(region_lock(rx,ry)); // only a rewrite of this file blocks
+        MappedFile f;
+        if(!f.open(region_path(rx, ry).c_str())) return false;
+        const u8* p=nullptr; size_t n=0;
+        if(!region_slot(f, slot_of(cx,cy), p, n)) return false;
+        return decode(p, n, tiles);
+    }
+
+    // All layers, or a foreground-only payload (other layers cleared).
+    static bool decode(const u8* p,size_t n,u16* tiles){
+        if(rle_decode_u16(p, n, tiles, LAYERS*CHUNK*CHUNK)) return true;
+        if(!rle_decode_u16(p, n, tiles, CHUNK*CHUNK)) return false;
+        std::fill(tiles + CHUNK*CHUNK, tiles + LAYERS*CHUNK*CHUNK, (u16)0);
+        return true;
+    }
+
+    static bool region_slot(const MappedFile& f,int slot,const u8*& p,size_t& n){
+        const size_t hdr=8 + 8*(size_t)SLOTS;
+        if(f.size<hdr) return false;
+        u32 magic=0, slots=0, off=0, len=0;
+        std::memcpy(&magic, f.data, 4);
+        std::memcpy(&slots, f.data+4, 4);
+        if(magic!=MAGIC || slots!=(u32)SLOTS) return false;
+        std::memcpy(&off, f.data + 8 + 4*(size_t)slot, 4);
+        std::memcpy(&len, f.data + 8 + 4*(size_t)SLOTS + 4*(size_t)slot, 4);
+        if(len==0 || (size_t)off+(size_t)len>f.size) return false;
+        p=f.data+off; n=len;
+        return true;
+    }
+
+    // Merge the overlay into the region files (blocking, any thread).
+    void flush(){
+        if(!enabled()) return;
+        std::lock_guard<std::mutex> fl(flush_m);
+
+        std::vector<Pending> snap;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            snap.reserve(overlay.size());
+            for(auto& kv: overlay) snap.push_back(kv.second);
+        }
+        if(snap.empty()) return;
+
+        std::unordered_map<long long, std::vector<const Pending*>> regions;
+        for(const Pending& p: snap) regions[chunk_key(region_of(p.cx), region_of(p.cy))].push_back(&p);
+
+        std::vector<long long> written;
+        for(auto& kv: regions){
+            int rx=region_of(kv.second[0]->cx), ry=region_of(kv.second[0]->cy);
+            std::wstring path=region_path(rx,ry);
+            std::lock_guard<std::mutex> io(region_lock(rx,ry)); // loads elsewhere keep going
+
+            // start from the current file contents
+            std::vector<std::vector<u8>> slots((size_t)SLOTS);
+            {
+                MappedFile f;
+                if(f.open(path.c_str())){
+                    for(int i=0;i<SLOTS;i++){
+                        const u8* p=nullptr; size_t n=0;
+                        if(region_slot(f,i,p,n)) slots[(size_t)i].assign(p,p+n);
+                    }
+                }
+            }
+            for(const Pending* p: kv.second)
+                slots[(size_t)slot_of(p->cx, p->cy)]=p->data;
+
+            std::vector<u8> file(8 + 8*(size_t)SLOTS, 0);
+            u32 hdr[2]={MAGIC,(u32)SLOTS};
+            std::memcpy(file.data(), hdr, 8);
+            for(int i=0;i<SLOTS;i++){
+                const auto& d=slots[(size_t)i];
+                u32 off=d.empty()?0u:(u32)file.size(), len=(u32)d.size();
+                std::memcpy(file.data() + 8 + 4*(size_t)i, &off, 4);
+                std::memcpy(file.data() + 8 + 4*(size_t)SLOTS + 4*(size_t)i, &len, 4);
+                file.insert(file.end(), d.begin(), d.end());
+            }
+            if(write_file_replace(path, file.data(), file.size()))
+                for(const Pending* p: kv.second) written.push_back(chunk_key(p->cx,p->cy));
+        }
+
+        // drop overlay entries that reached disk and were not replaced meanwhile
+        std::lock_guard<std::mutex> lk(m);
+        for(const Pending& p: snap){
+            long long k=chunk_key(p.cx,p.cy);
+            if(std::find(written.begin(), written.end(), k)==written.end()) continue;
+            auto it=overlay.find(k);
+            if(it!=overlay.end() && it->second.ver==p.ver) overlay.erase(it);
+        }
+    }
+
+    // Flush on a worker; requests made while a flush runs are folded into it.
+    void flush_async(JobSystem& jobs){
+        if(!enabled()) return;
+        flush_req.fetch_add(1);
+        if(flushing.exchange(true)) return;
+        io_inflight.fetch_add(1);
+        jobs.submit_background([this]{
+            for(;;){
+                u32 seen=flush_req.load();
+                flush();
+                flushing.store(false);
+                if(flush_req.load()==seen) break;
+                if(flushing.exchange(true)) break; // a newer job took over
+            }
+            std::lock_guard<std::mutex> lk(io_wait_m);
+            if(io_inflight.fetch_sub(1)==1) io_cv.notify_all();
+        });
+    }
+
+    // Block until background flushes have finished.
+    void wait(){
+        std::unique_lock<std::mutex> lk(io_wait_m);
+        io_cv.wait(lk, [&]{ return io_inflight.load()==0; });
+    }
+};
+
+// Procedural generator: fill tiles[LAYERS][CHUNK*CHUNK] (layer-major, rows within a layer)
+// of chunk (cx,cy); arrives zeroed, so writing only the first layer leaves BG/META empty.
+// Runs on worker threads: must only touch its arguments.
+using WorldGenFn = void(*)(u32 seed, int cx, int cy, u16* tiles, void* user);
+
+// Default terrain: wavy surface, grass/dirt/stone with matching walls below the surface.
+// The seed shifts the wave phases.
+static inline void world_gen_default(u32 seed, int cx, int cy, u16* tiles, void* user){
+    (void)user;
+    u32 hs=seed*0x9E3779B1u; hs^=hs>>15; hs*=0x85EBCA77u; hs^=hs>>13;
+    f32 ph0=(f32)(hs & 0xFFFFu)*(6.2831853f/65536.0f);
+    f32 ph1=(f32)(hs >> 16)*(6.2831853f/65536.0f);
+
+    for(int ty=0; ty<CHUNK; ty++){
+        for(int tx=0; tx<CHUNK; tx++){
+            int wx = cx*CHUNK + tx;
+            int wy = cy*CHUNK + ty;
+
+            // wavy surface
+            f32 h = std::sin(wx*0.08f + ph0)*4.0f + std::sin(wx*0.02f + ph1)*10.0f;
+            int ground = (int)(18.0f + h);
+
+            u16 tile=0;
+            if(wy>ground){
+                tile=1; // dirt
+                if(wy>ground+10) tile=2; // stone
+            } else if(wy==ground){
+                tile=4; // grass
+            }
+            size_t i=(size_t)ty*(size_t)CHUNK + (size_t)tx;
+            tiles[i]=tile;
+            if(wy>ground) tiles[(size_t)LAYER_BG*CHUNK*CHUNK + i]=tile; // wall behind, shows when dug out
+        }
+    }
+}
+
+struct World {
+    Tileset ts{};
+    int tile_px=32; // world pixels per tile
+    u32 seed=0xC0FFEEu;
 
-        // title
-        draw_text(*c, x+pad, y+6, 2, RGBA(235,235,240,255), title);
+    // Tile definitions (solid(), light decay/emission, tileset cells). Workers read them
+    // while filling chunks: change them before streaming (or after wait_stream), then
+    // call invalidate_surfaces().
+    std::vector<TileDef> tile_defs=default_tile_defs();
+    TileDef unknown_def{};          // ids past tile_defs and TILE_UNKNOWN: solid, decay 18
+    u32 wall_tint=RGBA(150,150,160,255); // BG layer shade
+
+    std::unordered_map<long long, Chunk*> map; // key->chunk (storage owned by pool)
+    ChunkPool pool;
+    TileBlockPool blocks;                      // dense layers
+
+    // Lookup caches in front of the hash map: the last chunk hit, then a toroidal
+    // RING x RING window indexed by (cx,cy) mod RING. Any RING x RING block of chunks
+    // maps without collisions, and draw touches every visible chunk each frame, so the
+    // window follows the camera.
+    static constexpr int RING=16;
+    std::array<Chunk*,RING*RING> ring{};
+    Chunk* last=nullptr;
+
+    WorldGenFn gen=world_gen_default;
+    void* gen_user=nullptr;
+
+    // Background generation (stream): chunks queued on workers, published on the main thread.
+    int stream_margin=2;        // chunks pre-generated beyond the visible range
+    int stream_max_inflight=32;
+    std::unordered_map<long long, Chunk*> pending; // queued, not yet published (main thread only)
+    std::mutex done_m;
+    std::vector<Chunk*> done;                      // finished by workers (guarded by done_m)
+    std::atomic<int> inflight{0};                  // dropped under done_m
+    std::condition_variable done_cv;               // signalled when inflight reaches 0
+    struct StreamReq { int d2, cx, cy; };
+    std::vector<StreamReq> want;                   // scratch
+
+    // Residency (see enforce_residency): chunks outside resident_radius are evicted
+    // least-recently-used first while resident memory exceeds mem_budget.
+    ChunkStore store;                // region files, enabled by open()
+    int resident_radius=6;           // chunks (Chebyshev) around the camera never evicted
+    size_t mem_budget=(size_t)64<<20;
+    int residency_interval=15;       // stream() calls between residency passes
+    u32 frame=0;                     // stream() calls, LRU clock
+    std::vector<Chunk*> evict_scratch;
+
+    // Edit log: tile rects (inclusive) whose contents changed through set() or a chunk
+    // load/unload, for incremental consumers (LightMap). edit_seq counts every entry;
+    // the ring keeps the last EDIT_LOG, a consumer further behind must rebuild.
+    static constexpr int EDIT_LOG=256;
+    std::array<RectI,EDIT_LOG> edit_log{};
+    u64 edit_seq=0;
+
+    void note_edit(RectI r){
+        edit_log[(size_t)(edit_seq%(u64)EDIT_LOG)]=r;
+        edit_seq++;
+    }
+    void note_chunk(int cx,int cy){
+        note_edit(RectI{cx*CHUNK, cy*CHUNK, cx*CHUNK+CHUNK-1, cy*CHUNK+CHUNK-1});
+    }
 
-        // close visuals
-        u32 cbc = close_hot ? RGBA(255,120,120,240) : RGBA(200,90,90,200);
-        c->rect_fill(cbx,cby,cbw,cbh,cbc);
-        c->rect_outline(cbx,cby,cbw,cbh,1,RGBA(10,10,12,255));
-        draw_text(*c, cbx+5, cby+3, 2, RGBA(20,20,24,255), "X");
+    World()=default;
+    World(const World&)=delete;
+    World& operator=(const World&)=delete;
+    ~World(){
+        wait_stream();
+        put_dirty();   // resident edits would otherwise never reach the overlay
+        store.wait();
+        store.flush();
+    }
+    bool bilinear=true;
+    bool blend=true;
 
-        // content
-        int cx = x+pad;
-        int cy = y+th+pad;
-        int cw = w - 2*pad;
-        int ch = h - th - 2*pad;
+    bool chunk_cache=true;   // draw one cached surface per chunk (false: per-tile blits)
+    int surf_cache_max=128;  // cached surfaces kept before unused ones are dropped
+    int surf_count=0;
+    u32 draw_frame=0;
 
-        push_clip(cx,cy,cw,ch);
+    const TileDef& def(u16 t) const { return t<tile_defs.size() ? tile_defs[t] : unknown_def; }
 
-        win.x=x; win.y=y; win.w=w; win.h=h;
-        win.cx=cx; win.cy=cy;
-        return true;
-    }
+    // solid rule (TILE_UNKNOWN counts as solid: nothing walks or shines into unloaded chunks)
+    bool solid(u16 t) const { return (def(t).flags & TILE_SOLID)!=0; }
 
-    void window_end(){
-        pop_clip();
+    static inline long long key(int cx,int cy){ return chunk_key(cx,cy); }
+
+    static inline int ring_slot(int cx,int cy){
+        return (cy & (RING-1))*RING + (cx & (RING-1));
     }
 
-    void next_line(int h){
-        win.cy += h + 6;
+    // Loaded chunk or nullptr (never generates).
+    Chunk* find_chunk(int cx,int cy){
+        Chunk* c=last;
+        if(!(c && c->cx==cx && c->cy==cy)){
+            Chunk*& slot=ring[(size_t)ring_slot(cx,cy)];
+            if(!(slot && slot->cx==cx && slot->cy==cy)){
+                auto it=map.find(key(cx,cy));
+                if(it==map.end()) return nullptr;
+                slot=it->second;
+            }
+            c=last=slot;
+        }
+        c->touch=frame;
+        return c;
     }
 
-    void label(const char* s){
-        draw_text(*c, win.cx, win.cy, 2, RGBA(225,225,235,255), s);
-        next_line(text_line_h(2));
+    // Loaded chunk or nullptr; touches no caches, so it is safe for concurrent readers.
+    const Chunk* find_loaded(int cx,int cy) const {
+        const Chunk* slot=ring[(size_t)ring_slot(cx,cy)];
+        if(slot && slot->cx==cx && slot->cy==cy) return slot;
+        auto it=map.find(key(cx,cy));
+        return it==map.end() ? nullptr : it->second;
     }
 
-    bool button(const char* label, int w=160, int h=28){
-        if(w<=0) w=160;
-        if(h<=0) h=28;
-        int x=win.cx, y=win.cy;
+    void insert_chunk(Chunk* c){
+        c->touch=frame;
+        note_chunk(c->cx,c->cy);
+        map.emplace(key(c->cx,c->cy), c);
+        ring[(size_t)ring_slot(c->cx,c->cy)]=c;
+        last=c;
+    }
 
-        u32 id = fnv1a(label) ^ (win.id*0x9E3779B1u) ^ (++counter);
-        bool inside = pt_in(mx,my,x,y,w,h);
+    // Remove a loaded chunk from the map and caches and recycle it (does not persist).
+    void unload_chunk(Chunk* c){
+        note_chunk(c->cx,c->cy);
+        map.erase(key(c->cx,c->cy));
+        Chunk*& slot=ring[(size_t)ring_slot(c->cx,c->cy)];
+        if(slot==c) slot=nullptr;
+        if(last==c) last=nullptr;
+        if(!c->surf.px.empty()) surf_count--;
+        release_chunk(c);
+    }
 
-        if(inside) hot=id;
-        if(mp && inside) active=id;
+    void release_chunk(Chunk* c){
+        for(ChunkLayer& l: c->layers) if(l.dense) blocks.release(l.dense);
+        pool.release(c);
+    }
 
-        bool clicked=false;
-        if(mr && active==id && inside) clicked=true;
+    // Per-thread LAYERS*CHUNK*CHUNK staging buffer for generation, loads and saves.
+    static u16* chunk_scratch(){
+        static thread_local u16 t[(size_t)LAYERS*CHUNK*CHUNK];
+        return t;
+    }
 
-        u32 bg=RGBA(50,50,62,220);
-        if(hot==id) bg=RGBA(70,70,88,235);
-        if(active==id) bg=RGBA(90,90,112,245);
+    // Store full layers t (LAYERS*CHUNK*CHUNK) into c; uniform layers keep a single value. Any thread.
+    void pack_chunk(Chunk& c,const u16* t){
+        for(int li=0;li<LAYERS;li++){
+            const u16* src=t + (size_t)li*CHUNK*CHUNK;
+            ChunkLayer& l=c.layers[li];
+            if(std::all_of(src+1, src+CHUNK*CHUNK, [&](u16 v){ return v==src[0]; })){
+                if(l.dense){ blocks.release(l.dense); l.dense=nullptr; }
+                std::fill(l.row, l.row+CHUNK, src[0]);
+            }else{
+                if(!l.dense) l.dense=blocks.alloc();
+                std::memcpy(l.dense, src, sizeof(u16)*CHUNK*CHUNK);
+            }
+        }
+        c.recheck=false;
+        c.emits=chunk_emits(c);
+    }
+    void unpack_chunk(const Chunk& c,u16* t) const {
+        for(int li=0;li<LAYERS;li++){
+            const ChunkLayer& l=c.layers[li];
+            u16* dst=t + (size_t)li*CHUNK*CHUNK;
+            if(l.dense) std::memcpy(dst, l.dense, sizeof(u16)*CHUNK*CHUNK);
+            else        std::fill(dst, dst+CHUNK*CHUNK, l.fill());
+        }
+    }
+    // Return layers that edits made uniform to a single value.
+    void compact_chunk(Chunk& c){
+        u16* t=chunk_scratch();
+        unpack_chunk(c,t);
+        pack_chunk(c,t);
+    }
 
-        c->rect_fill(x,y,w,h,bg);
-        c->rect_outline(x,y,w,h,1,RGBA(10,10,12,255));
+    u8 tile_emit(u16 fg,u16 meta) const {
+        u8 e=(u8)(meta>>META_EMIT_SHIFT);
+        return e ? e : def(fg).emit;
+    }
+    bool chunk_emits(const Chunk& c) const {
+        const ChunkLayer& fg=c.layers[LAYER_FG];
+        const ChunkLayer& me=c.layers[LAYER_META];
+        if(fg.uniform() && me.uniform()) return tile_emit(fg.fill(), me.fill())!=0;
+        for(int ly=0;ly<CHUNK;ly++){
+            const u16* f=fg.row_ptr(ly);
+            const u16* m=me.row_ptr(ly);
+            for(int lx=0;lx<CHUNK;lx++) if(tile_emit(f[lx], m[lx])) return true;
+        }
+        return false;
+    }
 
-        int tw=text_width(label,2);
-        int tx=x + (w-tw)/2;
-        int ty=y + (h-text_line_h(2))/2;
-        draw_text(*c, tx,ty,2, RGBA(235,235,240,255), label);
+    // Disk first (if a store is open), generator otherwise. Any thread.
+    void fill_chunk(Chunk& c){
+        u16* t=chunk_scratch();
+        if(!(store.enabled() && store.load(c.cx, c.cy, t))){
+            std::fill(t, t+(size_t)LAYERS*CHUNK*CHUNK, (u16)0);
+            gen(seed, c.cx, c.cy, t, gen_user);
+        }
+        pack_chunk(c,t);
+    }
 
-        next_line(h);
-        return clicked;
+    Chunk& get_chunk(int cx,int cy){
+        if(Chunk* c=find_chunk(cx,cy)) return *c;
+
+        // synchronous fallback (a queued copy of this chunk is discarded on publish)
+        Chunk* c=pool.alloc();
+        c->cx=cx; c->cy=cy;
+        fill_chunk(*c);
+        insert_chunk(c);
+        return *c;
     }
 
-    bool checkbox(const char* label, bool& v){
-        int box=18;
-        int x=win.cx, y=win.cy;
-        int w = box + 10 + text_width(label,2);
-        int h = box;
+    // Read without generating: TILE_UNKNOWN if the chunk is not loaded.
+    u16 peek(int wx,int wy,int layer=LAYER_FG) const {
+        const Chunk* c = find_loaded(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+        if(!c) return TILE_UNKNOWN;
+        return c->layers[layer].at(wx&(CHUNK-1), wy&(CHUNK-1));
+    }
 
-        u32 id = fnv1a(label) ^ (win.id*0x85EBCA77u) ^ (++counter);
-        bool inside = pt_in(mx,my,x,y,w,h);
-        if(inside) hot=id;
-        if(mp && inside) active=id;
+    // Like row_ptr, but nullptr (n still set) if the chunk is not loaded.
+    const u16* peek_row(int wx,int wy,int& n,int layer=LAYER_FG) const {
+        int lx=wx&(CHUNK-1);
+        n=CHUNK-lx;
+        const Chunk* c = find_loaded(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+        if(!c) return nullptr;
+        return c->layers[layer].row_ptr(wy&(CHUNK-1)) + lx;
+    }
 
-        bool toggled=false;
-        if(mr && active==id && inside){
-            v=!v; toggled=true;
+    // Any solid tile in column wx, rows [wy0,wy1] / row wy, columns [wx0,wx1]? Never
+    // generates (unloaded reads as TILE_UNKNOWN); one chunk lookup per chunk crossed.
+    bool solid_col(int wx,int wy0,int wy1) const {
+        for(int y=wy0;y<=wy1;){
+            int ly=y&(CHUNK-1);
+            int n=std::min(CHUNK-ly, wy1-y+1);
+            const Chunk* c=find_loaded(wx>>CHUNK_SHIFT, y>>CHUNK_SHIFT);
+            if(!c){ if(solid(TILE_UNKNOWN)) return true; }
+            else if(c->layers[LAYER_FG].uniform()){ if(solid(c->layers[LAYER_FG].fill())) return true; }
+            else{
+                const u16* p=c->layers[LAYER_FG].dense + (size_t)ly*(size_t)CHUNK + (size_t)(wx&(CHUNK-1));
+                for(int i=0;i<n;i++,p+=CHUNK) if(solid(*p)) return true;
+            }
+            y+=n;
+        }
+        return false;
+    }
+    bool solid_row(int wy,int wx0,int wx1) const {
+        for(int x=wx0;x<=wx1;){
+            int n;
+            const u16* p=peek_row(x, wy, n);
+            n=std::min(n, wx1-x+1);
+            if(!p){ if(solid(TILE_UNKNOWN)) return true; }
+            else for(int i=0;i<n;i++) if(solid(p[i])) return true;
+            x+=n;
         }
+        return false;
+    }
 
-        c->rect_fill(x,y,box,box,RGBA(36,38,45,230));
-        c->rect_outline(x,y,box,box,1,RGBA(10,10,12,255));
-        if(v) c->rect_fill(x+4,y+4,box-8,box-8,RGBA(120,200,255,245));
+    u16 get(int wx,int wy,int layer=LAYER_FG){
+        Chunk& c = get_chunk(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+        return c.layers[layer].at(wx&(CHUNK-1), wy&(CHUNK-1));
+    }
 
-        draw_text(*c, x+box+10,y+2,2,RGBA(225,225,235,255), label);
-        next_line(box);
-        return toggled;
+    // Writing into a uniform layer makes it dense; it turns uniform again in the next
+    // residency pass (compact_chunk) if the edits restore a single value.
+    void set(int wx,int wy,u16 v,int layer=LAYER_FG){
+        Chunk& c = get_chunk(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+        ChunkLayer& l=c.layers[layer];
+        size_t i=(size_t)(wy&(CHUNK-1))*(size_t)CHUNK + (size_t)(wx&(CHUNK-1));
+        if(l.at(wx&(CHUNK-1), wy&(CHUNK-1))==v) return;
+        if(l.uniform()){
+            l.dense=blocks.alloc();
+            std::fill(l.dense, l.dense+CHUNK*CHUNK, l.fill());
+        }
+        l.dense[i]=v;
+        if(layer!=LAYER_META) c.surf_dirty=true;
+        c.dirty=true; c.recheck=true;
+        if(layer==LAYER_BG) return; // walls neither block nor emit light: no reflood
+        const ChunkLayer& fg=c.layers[LAYER_FG];
+        const ChunkLayer& me=c.layers[LAYER_META];
+        if(tile_emit(fg.at(wx&(CHUNK-1), wy&(CHUNK-1)), me.at(wx&(CHUNK-1), wy&(CHUNK-1)))) c.emits=true;
+        note_edit(RectI{wx,wy,wx,wy});
     }
 
-    f32 sliderf(const char* label, f32 v, f32 vmin, f32 vmax, int w=240, int h=18){
-        if(w<=0) w=240;
-        if(h<=0) h=18;
+    // Direct row access: tiles (wx..wx+n-1, wy) are contiguous, n = tiles left in the chunk row.
+    // Valid until the next set() in that chunk or the next residency pass (stream /
+    // enforce_residency may unload the chunk or compact_chunk its dense blocks away).
+    const u16* row_ptr(int wx,int wy,int& n,int layer=LAYER_FG){
+        Chunk& c = get_chunk(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+        int lx=wx&(CHUNK-1);
+        n=CHUNK-lx;
+        return c.layers[layer].row_ptr(wy&(CHUNK-1)) + lx;
+    }
 
-        int x=win.cx, y=win.cy;
-        draw_text(*c, x,y-18,2,RGBA(220,220,230,255), label);
+    // Copy the tiles of [x0,x0+w) x [y0,y0+h) into out, one chunk row segment at a time.
+    // Never generates: unloaded chunks read as TILE_UNKNOWN.
+    void read_region(TileRegion& out,int x0,int y0,int w,int h,int layer=LAYER_FG) const {
+        out.x0=x0; out.y0=y0;
+        out.w=std::max(w,0); out.h=std::max(h,0);
+        out.t.resize((size_t)out.w*(size_t)out.h);
+        for(int y=0;y<out.h;y++){
+            u16* dst=out.t.data() + (size_t)y*(size_t)out.w;
+            for(int x=0;x<out.w;){
+                int n=0;
+                const u16* src=peek_row(x0+x, y0+y, n, layer);
+                n=std::min(n, out.w-x);
+                if(src) std::memcpy(dst+x, src, (size_t)n*sizeof(u16));
+                else    std::fill(dst+x, dst+x+n, TILE_UNKNOWN);
+                x+=n;
+            }
+        }
+    }
 
-        u32 id = fnv1a(label) ^ (win.id*0x27D4EB2Du) ^ (++counter);
-        bool inside = pt_in(mx,my,x,y,w,h);
-        if(inside) hot=id;
-        if(mp && inside) active=id;
+    // Hand finished background chunks to the map (main thread).
+    void publish(){
+        std::vector<Chunk*> ready;
+        {
+            std::lock_guard<std::mutex> lk(done_m);
+            ready.swap(done);
+        }
+        for(Chunk* c: ready){
+            pending.erase(key(c->cx,c->cy));
+            if(find_chunk(c->cx,c->cy)){ release_chunk(c); continue; } // generated synchronously meanwhile
+            insert_chunk(c);
+        }
+    }
 
-        f32 t = (v - vmin) / (vmax - vmin);
-        t = clampf(t,0,1);
+    // Publish finished chunks, then queue generation of missing chunks around the
+    // camera (visible range + stream_margin), nearest first.
+    // Call outside TiledRasterizer::begin/end: eviction frees chunk surfaces.
+    void stream(const Camera2D& cam, JobSystem& jobs){
+        WE_ZONE("World::stream");
+        frame++;
+        publish();
+        if(residency_interval>0 && frame%(u32)residency_interval==0) enforce_residency(cam, jobs);
+
+        f32 left,top,right,bottom;
+        cam.view_bounds(left,top,right,bottom);
+        f32 cpx=(f32)(CHUNK*tile_px);
+        int cx0=(int)std::floor(left/cpx)-stream_margin;
+        int cx1=(int)std::floor(right/cpx)+stream_margin;
+        int cy0=(int)std::floor(top/cpx)-stream_margin;
+        int cy1=(int)std::floor(bottom/cpx)+stream_margin;
+        int ccx=(int)std::floor(cam.pos.x/cpx), ccy=(int)std::floor(cam.pos.y/cpx);
+
+        want.clear();
+        for(int cy=cy0; cy<=cy1; cy++){
+            for(int cx=cx0; cx<=cx1; cx++){
+                if(find_loaded(cx,cy) || pending.count(key(cx,cy))) continue;
+                int dx=cx-ccx, dy=cy-ccy;
+                want.push_back({dx*dx+dy*dy, cx, cy});
+            }
+        }
+        std::sort(want.begin(), want.end(), [](const StreamReq& a,const StreamReq& b){ return a.d2<b.d2; });
+
+        for(const StreamReq& r: want){
+            if(inflight.load()>=stream_max_inflight) break;
+            Chunk* c=pool.alloc(); // pool is main-thread only; workers just fill tiles
+            c->cx=r.cx; c->cy=r.cy;
+            pending.emplace(key(r.cx,r.cy), c);
+            inflight.fetch_add(1);
+            jobs.submit_background([this,c]{
+                fill_chunk(*c);
+                std::lock_guard<std::mutex> lk(done_m);
+                done.push_back(c);
+                if(inflight.fetch_sub(1)==1) done_cv.notify_all();
+            });
+        }
+    }
 
-        if(active==id && md){
-            f32 nt = (f32)(mx - x)/(f32)w;
-            nt = clampf(nt,0,1);
-            v = vmin + nt*(vmax-vmin);
-            t = nt;
+    // Block until every queued generation job has finished (then publish them).
+    void wait_stream(){
+        {
+            std::unique_lock<std::mutex> lk(done_m);
+            done_cv.wait(lk, [&]{ return inflight.load()==0; });
         }
+        publish();
+    }
 
-        c->rect_fill(x,y,w,h,RGBA(36,38,45,230));
-        int knob = std::max(h,10);
-        int kx = x + (int)((w-knob)*t);
-        u32 kc = (active==id)?RGBA(190,230,255,255):((hot==id)?RGBA(160,215,255,245):RGBA(120,200,255,235));
-        c->rect_fill(kx,y,knob,h,kc);
-        c->rect_outline(x,y,w,h,1,RGBA(10,10,12,255));
+    static size_t chunk_bytes(const Chunk& c){
+        size_t b=sizeof(Chunk) + c.surf.px.capacity()*sizeof(u32);
+        for(const ChunkLayer& l: c.layers) if(l.dense) b+=(size_t)CHUNK*CHUNK*sizeof(u16);
+        return b;
+    }
 
-        next_line(h+18);
-        return v;
+    // Compact chunks edited since the last pass, then evict LRU chunks outside
+    // resident_radius until under mem_budget. Dirty chunks are encoded into the store
+    // first (written in the background); without a store they stay.
+    void enforce_residency(const Camera2D& cam, JobSystem& jobs){
+        f32 cpx=(f32)(CHUNK*tile_px);
+        int ccx=(int)std::floor(cam.pos.x/cpx), ccy=(int)std::floor(cam.pos.y/cpx);
+
+        size_t bytes=0;
+        evict_scratch.clear();
+        for(auto& kv: map){
+            Chunk* c=kv.second;
+            if(c->recheck) compact_chunk(*c);
+            bytes+=chunk_bytes(*c);
+            int d=std::max(std::abs(c->cx-ccx), std::abs(c->cy-ccy));
+            if(d<=resident_radius) continue;
+            if(c->dirty && !store.enabled()) continue;
+            evict_scratch.push_back(c);
+        }
+        if(bytes<=mem_budget) return;
+
+        std::sort(evict_scratch.begin(), evict_scratch.end(), [](const Chunk* a,const Chunk* b){ return a->touch<b->touch; });
+        bool wrote=false;
+        for(Chunk* c: evict_scratch){
+            if(bytes<=mem_budget) break;
+            if(c->dirty){ put_chunk(*c); wrote=true; }
+            bytes-=chunk_bytes(*c);
+            unload_chunk(c);
+        }
+        if(wrote) store.flush_async(jobs);
     }
-};
 
-// ============================================================
-// World (chunked tiles) + physics helper
-// ============================================================
-static constexpr int CHUNK = 32;
+    // Use dir (UTF-8) for region files. Loaded chunks are dropped so everything streams
+    // back in from disk; the seed in dir/world.meta wins over World::seed.
+    bool open(const char* dir){
+        std::wstring wdir;
+        if(!WIC::mb_to_wide(dir, wdir)) return false;
+        while(!wdir.empty() && (wdir.back()==L'\0' || wdir.back()==L'\\' || wdir.back()==L'/')) wdir.pop_back();
+
+        wait_stream();
+        put_dirty();   // edits belong to the world being closed
+        store.wait();
+        store.flush();
+        while(!map.empty()) unload_chunk(map.begin()->second);
+
+        CreateDirectoryW(wdir.c_str(), nullptr);
+        store.dir=wdir;
+
+        MappedFile meta;
+        u32 hdr[3]={0,0,0};
+        if(meta.open((wdir+L"\\world.meta").c_str()) && meta.size>=sizeof(hdr)){
+            std::memcpy(hdr, meta.data, sizeof(hdr));
+            if(hdr[0]==0x31544D57u && hdr[1]==1u) seed=hdr[2]; // "WMT1"
+            meta.close();
+        }else{
+            save_meta();
+        }
+        return true;
+    }
 
-struct Tileset {
-    const Image* img=nullptr;
-    int tile_w=16, tile_h=16;
-    int cols=0, rows=0;
-};
+    bool save_meta(){
+        if(!store.enabled()) return false;
+        u32 hdr[3]={0x31544D57u, 1u, seed};
+        return write_file_replace(store.dir+L"\\world.meta", hdr, sizeof(hdr));
+    }
 
-static inline Tileset make_tileset(const Image* img,int tw,int th){
-    Tileset t{};
-    t.img=img; t.tile_w=tw; t.tile_h=th;
-    if(img && tw>0 && th>0){
-        t.cols = img->w / tw;
-        t.rows = img->h / th;
+    void put_chunk(const Chunk& c){
+        u16* t=chunk_scratch();
+        unpack_chunk(c,t);
+        store.put(c.cx, c.cy, t);
     }
-    return t;
-}
 
-struct Chunk {
-    int cx=0, cy=0;
-    std::vector<u16> tiles; // layer0 only for simplicity
-    bool used=false;
-};
+    // Encode every dirty resident chunk into the store overlay.
+    void put_dirty(){
+        if(!store.enabled()) return;
+        for(auto& kv: map){
+            Chunk* c=kv.second;
+            if(!c->dirty) continue;
+            put_chunk(*c);
+            c->dirty=false;
+        }
+    }
 
-struct World {
-    Tileset ts{};
-    int tile_px=32; // world pixels per tile
-    u32 seed=0xC0FFEEu;
+    // Persist every dirty chunk without stalling: encode now, write on a worker.
+    void save_all(JobSystem& jobs){
+        if(!store.enabled()) return;
+        put_dirty();
+        save_meta();
+        store.flush_async(jobs);
+    }
 
-    std::unordered_map<long long, Chunk> map; // key->chunk
-    bool bilinear=true;
-    bool blend=true;
+    u32 debug_color(u16 t) const { return def(t).color; }
 
-    // solid rule
-    bool solid(u16 t) const { return t!=0; }
+    // Call after changing ts/tile_px/tile_defs: every chunk surface is rebuilt on next draw.
+    void invalidate_surfaces(){
+        for(auto& kv: map) kv.second->surf_dirty=true;
+    }
 
-    static inline long long key(int cx,int cy){
-        return ( (long long)(u32)cx << 32 ) ^ (long long)(u32)cy;
+    // Surface pixels per tile: smallest power of two covering the on-screen tile size,
+    // capped at the tileset cell size (a cheap mip choice). Debug colors need 1px.
+    int surf_level(f32 screen_tile_px) const {
+        if(!(ts.img && ts.cols>0)) return 1;
+        int cap=std::max(1,std::max(ts.tile_w,ts.tile_h));
+        int p=1;
+        while(p<cap && (f32)p<screen_tile_px) p<<=1;
+        return std::min(p,cap);
     }
 
-    Chunk& get_chunk(int cx,int cy){
-        long long k=key(cx,cy);
-        auto it=map.find(k);
-        if(it!=map.end()) return it->second;
+    void release_surface(Chunk& c){
+        if(!c.surf.px.empty()) surf_count--;
+        c.surf=Image{};
+        c.surf_key=0;
+    }
+
+    // BG walls (wall_tint) behind non-opaque FG tiles; FG blends over a wall, else it is copied as-is.
+    void build_surface(Chunk& c,int p,u32 key){
+        bool have_ts = ts.img && ts.cols>0;
+        const ChunkLayer& fg=c.layers[LAYER_FG];
+        const ChunkLayer& bg=c.layers[LAYER_BG];
+        bool any=false;
+        for(const ChunkLayer* l: {&fg,&bg}){
+            if(l->uniform()) any|=l->fill()!=0;
+            else for(int i=0;i<CHUNK*CHUNK && !any;i++) any=l->dense[i]!=0;
+        }
+
+        c.surf_key=key;
+        c.surf_dirty=false;
+        c.surf_empty=!any;
+        if(!any){
+            if(!c.surf.px.empty()) surf_count--;
+            c.surf=Image{};
+            return;
+        }
 
-        Chunk c{};
-        c.cx=cx; c.cy=cy; c.used=true;
-        c.tiles.assign((size_t)CHUNK*(size_t)CHUNK, 0);
+        int S=CHUNK*p;
+        if(c.surf.px.empty()) surf_count++;
+        c.surf.w=S; c.surf.h=S;
+        c.surf.premul = have_ts && ts.img->premul; // tiles are copied as-is
+        c.surf.px.assign((size_t)S*(size_t)S, 0);
+        c.surf.touch();
 
-        // default gen (simple terrain)
+        Canvas sc{};
+        sc.set(c.surf.px.data(), S,S,S);
+        u32 wt=wall_tint;
         for(int ty=0; ty<CHUNK; ty++){
+            const u16* fr=fg.row_ptr(ty);
+            const u16* br=bg.row_ptr(ty);
             for(int tx=0; tx<CHUNK; tx++){
-                int wx = cx*CHUNK + tx;
-                int wy = cy*CHUNK + ty;
-
-                // wavy surface
-                f32 h = std::sin(wx*0.08f)*4.0f + std::sin(wx*0.02f)*10.0f;
-                int ground = (int)(18.0f + h);
-
-                u16 tile=0;
-                if(wy>ground){
-                    tile=1; // dirt
-                    if(wy>ground+10) tile=2; // stone
-                } else if(wy==ground){
-                    tile=4; // grass
+                u16 t=fr[tx], wv=br[tx];
+                if(wv!=0 && !(def(t).flags & TILE_OPAQUE)){
+                    const TileDef& d=def(wv);
+                    if(have_ts){
+                        blit(sc, tx*p,ty*p, p,p, *ts.img, ts.src_x(d.wall), ts.src_y(d.wall), ts.tile_w,ts.tile_h,
+                             false, bilinear, wt);
+                    } else {
+                        sc.rect_fill(tx*p,ty*p,p,p, mul_color(d.color, wt));
+                    }
+                }
+                if(t==0) continue;
+                const TileDef& d=def(t);
+                if(have_ts){
+                    blit(sc, tx*p,ty*p, p,p, *ts.img, ts.src_x(d.sprite), ts.src_y(d.sprite), ts.tile_w,ts.tile_h,
+                         wv!=0 && !(d.flags & TILE_OPAQUE), bilinear);
+                } else {
+                    sc.rect_fill(tx*p,ty*p,p,p, d.color);
                 }
-                c.tiles[(size_t)ty*(size_t)CHUNK + (size_t)tx]=tile;
             }
         }
-
-        auto res = map.emplace(k, std::move(c));
-        return res.first->second;
     }
 
-    u16 get(int wx,int wy){
-        int cx = (wx>=0)? (wx/CHUNK) : -(((-wx)+CHUNK-1)/CHUNK);
-        int cy = (wy>=0)? (wy/CHUNK) : -(((-wy)+CHUNK-1)/CHUNK);
-        int lx = wx - cx*CHUNK;
-        int ly = wy - cy*CHUNK;
-        Chunk& c = get_chunk(cx,cy);
-        return c.tiles[(size_t)ly*(size_t)CHUNK + (size_t)lx];
+    // Drop surfaces of chunks that were not drawn this frame.
+    void trim_surfaces(){
+        for(auto& kv: map){
+            Chunk& c=*kv.second;
+            if(!c.surf.px.empty() && c.surf_frame!=draw_frame) release_surface(c);
+        }
     }
 
-    void set(int wx,int wy,u16 v){
-        int cx = (wx>=0)? (wx/CHUNK) : -(((-wx)+CHUNK-1)/CHUNK);
-        int cy = (wy>=0)? (wy/CHUNK) : -(((-wy)+CHUNK-1)/CHUNK);
-        int lx = wx - cx*CHUNK;
-        int ly = wy - cy*CHUNK;
-        Chunk& c = get_chunk(cx,cy);
-        c.tiles[(size_t)ly*(size_t)CHUNK + (size_t)lx]=v;
+    void draw(Canvas& dst, const Camera2D& cam){
+        WE_ZONE("World::draw");
+        if(!chunk_cache){ draw_tiles(dst,cam); return; }
+
+        // cull by the (rotated) view bounds
+        f32 left,top,right,bottom;
+        cam.view_bounds(left,top,right,bottom);
+
+        int tsz=tile_px;
+        int cx0=floor_div((int)std::floor(left/(f32)tsz)-2, CHUNK);
+        int cx1=floor_div((int)std::floor(right/(f32)tsz)+2, CHUNK);
+        int cy0=floor_div((int)std::floor(top/(f32)tsz)-2, CHUNK);
+        int cy1=floor_div((int)std::floor(bottom/(f32)tsz)+2, CHUNK);
+
+        bool have_ts = ts.img && ts.cols>0;
+        int p = surf_level((f32)tsz*cam.zoom);
+        u32 key = (u32)p | (have_ts?0x10000u:0u) | ((have_ts&&bilinear)?0x20000u:0u) | ((have_ts&&ts.img->premul)?0x40000u:0u);
+        bool smooth = have_ts && bilinear;
+
+        draw_frame++;
+        f32 csz=(f32)(CHUNK*tsz);
+        ScreenGrid g=cam.grid(csz, cx0, cy0);
+        int S=CHUNK*p;
+
+        for(int cy=cy0; cy<=cy1; cy++){
+            for(int cx=cx0; cx<=cx1; cx++){
+                Chunk* cp=find_chunk(cx,cy);
+                if(!cp) continue; // not generated yet (see stream)
+                Chunk& c=*cp;
+                if(c.empty()){ // sky: nothing built, nothing drawn
+                    if(!c.surf.px.empty()) release_surface(c);
+                    continue;
+                }
+                if(c.surf_dirty || c.surf_key!=key) build_surface(c,p,key);
+                c.surf_frame=draw_frame;
+                if(c.surf_empty) continue;
+
+                // neighbours share edges exactly (floor of both corners): no seams
+                v2 a=g.at(cx-cx0, cy-cy0);
+                v2 b=g.at(cx+1-cx0, cy+1-cy0);
+                int sx0=(int)std::floor(a.x), sy0=(int)std::floor(a.y);
+                int sx1=(int)std::floor(b.x), sy1=(int)std::floor(b.y);
+                blit(dst, sx0,sy0, sx1-sx0, sy1-sy0, c.surf, 0,0,S,S, true, smooth);
+            }
+        }
+
+        if(surf_count>surf_cache_max) trim_surfaces();
     }
 
-    void draw(Canvas& dst, const Camera2D& cam){
-        // cull by viewport (no rotation assumed for culling; still works fine for rot=0 typical)
-        f32 invz = (cam.zoom!=0)? (1.0f/cam.zoom) : 1.0f;
-        f32 left   = cam.pos.x - cam.viewport.x*0.5f*invz;
-        f32 right  = cam.pos.x + cam.viewport.x*0.5f*invz;
-        f32 top    = cam.pos.y - cam.viewport.y*0.5f*invz;
-        f32 bottom = cam.pos.y + cam.viewport.y*0.5f*invz;
+    // Reference path: one blit/rect per visible tile.
+    void draw_tiles(Canvas& dst, const Camera2D& cam){
+        // cull by the (rotated) view bounds
+        f32 left,top,right,bottom;
+        cam.view_bounds(left,top,right,bottom);
 
         int tsz=tile_px;
         int tx0=(int)std::floor(left/(f32)tsz)-2;
@@ -1158,38 +5010,144 @@ struct World {
         int ty0=(int)std::floor(top/(f32)tsz)-2;
         int ty1=(int)std::floor(bottom/(f32)tsz)+2;
 
-        m3 V = cam.view();
+        ScreenGrid g=cam.grid((f32)tsz, tx0, ty0);
+
+        int ds=(int)(tsz*cam.zoom);
+        u32 wt=wall_tint;
 
         for(int ty=ty0; ty<=ty1; ty++){
             for(int tx=tx0; tx<=tx1; tx++){
-                u16 t = get(tx,ty);
-                if(t==0) continue;
+                u16 t = peek(tx,ty);
+                if(t==TILE_UNKNOWN) continue;
+                u16 wv = (def(t).flags & TILE_OPAQUE) ? 0 : peek(tx,ty,LAYER_BG);
+                if(t==0 && wv==0) continue;
 
-                v2 wp = V2((f32)(tx*tsz), (f32)(ty*tsz));
-                v2 sp = m3_mul_v2(V, wp);
+                v2 sp = g.at(tx-tx0, ty-ty0);
 
                 int sx=(int)std::floor(sp.x);
                 int sy=(int)std::floor(sp.y);
 
                 // tileset draw if available
                 if(ts.img && ts.cols>0){
-                    int tw=ts.tile_w, th=ts.tile_h;
-                    int id=(int)t;
-                    int cx=id % ts.cols;
-                    int cy=id / ts.cols;
-                    blit(dst, sx,sy, (int)(tsz*cam.zoom),(int)(tsz*cam.zoom),
-                         *ts.img, cx*tw, cy*th, tw,th,
-                         blend, bilinear);
+                    if(wv){
+                        const TileDef& d=def(wv);
+                        blit(dst, sx,sy, ds,ds, *ts.img, ts.src_x(d.wall), ts.src_y(d.wall), ts.tile_w,ts.tile_h,
+                             blend, bilinear, wt);
+                    }
+                    if(t){
+                        const TileDef& d=def(t);
+                        blit(dst, sx,sy, ds,ds, *ts.img, ts.src_x(d.sprite), ts.src_y(d.sprite), ts.tile_w,ts.tile_h,
+                             blend, bilinear);
+                    }
                 } else {
-                    // debug colors
-                    u32 col=RGBA(92,72,56,255);
-                    if(t==2) col=RGBA(110,110,120,255);
-                    if(t==4) col=RGBA(70,160,80,255);
-                    dst.rect_fill(sx,sy,(int)(tsz*cam.zoom),(int)(tsz*cam.zoom), col);
+                    if(wv) dst.rect_fill(sx,sy,ds,ds, mul_color(debug_color(wv), wt));
+                    if(t) dst.rect_fill(sx,sy,ds,ds, debug_color(t));
+                }
+            }
+        }
+    }
+};
+
+// ============================================================
+// Solid mask (1 bit per tile of a world rect, built from chunk rows)
+// ============================================================
+struct SolidMask {
+    int x0=0, y0=0, w=0, h=0;  // world tile rect
+    int stride=0;              // u64 words per row
+    std::vector<u64> bits;
+
+    // Never generates: unloaded chunks count as solid (World::solid(TILE_UNKNOWN)).
+    void build(const World& world,int bx0,int by0,int bw,int bh){
+        x0=bx0; y0=by0; w=std::max(bw,0); h=std::max(bh,0);
+        stride=(w+63)>>6;
+        size_t words=(size_t)stride*(size_t)h;
+        if(words>bits.capacity()) bits.reserve(std::max({words, bits.capacity()*2, (size_t)4096})); // grow geometrically
+        bits.assign(words, 0);
+        bool unknown=world.solid(TILE_UNKNOWN);
+        for(int y=0;y<h;y++){
+            u64* row=bits.data() + (size_t)y*(size_t)stride;
+            int wy=y0+y;
+            for(int x=0;x<w;){
+                int wx=x0+x;
+                int n=std::min(CHUNK-(wx&(CHUNK-1)), w-x);
+                const Chunk* c=world.find_loaded(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+                const ChunkLayer* l=c ? &c->layers[LAYER_FG] : nullptr;
+                if(!l || l->uniform()){ // whole segment solid or not
+                    if(l ? world.solid(l->fill()) : unknown) set_run(row, x, n);
+                }else{
+                    const u16* src=l->row_ptr(wy&(CHUNK-1)) + (wx&(CHUNK-1));
+                    for(int i=0;i<n;i++)
+                        if(world.solid(src[i])) row[(x+i)>>6] |= (u64)1 << ((x+i)&63);
+                }
+                x+=n;
+            }
+        }
+    }
+
+    static void set_run(u64* row,int x,int n){
+        while(n>0){
+            int b=x&63, k=std::min(64-b, n);
+            row[x>>6] |= (k==64 ? ~(u64)0 : (((u64)1<<k)-1)) << b;
+            x+=k; n-=k;
+        }
+    }
+
+    bool contains(int wx,int wy) const { return wx>=x0 && wy>=y0 && wx<x0+w && wy<y0+h; }
+
+    // Outside the rect counts as solid.
+    bool solid(int wx,int wy) const {
+        if(!contains(wx,wy)) return true;
+        int x=wx-x0, y=wy-y0;
+        return (bits[(size_t)y*(size_t)stride + (size_t)(x>>6)] >> (x&63)) & 1;
+    }
+};
+
+// Light decay per tile of a world rect: the META layer's decay byte, else the FG tile's
+// TileDef::decay. Outside the rect and in unloaded chunks, World::unknown_def.decay.
+struct DecayMap {
+    int x0=0, y0=0, w=0, h=0;  // world tile rect
+    u8 outside=18;
+    std::vector<u8> d;
+
+    // Never generates.
+    void build(const World& world,int bx0,int by0,int bw,int bh){
+        x0=bx0; y0=by0; w=std::max(bw,0); h=std::max(bh,0);
+        outside=world.unknown_def.decay;
+        size_t cells=(size_t)w*(size_t)h;
+        if(cells>d.capacity()) d.reserve(std::max({cells, d.capacity()*2, (size_t)4096})); // grow geometrically
+        d.resize(cells);
+        for(int y=0;y<h;y++){
+            u8* row=d.data() + (size_t)y*(size_t)w;
+            int wy=y0+y;
+            for(int x=0;x<w;){
+                int wx=x0+x;
+                int lx=wx&(CHUNK-1), ly=wy&(CHUNK-1);
+                int n=std::min(CHUNK-lx, w-x);
+                const Chunk* c=world.find_loaded(wx>>CHUNK_SHIFT, wy>>CHUNK_SHIFT);
+                if(!c){ std::memset(row+x, outside, (size_t)n); x+=n; continue; }
+                const ChunkLayer& fg=c->layers[LAYER_FG];
+                const ChunkLayer& me=c->layers[LAYER_META];
+                if(fg.uniform() && me.uniform()){ // solid rock, open sky: one value per segment
+                    u8 m=(u8)(me.fill() & META_DECAY_MASK);
+                    std::memset(row+x, m ? m : world.def(fg.fill()).decay, (size_t)n);
+                }else{
+                    const u16* f=fg.row_ptr(ly) + lx;
+                    const u16* mt=me.row_ptr(ly) + lx;
+                    for(int i=0;i<n;i++){
+                        u8 m=(u8)(mt[i] & META_DECAY_MASK);
+                        row[x+i] = m ? m : world.def(f[i]).decay;
+                    }
                 }
+                x+=n;
             }
         }
     }
+
+    u8 at(int wx,int wy) const {
+        int x=wx-x0, y=wy-y0;
+        if(x<0 || y<0 || x>=w || y>=h) return outside;
+        return d[(size_t)y*(size_t)w + (size_t)x];
+    }
 };
 
 // ============================================================
@@ -1201,19 +5159,252 @@ struct LightSource {
     u8  intensity=255; // 0..255
 };
 
-struct LightMap {
-    int w=0,h=0;          // in tiles (visible region)
-    int ox=0, oy=0;       // world tile origin of [0,0]
-    std::vector<u8> L;    // light 0..255
-    u8 ambient=40;
+// Append a light per emitting tile (TileDef::emit or the META emission byte) of the loaded
+// chunks that can reach the LightMap window (view + 4 tiles); chunks without emitters are
+// skipped whole. Radius emit/12 tiles: the light fades like one crossing open air.
+static inline void gather_tile_lights(const World& world, const Camera2D& cam, std::vector<LightSource>& out){
+    f32 left,top,right,bottom;
+    cam.view_bounds(left,top,right,bottom);
+    int tsz=world.tile_px;
+    int reach=4 + 255/12;
+    int tx0=(int)std::floor(left/(f32)tsz)-reach, tx1=(int)std::floor(right/(f32)tsz)+reach;
+    int ty0=(int)std::floor(top/(f32)tsz)-reach,  ty1=(int)std::floor(bottom/(f32)tsz)+reach;
+    for(int cy=ty0>>CHUNK_SHIFT; cy<=(ty1>>CHUNK_SHIFT); cy++){
+        for(int cx=tx0>>CHUNK_SHIFT; cx<=(tx1>>CHUNK_SHIFT); cx++){
+            const Chunk* c=world.find_loaded(cx,cy);
+            if(!c || !c->emits) continue;
+            const ChunkLayer& fg=c->layers[LAYER_FG];
+            const ChunkLayer& me=c->layers[LAYER_META];
+            int ly0=std::max(ty0-cy*CHUNK,0), ly1=std::min(ty1-cy*CHUNK,CHUNK-1);
+            int lx0=std::max(tx0-cx*CHUNK,0), lx1=std::min(tx1-cx*CHUNK,CHUNK-1);
+            for(int ly=ly0; ly<=ly1; ly++){
+                const u16* f=fg.row_ptr(ly);
+                const u16* m=me.row_ptr(ly);
+                for(int lx=lx0; lx<=lx1; lx++){
+                    u8 e=world.tile_emit(f[lx], m[lx]);
+                    if(!e) continue;
+                    LightSource ls;
+                    ls.pos_px=V2(((f32)(cx*CHUNK+lx)+0.5f)*(f32)tsz, ((f32)(cy*CHUNK+ly)+0.5f)*(f32)tsz);
+                    ls.radius_tiles=std::max(1, (int)e/12);
+                    ls.intensity=e;
+                    out.push_back(ls);
+                }
+            }
+        }
+    }
+}
+
+struct LightMap {
+    int w=0,h=0;          // in tiles (visible region)
+    int ox=0, oy=0;       // world tile origin of [0,0]
+    std::vector<u8> L;    // light 0..255
+    u8 ambient=40;
+
+    // Incremental state: L persists between builds and only cells inside dirty rects
+    // (moved/added/removed lights, World edits, newly scrolled-in strips) are relit.
+    // Each light floods only its box (radius_tiles around its tile), so
+    // L = max(ambient, floods of the lights whose box covers the cell).
+    bool valid=false;
+    u8 built_ambient=0;
+    u64 edit_seq=0;                 // World::edit_seq consumed so far
+    std::vector<LightSource> prev;  // lights of the last build
+    std::vector<RectI> dirty;       // world tile rects to relight
+    int max_dirty=64;               // more rects than this: relight the whole window
+    int relit_lights=0;             // stats of the last build
+    int relit_cells=0;
+
+    DecayMap decays;                // scratch: window + max flood radius, rebuilt per relight
+    std::vector<u8> mask;           // scratch: window cells inside a dirty rect
+    std::vector<u8> Lswap;
+    std::vector<int> hits;          // scratch: lights to reflood
+
+    struct FloodScratch {
+        std::vector<u8> F;              // one light's flood over its box
+        std::vector<u32> bucket[256];   // Dial's queue: box cell indices by light value
+    };
+    FloodScratch scratch;           // serial path
+
+    // Parallel path: reflooded lights grouped by cluster_tiles cells; each cluster floods
+    // into its own buffer on a worker, then rows are max-reduced into L. Same output as serial.
+    bool parallel=true;
+    int min_parallel_lights=8;      // fewer lights to reflood: stay serial
+    int cluster_tiles=16;
+    struct Cluster {
+        RectI rect;                     // union of member boxes, clipped to the window
+        std::vector<int> lights;
+        std::vector<u8> buf;            // rect-sized max of member floods
+        FloodScratch fs;
+    };
+    std::vector<Cluster> clusters;
+    int cluster_count=0;
+    std::vector<std::pair<long long,int>> cluster_keys;
+
+    void invalidate(){ valid=false; }
+
+    static void light_tile(const LightSource& ls,int tsz,int& tx,int& ty){
+        tx=(int)std::floor(ls.pos_px.x/(f32)tsz);
+        ty=(int)std::floor(ls.pos_px.y/(f32)tsz);
+    }
+    static RectI light_box(const LightSource& ls,int tsz){
+        int tx,ty; light_tile(ls,tsz,tx,ty);
+        int r=std::max(ls.radius_tiles,0);
+        return RectI{tx-r, ty-r, tx+r, ty+r};
+    }
+    static bool overlaps(RectI a,RectI b){
+        return a.x0<=b.x1 && b.x0<=a.x1 && a.y0<=b.y1 && b.y0<=a.y1;
+    }
+
+    // Flood one light over its box into F, brightest first (Dial's queue: one bucket
+    // per light value), so each cell expands once, at its final value. Values at or below
+    // ambient are not expanded (they lose to ambient anyway). Each step loses the tile's
+    // decay (DecayMap), at least ceil(intensity/(radius+1)) so the light dies out within
+    // radius_tiles steps.
+    void flood(const DecayMap& decay_map,const LightSource& ls,RectI box,FloodScratch& fs) const {
+        std::vector<u8>& F=fs.F;
+        auto& bucket=fs.bucket;
+        int bw=box.x1-box.x0+1, bh=box.y1-box.y0+1;
+        F.assign((size_t)bw*(size_t)bh, 0);
+
+        int r=std::max(ls.radius_tiles,0);
+        int floor_decay=((int)ls.intensity + r)/(r+1);
+        int lo=std::max((int)ambient, 1);
+
+        u32 c=(u32)(r*bw + r);
+        F[c]=ls.intensity;
+        bucket[ls.intensity].push_back(c);
+
+        for(int v=ls.intensity; v>=0; v--){
+            std::vector<u32>& b=bucket[v];
+            if(v>lo){
+                for(size_t i=0;i<b.size();i++){
+                    u32 idx=b[i];
+                    if(F[idx]!=v) continue; // raised after queueing
+                    int x=(int)(idx%(u32)bw), y=(int)(idx/(u32)bw);
+
+                    int decay = std::max((int)decay_map.at(box.x0+x, box.y0+y), floor_decay);
+                    if(v<=decay) continue;
+                    u8 nv=(u8)(v-decay);
+
+                    if(x+1<bw && nv>F[idx+1])  { F[idx+1]=nv;  bucket[nv].push_back(idx+1); }
+                    if(x>0    && nv>F[idx-1])  { F[idx-1]=nv;  bucket[nv].push_back(idx-1); }
+                    if(y+1<bh && nv>F[idx+bw]) { F[idx+bw]=nv; bucket[nv].push_back(idx+(u32)bw); }
+                    if(y>0    && nv>F[idx-bw]) { F[idx-bw]=nv; bucket[nv].push_back(idx-(u32)bw); }
+                }
+            }
+            b.clear();
+        }
+    }
+
+    // dst (covering dst_rect, row-major) = max(dst, F) over box ∩ clip; only where mask is set, if given.
+    static void max_into(const std::vector<u8>& F,RectI box,u8* dst,RectI dst_rect,RectI clip,const u8* mask){
+        RectI c;
+        if(!rect_intersect(box, clip, c)) return;
+        int bw=box.x1-box.x0+1, dw=dst_rect.x1-dst_rect.x0+1;
+        for(int y=c.y0;y<=c.y1;y++){
+            const u8* f=&F[(size_t)(y-box.y0)*(size_t)bw + (size_t)(c.x0-box.x0)];
+            size_t row=(size_t)(y-dst_rect.y0)*(size_t)dw + (size_t)(c.x0-dst_rect.x0);
+            u8* d=dst+row;
+            const u8* m=mask? mask+row : nullptr;
+            for(int x=0;x<=c.x1-c.x0;x++)
+                if((!m || m[x]) && f[x]>d[x]) d[x]=f[x];
+        }
+    }
+
+    void reflood_serial(const std::vector<LightSource>& lights,int tsz,RectI win){
+        for(int li: hits){
+            const LightSource& ls=lights[(size_t)li];
+            RectI box=light_box(ls,tsz);
+            flood(decays, ls, box, scratch);
+            max_into(scratch.F, box, L.data(), win, win, mask.data());
+        }
+    }
+
+    void reflood_parallel(const std::vector<LightSource>& lights,int tsz,RectI win,JobSystem& jobs){
+        // group by cluster cell of the light tile (sorted: deterministic membership)
+        cluster_keys.clear();
+        for(int li: hits){
+            int tx,ty; light_tile(lights[(size_t)li],tsz,tx,ty);
+            cluster_keys.push_back({chunk_key(floor_div(tx,cluster_tiles), floor_div(ty,cluster_tiles)), li});
+        }
+        std::sort(cluster_keys.begin(), cluster_keys.end());
+
+        cluster_count=0;
+        for(size_t i=0;i<cluster_keys.size();i++){
+            if(i==0 || cluster_keys[i].first!=cluster_keys[i-1].first){
+                if((size_t)cluster_count==clusters.size()) clusters.emplace_back();
+                Cluster& c=clusters[(size_t)cluster_count++];
+                c.lights.clear();
+                c.rect=RectI{win.x1, win.y1, win.x0, win.y0};
+            }
+            Cluster& c=clusters[(size_t)cluster_count-1];
+            int li=cluster_keys[i].second;
+            RectI b;
+            if(!rect_intersect(light_box(lights[(size_t)li],tsz), win, b)) continue;
+            c.lights.push_back(li);
+            c.rect.x0=std::min(c.rect.x0,b.x0); c.rect.y0=std::min(c.rect.y0,b.y0);
+            c.rect.x1=std::max(c.rect.x1,b.x1); c.rect.y1=std::max(c.rect.y1,b.y1);
+        }
+
+        jobs.parallel_for(cluster_count, [&](int ci){
+            Cluster& c=clusters[(size_t)ci];
+            if(c.lights.empty()) return;
+            c.buf.assign((size_t)(c.rect.x1-c.rect.x0+1)*(size_t)(c.rect.y1-c.rect.y0+1), 0);
+            for(int li: c.lights){
+                const LightSource& ls=lights[(size_t)li];
+                RectI box=light_box(ls,tsz);
+                flood(decays, ls, box, c.fs);
+                max_into(c.fs.F, box, c.buf.data(), c.rect, c.rect, nullptr);
+            }
+        });
+
+        jobs.parallel_for(h, [&](int y){
+            int wy=oy+y;
+            u8* row=&L[(size_t)y*(size_t)w];
+            const u8* m=&mask[(size_t)y*(size_t)w];
+            for(int ci=0;ci<cluster_count;ci++){
+                const Cluster& c=clusters[(size_t)ci];
+                if(c.lights.empty() || wy<c.rect.y0 || wy>c.rect.y1) continue;
+                const u8* src=&c.buf[(size_t)(wy-c.rect.y0)*(size_t)(c.rect.x1-c.rect.x0+1)];
+                for(int x=c.rect.x0;x<=c.rect.x1;x++){
+                    size_t i=(size_t)(x-ox);
+                    u8 v=src[x-c.rect.x0];
+                    if(m[i] && v>row[i]) row[i]=v;
+                }
+            }
+        });
+    }
+
+    // Move the window to [tx0,tx1]x[ty0,ty1], keeping the overlap and queueing exposed strips.
+    void scroll(int tx0,int ty0,int tx1,int ty1){
+        int nw=tx1-tx0+1, nh=ty1-ty0+1;
+        RectI win{tx0,ty0,tx1,ty1};
+        RectI old{ox,oy,ox+w-1,oy+h-1}, o;
+        bool keep = valid && w>0 && h>0 && rect_intersect(old, win, o);
+
+        if(keep && nw==w && nh==h && tx0==ox && ty0==oy) return;
+
+        Lswap.assign((size_t)nw*(size_t)nh, ambient);
+        if(keep){
+            for(int y=o.y0;y<=o.y1;y++)
+                std::memcpy(&Lswap[(size_t)(y-ty0)*(size_t)nw + (size_t)(o.x0-tx0)],
+                            &L[(size_t)(y-oy)*(size_t)w + (size_t)(o.x0-ox)], (size_t)(o.x1-o.x0+1));
+            if(o.y0>win.y0) dirty.push_back(RectI{win.x0, win.y0, win.x1, o.y0-1});
+            if(o.y1<win.y1) dirty.push_back(RectI{win.x0, o.y1+1, win.x1, win.y1});
+            if(o.x0>win.x0) dirty.push_back(RectI{win.x0, o.y0, o.x0-1, o.y1});
+            if(o.x1<win.x1) dirty.push_back(RectI{o.x1+1, o.y0, win.x1, o.y1});
+        }else{
+            valid=false;
+        }
+        L.swap(Lswap);
+        ox=tx0; oy=ty0; w=nw; h=nh;
+    }
 
-    void build(World& world, const Camera2D& cam, const std::vector<LightSource>& lights) {
-        // visible tile bounds
-        f32 invz = (cam.zoom!=0)? (1.0f/cam.zoom) : 1.0f;
-        f32 left   = cam.pos.x - cam.viewport.x*0.5f*invz;
-        f32 right  = cam.pos.x + cam.viewport.x*0.5f*invz;
-        f32 top    = cam.pos.y - cam.viewport.y*0.5f*invz;
-        f32 bottom = cam.pos.y + cam.viewport.y*0.5f*invz;
+    // jobs: enables the parallel cluster path (see parallel / min_parallel_lights).
+    void build(World& world, const Camera2D& cam, const std::vector<LightSource>& lights, JobSystem* jobs=nullptr) {
+        WE_ZONE("LightMap::build");
+        // visible tile bounds (rotated view)
+        f32 left,top,right,bottom;
+        cam.view_bounds(left,top,right,bottom);
 
         int tsz=world.tile_px;
         int tx0=(int)std::floor(left/(f32)tsz)-4;
@@ -1221,52 +5412,94 @@ struct LightMap {
         int ty0=(int)std::floor(top/(f32)tsz)-4;
         int ty1=(int)std::floor(bottom/(f32)tsz)+4;
 
-        ox=tx0; oy=ty0;
-        w = (tx1-tx0+1);
-        h = (ty1-ty0+1);
-        if(w<=0||h<=0){ w=h=0; L.clear(); return; }
-
-        L.assign((size_t)w*(size_t)h, ambient);
-
-        struct Node{ int x,y; u8 v; };
-        std::vector<Node> q;
-        q.reserve(4096);
-
-        auto push=[&](int x,int y,u8 v){
-            if(x<0||y<0||x>=w||y>=h) return;
-            size_t idx=(size_t)y*(size_t)w+(size_t)x;
-            if(v<=L[idx]) return;
-            L[idx]=v;
-            q.push_back({x,y,v});
-        };
-
-        // seed from lights
-        for(const auto& ls: lights){
-            int tx=(int)std::floor(ls.pos_px.x/(f32)tsz);
-            int ty=(int)std::floor(ls.pos_px.y/(f32)tsz);
-            int lx=tx-ox, ly=ty-oy;
-            push(lx,ly,ls.intensity);
+        relit_lights=relit_cells=0;
+        if(tx1<tx0||ty1<ty0){ w=h=0; L.clear(); valid=false; return; }
+
+        dirty.clear();
+        scroll(tx0,ty0,tx1,ty1);
+        RectI win{ox,oy,ox+w-1,oy+h-1};
+
+        if(ambient!=built_ambient || world.edit_seq-edit_seq > (u64)World::EDIT_LOG) valid=false;
+
+        if(valid){
+            // lights that moved, changed, appeared or vanished: old and new boxes
+            size_t n=std::max(prev.size(), lights.size());
+            for(size_t i=0;i<n;i++){
+                const LightSource* a = i<prev.size()   ? &prev[i]   : nullptr;
+                const LightSource* b = i<lights.size() ? &lights[i] : nullptr;
+                if(a && b){
+                    int ax,ay,bx,by;
+                    light_tile(*a,tsz,ax,ay); light_tile(*b,tsz,bx,by);
+                    if(ax==bx && ay==by && a->intensity==b->intensity && a->radius_tiles==b->radius_tiles) continue;
+                }
+                if(a) dirty.push_back(light_box(*a,tsz));
+                if(b) dirty.push_back(light_box(*b,tsz));
+            }
+            // world edits: every light whose flood could cross the edited tiles
+            for(u64 s=edit_seq; s<world.edit_seq; s++){
+                RectI e=world.edit_log[(size_t)(s%(u64)World::EDIT_LOG)];
+                for(const auto& ls: lights){
+                    RectI b=light_box(ls,tsz);
+                    if(overlaps(b,e)) dirty.push_back(b);
+                }
+                if(dirty.size()>(size_t)max_dirty) break;
+            }
+        }
+        edit_seq=world.edit_seq;
+        built_ambient=ambient;
+        prev=lights;
+
+        if(!valid || dirty.size()>(size_t)max_dirty){
+            dirty.clear();
+            dirty.push_back(win);
+            valid=true;
         }
 
-        // BFS propagation
-        for(size_t qi=0; qi<q.size(); qi++){
-            Node n=q[qi];
-            if(n.v<=1) continue;
+        // clip to the window, reset covered cells to ambient
+        mask.resize((size_t)w*(size_t)h, 0);
+        size_t kept=0;
+        for(RectI d: dirty){
+            RectI c;
+            if(!rect_intersect(d, win, c)) continue;
+            dirty[kept++]=c;
+            for(int y=c.y0;y<=c.y1;y++){
+                size_t row=(size_t)(y-oy)*(size_t)w;
+                for(int x=c.x0;x<=c.x1;x++){
+                    size_t i=row+(size_t)(x-ox);
+                    relit_cells+= mask[i]^1;
+                    mask[i]=1;
+                    L[i]=ambient;
+                }
+            }
+        }
+        dirty.resize(kept);
+        if(dirty.empty()) return;
+
+        // lights whose box touches a dirty rect (dirty rects lie inside the window)
+        hits.clear();
+        int margin=0;
+        for(size_t i=0;i<lights.size();i++){
+            RectI box=light_box(lights[i],tsz);
+            for(RectI d: dirty) if(overlaps(box,d)){
+                hits.push_back((int)i);
+                margin=std::max(margin, lights[i].radius_tiles);
+                break;
+            }
+        }
 
-            // block light slightly by solid tiles
-            int wx = ox+n.x;
-            int wy = oy+n.y;
-            bool block = world.solid(world.get(wx,wy));
-            u8 decay = block ? 18 : 12; // solids eat more light
+        // one decay map covering all of their boxes
+        if(!hits.empty()) decays.build(world, win.x0-margin, win.y0-margin, w+2*margin, h+2*margin);
 
-            auto step=[&](int dx,int dy){
-                int nx=n.x+dx, ny=n.y+dy;
-                u8 nv = (n.v>decay)? (u8)(n.v - decay) : 0;
-                push(nx,ny,nv);
-            };
+        // reflood them, max into masked cells
+        relit_lights=(int)hits.size();
+        if(jobs && parallel && jobs->size()>1 && relit_lights>=min_parallel_lights)
+            reflood_parallel(lights, tsz, win, *jobs);
+        else
+            reflood_serial(lights, tsz, win);
 
-            step(1,0); step(-1,0); step(0,1); step(0,-1);
-        }
+        for(RectI d: dirty)
+            for(int y=d.y0;y<=d.y1;y++)
+                std::memset(&mask[(size_t)(y-oy)*(size_t)w + (size_t)(d.x0-ox)], 0, (size_t)(d.x1-d.x0+1));
     }
 
     u8 sample_tile(int world_tx,int world_ty) const {
@@ -1276,35 +5509,35 @@ struct LightMap {
         return L[(size_t)y*(size_t)w+(size_t)x];
     }
 
+    // Darken everything drawn so far (tiles + sprites + particles) in one pass: per-cell
+    // multipliers are upsampled bilinearly per pixel, so light falls off smoothly at any zoom.
+    // The multipliers and grid live in frame_arena(): a TiledRasterizer replays them in end().
+
     void draw_darkness_overlay(Canvas& dst, const World& world, const Camera2D& cam){
-        // Draw per-tile black overlay so EVERYTHING (tiles + sprites + particles) gets darkened.
+        WE_ZONE("LightMap::draw_darkness_overlay");
         if(w<=0||h<=0) return;
 
-        int tsz=world.tile_px;
-        m3 V=cam.view();
-
-        for(int y=0;y<h;y++){
-            for(int x=0;x<w;x++){
-                u8 lv = L[(size_t)y*(size_t)w+(size_t)x];
-                // alpha based on missing light
-                int missing = 255 - (int)lv;
-                int a = clampi((missing*220)/255, 0, 220);
-                if(a<=0) continue;
-
-                int wx = ox + x;
-                int wy = oy + y;
-
-                v2 wp = V2((f32)(wx*tsz), (f32)(wy*tsz));
-                v2 sp = m3_mul_v2(V, wp);
-
-                int sx=(int)std::floor(sp.x);
-                int sy=(int)std::floor(sp.y);
-                int sw=(int)(tsz*cam.zoom);
-                int sh=(int)(tsz*cam.zoom);
-
-                dst.rect_fill(sx,sy,sw,sh, RGBA(0,0,0,(u32)a));
-            }
+        Arena& fa=frame_arena();
+        size_t cells=(size_t)w*(size_t)h;
+        u8* M=fa.alloc_array<u8>(cells);    // overlay multiplier per cell: 255 - darkness alpha
+        for(size_t i=0;i<cells;i++){
+            int missing = 255 - (int)L[i];
+            M[i] = (u8)(255 - clampi((missing*220)/255, 0, 220)); // alpha based on missing light
         }
+
+        // screen pixel center -> world -> grid (cell centers at integers)
+        m3 IV=cam.inv_view();
+        double s=65536.0/(double)world.tile_px;
+        double cx=IV.m[0][0]*0.5 + IV.m[0][1]*0.5 + IV.m[0][2];
+        double cy=IV.m[1][0]*0.5 + IV.m[1][1]*0.5 + IV.m[1][2];
+        ShadeGrid& shade=*new(fa.alloc(sizeof(ShadeGrid), alignof(ShadeGrid))) ShadeGrid{};
+        shade.m=M; shade.w=w; shade.h=h;
+        shade.u0=(i32)std::lround(cx*s - ((double)ox+0.5)*65536.0);
+        shade.v0=(i32)std::lround(cy*s - ((double)oy+0.5)*65536.0);
+        shade.dudx=(i32)std::lround(IV.m[0][0]*s); shade.dudy=(i32)std::lround(IV.m[0][1]*s);
+        shade.dvdx=(i32)std::lround(IV.m[1][0]*s); shade.dvdy=(i32)std::lround(IV.m[1][1]*s);
+
+        dst.shade(shade);
     }
 };
 
@@ -1329,28 +5562,95 @@ struct Particle {
     u32 c1=RGBA(255,255,255,0);
 };
 
+enum class ParticleOverflow : u8 {
+    Drop,           // ignore emits once full
+    ReplaceOldest,  // recycle the oldest live particles
+    Grow            // double the capacity
+};
+
+// Structure-of-arrays particles, ordered by age (index 0 = oldest): emits append,
+// update compacts stably. Arrays are sized to cap; [0,n) are live.
 struct Particles {
-    std::vector<Particle> p;
+    std::vector<f32> px, py, vx, vy, life, ttl, size;
+    std::vector<u32> c0, c1;
+    size_t n=0, cap=0;
+    ParticleOverflow overflow=ParticleOverflow::Drop;
+    f32 gravity=520.0f;
+    f32 drag=2.0f;          // velocity *= exp(-drag*dt)
     RNG rng{};
 
-    void init(int cap,u32 seed){
-        p.reserve((size_t)cap);
+    // Tile collision (update with a World): particles bounce off solid tiles of a SolidMask
+    // built around them each update. Particles outside the mask, or already inside a
+    // solid tile (e.g. emitted by a placed block), fly free.
+    bool collide=false;
+    f32 bounce=0.35f;        // velocity kept (reversed) on impact
+    f32 friction=0.7f;       // tangential velocity kept on floor/ceiling hits
+    int mask_max_tiles=1024; // cap of the mask side, centered on the particles
+    SolidMask solids;
+
+    // Parallel update: ranges of chunk particles on the worker pool. Every particle is
+    // independent (no RNG in update), so results match the serial path bit for bit.
+    int chunk=8192;
+    std::vector<u8> chunk_dead;
+
+    template<class F> void each_array(F&& f){
+        f(px); f(py); f(vx); f(vy); f(life); f(ttl); f(size); f(c0); f(c1);
+    }
+
+    void init(int cap_,u32 seed,ParticleOverflow policy=ParticleOverflow::Drop){
+        reserve((size_t)std::max(cap_,0));
+        overflow=policy;
         rng_seed(rng,seed);
     }
 
-    void emit_burst(v2 at,int count,f32 sp0,f32 sp1,f32 life0,f32 life1,f32 sz0,f32 sz1,u32 c0,u32 c1){
-        for(int i=0;i<count;i++){
-            if(p.size() > p.capacity()-1) break;
+    void reserve(size_t c){
+        if(c<=cap) return;
+        cap=c;
+        each_array([&](auto& v){ v.resize(cap); });
+    }
+
+    size_t count() const { return n; }
+    void clear(){ n=0; }
+
+    Particle get(size_t i) const {
+        Particle q;
+        q.p=V2(px[i],py[i]); q.v=V2(vx[i],vy[i]);
+        q.life=life[i]; q.ttl=ttl[i]; q.size=size[i];
+        q.c0=c0[i]; q.c1=c1[i];
+        return q;
+    }
+
+    // Remove the k oldest particles.
+    void drop_oldest(size_t k){
+        k=std::min(k,n);
+        if(k==0) return;
+        each_array([&](auto& v){ std::memmove(v.data(), v.data()+k, (n-k)*sizeof(v[0])); });
+        n-=k;
+    }
+
+    void emit_burst(v2 at,int count,f32 sp0,f32 sp1,f32 life0,f32 life1,f32 sz0,f32 sz1,u32 c0_,u32 c1_){
+        if(count<=0) return;
+        size_t want=(size_t)count;
+        if(n+want>cap){
+            switch(overflow){
+                case ParticleOverflow::Drop:          want=cap-n; break;
+                case ParticleOverflow::Grow:          reserve(std::max(cap*2, n+want)); break;
+                case ParticleOverflow::ReplaceOldest:
+                    want=std::min(want,cap);
+                    drop_oldest(n+want-cap);
+                    break;
+            }
+        }
+        for(size_t i=0;i<want;i++){
             f32 ang = rng_fr(rng,0,6.2831853f);
             f32 sp  = rng_fr(rng,sp0,sp1);
-            Particle q{};
-            q.p=at;
-            q.v=V2(std::cos(ang)*sp, std::sin(ang)*sp);
-            q.ttl=rng_fr(rng,life0,life1);
-            q.life=q.ttl;
-            q.size=rng_fr(rng,sz0,sz1);
-            q.c0=c0; q.c1=c1;
-            p.push_back(q);
+            size_t j=n++;
+            px[j]=at.x; py[j]=at.y;
+            vx[j]=std::cos(ang)*sp; vy[j]=std::sin(ang)*sp;
+            ttl[j]=rng_fr(rng,life0,life1);
+            life[j]=ttl[j];
+            size[j]=rng_fr(rng,sz0,sz1);
+            c0[j]=c0_; c1[j]=c1_;
         }
     }
 
@@ -1363,145 +5663,346 @@ struct Particles {
         return RGBA(rr,gg,bb,aa);
     }
 
-    void update(f32 dt){
+    // Integrate [i0,i1); returns true if any particle died.
+    bool integrate(size_t i0,size_t i1,f32 dt,f32 g,f32 damp){
+        bool dead=false;
+        size_t i=i0;
+#if WE_SIMD_X86
+        const __m128 vdt=_mm_set1_ps(dt), vg=_mm_set1_ps(g), vd=_mm_set1_ps(damp), z=_mm_setzero_ps();
+        int dm=0;
+        for(; i+4<=i1; i+=4){
+            __m128 l=_mm_sub_ps(_mm_loadu_ps(&life[i]), vdt);
+            _mm_storeu_ps(&life[i], l);
+            dm|=_mm_movemask_ps(_mm_cmple_ps(l,z));
+            __m128 x=_mm_mul_ps(_mm_loadu_ps(&vx[i]), vd);
+            __m128 y=_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&vy[i]), vg), vd);
+            _mm_storeu_ps(&vx[i], x);
+            _mm_storeu_ps(&vy[i], y);
+            _mm_storeu_ps(&px[i], _mm_add_ps(_mm_loadu_ps(&px[i]), _mm_mul_ps(x,vdt)));
+            _mm_storeu_ps(&py[i], _mm_add_ps(_mm_loadu_ps(&py[i]), _mm_mul_ps(y,vdt)));
+        }
+        dead=dm!=0;
+#endif
+        for(; i<i1; i++){
+            life[i]-=dt;
+            dead|=life[i]<=0;
+            vy[i]+=g;
+            vx[i]*=damp;
+            vy[i]*=damp;
+            px[i]+=vx[i]*dt;
+            py[i]+=vy[i]*dt;
+        }
+        return dead;
+    }
+
+    // Drop dead particles, keeping age order.
+    void compact(){
         size_t w=0;
-        for(size_t i=0;i<p.size();i++){
-            Particle q=p[i];
-            q.life -= dt;
-            if(q.life<=0) continue;
-            q.v.y += 520.0f*dt;
-            q.v.x *= std::exp(-2.0f*dt);
-            q.v.y *= std::exp(-2.0f*dt);
-            q.p = add(q.p, mul(q.v,dt));
-            p[w++]=q;
+        for(size_t i=0;i<n;i++){
+            if(life[i]<=0) continue;
+            if(w!=i){
+                px[w]=px[i]; py[w]=py[i]; vx[w]=vx[i]; vy[w]=vy[i];
+                life[w]=life[i]; ttl[w]=ttl[i]; size[w]=size[i];
+                c0[w]=c0[i]; c1[w]=c1[i];
+            }
+            w++;
+        }
+        n=w;
+    }
+
+    // Integrate [i0,i1) against solids (tile size tsz); returns true if any particle died.
+    bool integrate_collide(size_t i0,size_t i1,f32 dt,f32 g,f32 damp,f32 tsz){
+        const SolidMask& m=solids;
+        f32 inv=1.0f/tsz;
+        auto hit=[&](f32 x,f32 y){
+            int tx=(int)std::floor(x*inv), ty=(int)std::floor(y*inv);
+            return m.contains(tx,ty) && m.solid(tx,ty);
+        };
+        bool dead=false;
+        for(size_t i=i0;i<i1;i++){
+            life[i]-=dt;
+            dead|=life[i]<=0;
+            f32 x=px[i], y=py[i];
+            f32 ux=vx[i]*damp, uy=(vy[i]+g)*damp;
+            f32 nx=x+ux*dt, ny=y+uy*dt;
+            if(!hit(x,y)){
+                if(hit(nx,y)){ ux=-ux*bounce; nx=x; }
+                if(hit(nx,ny)){ uy=-uy*bounce; ux*=friction; ny=y; }
+            }
+            vx[i]=ux; vy[i]=uy; px[i]=nx; py[i]=ny;
+        }
+        return dead;
+    }
+
+    // Solid mask over the particle bounds (plus this step's travel), capped at mask_max_tiles.
+    void build_solids(const World& world,f32 dt){
+        f32 x0=px[0], x1=px[0], y0=py[0], y1=py[0], vmax=0;
+        for(size_t i=0;i<n;i++){
+            x0=std::min(x0,px[i]); x1=std::max(x1,px[i]);
+            y0=std::min(y0,py[i]); y1=std::max(y1,py[i]);
+            vmax=std::max(vmax, std::abs(vx[i])+std::abs(vy[i]));
+        }
+        f32 tsz=(f32)world.tile_px, pad=(vmax+std::abs(gravity)*dt)*dt + tsz;
+        int tx0=(int)std::floor((x0-pad)/tsz), tx1=(int)std::floor((x1+pad)/tsz);
+        int ty0=(int)std::floor((y0-pad)/tsz), ty1=(int)std::floor((y1+pad)/tsz);
+        int span=std::max(mask_max_tiles,1);
+        if(tx1-tx0+1>span){ int c=(tx0+tx1)/2; tx0=c-span/2; tx1=tx0+span-1; }
+        if(ty1-ty0+1>span){ int c=(ty0+ty1)/2; ty0=c-span/2; ty1=ty0+span-1; }
+        solids.build(world, tx0, ty0, tx1-tx0+1, ty1-ty0+1);
+    }
+
+    // world: collide with its solid tiles (if collide is set). jobs: split into chunks.
+    void update(f32 dt, const World* world=nullptr, JobSystem* jobs=nullptr){
+        WE_ZONE("Particles::update");
+        if(n==0) return;
+        f32 damp=std::exp(-drag*dt), g=gravity*dt; // hoisted: same for every particle
+        bool col = collide && world;
+        if(col) build_solids(*world, dt);
+        f32 tsz = world ? (f32)world->tile_px : 1.0f;
+
+        auto run=[&](size_t i0,size_t i1){
+            return col ? integrate_collide(i0,i1,dt,g,damp,tsz) : integrate(i0,i1,dt,g,damp);
+        };
+
+        size_t cs=(size_t)std::max(chunk,64);
+        int chunks=(int)((n+cs-1)/cs);
+        bool dead=false;
+        if(jobs && jobs->size()>1 && chunks>1){
+            chunk_dead.assign((size_t)chunks, 0);
+            jobs->parallel_for(chunks, [&](int c){
+                size_t i0=(size_t)c*cs;
+                chunk_dead[(size_t)c]=run(i0, std::min(n, i0+cs)) ? 1 : 0;
+            });
+            for(u8 d: chunk_dead) dead|=d!=0;
+        }else{
+            dead=run(0,n);
         }
-        p.resize(w);
+        if(dead) compact();
     }
 
     void draw(Canvas& c, const Camera2D& cam){
-        for(const auto& q: p){
-            f32 t = 1.0f - (q.life/q.ttl);
-            u32 col=color_lerp(q.c0,q.c1,ease_in_out_cubic(t));
-            int r=(int)std::max(1.0f, lerp(q.size, 0.0f, t));
-            v2 sp = cam.world_to_screen(q.p);
-            c.circle_fill((int)sp.x,(int)sp.y,r,col);
+        WE_ZONE("Particles::draw");
+        // recorded DrawCmds point at the batch until replay: frame arena; immediate: scratch
+        ScratchScope scope;
+        Span<Disc> discs=arena_span<Disc>(c.rec ? frame_arena() : scope.a, n);
+        Span<v2> sp=arena_span<v2>(scope.a, n);
+        cam.world_to_screen(px.data(), py.data(), sp.begin(), n);
+        for(size_t i=0;i<n;i++){
+            f32 t = 1.0f - (life[i]/ttl[i]);
+            Disc& d=discs[i];
+            d.col=color_lerp(c0[i],c1[i],ease_in_out_cubic(t));
+            d.r=(int)std::max(1.0f, lerp(size[i], 0.0f, t));
+            d.x=(int)sp[i].x;
+            d.y=(int)sp[i].y;
         }
+        // batches of consecutive (same-burst, so nearby) particles keep tile bins tight
+        for(size_t i=0;i<n;i+=256) c.discs(&discs[i], (int)std::min<size_t>(256, n-i));
     }
 };
 
 // ============================================================
 // ECS (simple but real): Registry + components + systems
 // ============================================================
-using Entity = u32; // packed: [gen:16][idx:16] (enough for small games)
-
-static inline u16 ent_idx(Entity e){ return (u16)(e & 0xFFFFu); }
-static inline u16 ent_gen(Entity e){ return (u16)(e >> 16); }
-static inline Entity make_ent(u16 idx,u16 gen){ return (Entity)(((u32)gen<<16) | (u32)idx); }
+// Handle: [gen][idx]. Default u32 with WE_ENT_IDX_BITS index bits; the rest is generation.
+// Index bits cap live entities, generation bits how often a slot can be reused before a
+// stale handle matches again:
+//   16 (default): 65535 entities, 65535 generations per slot
+//   20 (opt-in):  ~1M entities, only 4095 generations per slot
+// Define WE_ENTITY_64 for a u64 [gen:32][idx:32] handle when you need both.
+#if defined(WE_ENTITY_64)
+using Entity = u64;
+static constexpr int ENT_IDX_BITS = 32;
+#else
+#ifndef WE_ENT_IDX_BITS
+#define WE_ENT_IDX_BITS 16
+#endif
+using Entity = u32;
+static constexpr int ENT_IDX_BITS = WE_ENT_IDX_BITS;
+#endif
+static constexpr int ENT_GEN_BITS = (int)sizeof(Entity)*8 - ENT_IDX_BITS;
+static_assert(ENT_IDX_BITS>=8 && ENT_IDX_BITS<=32 && ENT_GEN_BITS>=4 && ENT_GEN_BITS<=32, "bad entity bit split");
+static constexpr u32 ENT_IDX_MASK = (u32)(((u64)1<<ENT_IDX_BITS)-1);
+static constexpr u32 ENT_GEN_MASK = (u32)(((u64)1<<ENT_GEN_BITS)-1);
+
+static inline u32 ent_idx(Entity e){ return (u32)(e & ENT_IDX_MASK); }
+static inline u32 ent_gen(Entity e){ return (u32)(e >> ENT_IDX_BITS) & ENT_GEN_MASK; }
+static inline Entity make_ent(u32 idx,u32 gen){ return ((Entity)gen<<ENT_IDX_BITS) | (Entity)idx; }
+
+// type-erased pool, so Registry::destroy can strip every component
+struct PoolBase {
+    virtual ~PoolBase()=default;
+    virtual void remove_idx(u32 idx)=0;
+};
 
 struct Registry {
-    std::vector<u16> gen;        // generation per slot
-    std::vector<u16> free_list;  // free indices
+    std::vector<u32> gen;        // generation per slot (never 0, so Entity 0 is never alive)
+    std::vector<u32> free_list;  // free indices
+    std::vector<PoolBase*> pools; // cleared on destroy (see attach)
 
     Entity create(){
-        u16 idx;
+        u32 idx;
         if(!free_list.empty()){
             idx = free_list.back(); free_list.pop_back();
         }else{
-            idx = (u16)gen.size();
+            WE_ASSERT(gen.size()<=ENT_IDX_MASK); // out of index bits
+            idx = (u32)gen.size();
             gen.push_back(1);
         }
         return make_ent(idx, gen[idx]);
     }
     bool alive(Entity e) const {
-        u16 idx=ent_idx(e);
+        u32 idx=ent_idx(e);
         if(idx>=gen.size()) return false;
         return gen[idx]==ent_gen(e);
     }
     void destroy(Entity e){
-        u16 idx=ent_idx(e);
+        u32 idx=ent_idx(e);
         if(idx>=gen.size()) return;
         if(gen[idx]!=ent_gen(e)) return;
-        gen[idx]++; // bump generation
+        for(PoolBase* p: pools) p->remove_idx(idx);
+        gen[idx]=(gen[idx]+1) & ENT_GEN_MASK; // bump generation
+        if(!gen[idx]) gen[idx]=1;
         free_list.push_back(idx);
     }
+    void attach(PoolBase* p){ pools.push_back(p); }
 };
 
 // Components (kept clean for main.cpp)
-struct CTransform { v2 pos{0,0}; f32 rot=0; v2 scale{1,1}; };
+struct CTransform {
+    v2 pos{0,0}; f32 rot=0; v2 scale{1,1};
+    v2 prev_pos{0,0}; f32 prev_rot=0; bool has_prev=false; // state before the last sim step (snapshot_transforms)
+};
+
+// Render position/rotation between the previous and current sim step (App::alpha).
+static inline v2 interp_pos(const CTransform& t, f32 alpha){
+    return t.has_prev ? V2(t.prev_pos.x+(t.pos.x-t.prev_pos.x)*alpha, t.prev_pos.y+(t.pos.y-t.prev_pos.y)*alpha) : t.pos;
+}
+static inline f32 interp_rot(const CTransform& t, f32 alpha){
+    return t.has_prev ? t.prev_rot+(t.rot-t.prev_rot)*alpha : t.rot;
+}
 struct CVel      { v2 v{0,0}; };
 struct CCollider { v2 half{14,20}; bool on_ground=false; };
 struct CPlayer   { f32 move_speed=320.0f; f32 jump_speed=520.0f; };
 struct CSprite   { const Image* img=nullptr; int sx=0,sy=0,sw=0,sh=0; bool bilinear=true; bool blend=true; u32 tint=RGBA(255,255,255,255); };
 struct CLight    { int radius_tiles=10; u8 intensity=255; };
 
-// Sparse component storage (scary but efficient)
+// Sprite drawing one atlas rect (AtlasBuilder::add handle).
+static inline CSprite make_sprite(const Atlas& atlas,int handle){
+    CSprite s;
+    const AtlasRect& r=atlas.rect(handle);
+    if(r.w>0 && r.h>0){ s.img=&atlas.img; s.sx=r.x; s.sy=r.y; s.sw=r.w; s.sh=r.h; }
+    return s;
+}
+
+// Owning group (see ECS::group): the first len dense slots of every owned pool hold the
+// entities that have all owned components, in the same order.
+struct GroupBase {
+    const void* tag=nullptr; // identifies the component list
+    size_t len=0;
+    virtual ~GroupBase()=default;
+    virtual void on_add(u32 idx)=0;     // after idx gained an owned component
+    virtual void on_remove(u32 idx)=0;  // before idx loses one
+};
+
+// Sparse component storage (scary but efficient). The sparse side is paged: 4K-entity
+// pages are allocated the first time an index in them gets a component, so huge or
+// scattered indices cost nothing until used. Steady-state add/remove do not allocate.
+static constexpr u32 ECS_PAGE_BITS = 12;
+static constexpr u32 ECS_PAGE = 1u<<ECS_PAGE_BITS;
+
 template<typename T>
-struct Pool {
-    std::vector<u16> dense_idx; // dense -> entity idx
+struct Pool : PoolBase {
+    std::vector<u32> dense_idx; // dense -> entity idx
     std::vector<T>   dense_val;
-    std::vector<i32> sparse;    // entity idx -> dense index, -1 if none
+    std::vector<std::unique_ptr<i32[]>> pages; // entity idx -> dense index, -1 if none
+    GroupBase* owner=nullptr;   // owning group, if any
 
-    void ensure_sparse(size_t n){
-        if(sparse.size()<n) sparse.resize(n, -1);
+    i32 sparse_at(u32 idx) const {
+        size_t p=idx>>ECS_PAGE_BITS;
+        return p<pages.size() && pages[p] ? pages[p][idx&(ECS_PAGE-1)] : -1;
     }
-
-    bool has(Entity e) const {
-        u16 idx=ent_idx(e);
-        if(idx>=sparse.size()) return false;
-        int di=sparse[idx];
-        return di>=0 && di<(int)dense_idx.size() && dense_idx[(size_t)di]==idx;
+    i32& sparse_ref(u32 idx){ // idx's page must exist
+        return pages[idx>>ECS_PAGE_BITS][idx&(ECS_PAGE-1)];
+    }
+    void ensure_page(u32 idx){
+        size_t p=idx>>ECS_PAGE_BITS;
+        if(pages.size()<=p) pages.resize(p+1);
+        if(!pages[p]){
+            pages[p].reset(new i32[ECS_PAGE]);
+            std::fill(pages[p].get(), pages[p].get()+ECS_PAGE, -1);
+        }
     }
 
+    bool has(Entity e) const { return sparse_at(ent_idx(e))>=0; }
+
     T* get(Entity e){
-        u16 idx=ent_idx(e);
-        if(idx>=sparse.size()) return nullptr;
-        int di=sparse[idx];
-        if(di<0) return nullptr;
-        if(di>=(int)dense_idx.size()) return nullptr;
-        if(dense_idx[(size_t)di]!=idx) return nullptr;
-        return &dense_val[(size_t)di];
-    }
-
-    T& add(Entity e, const T& v=T{}){
-        ensure_sparse(ent_idx(e)+1);
-        u16 idx=ent_idx(e);
-        int di=sparse[idx];
-        if(di>=0 && (size_t)di<dense_idx.size() && dense_idx[(size_t)di]==idx){
-            dense_val[(size_t)di]=v;
+        i32 di=sparse_at(ent_idx(e));
+        return di>=0 ? &dense_val[(size_t)di] : nullptr;
+    }
+
+    T& add(Entity e, T v=T{}){
+        u32 idx=ent_idx(e);
+        ensure_page(idx);
+        i32 di=sparse_ref(idx);
+        if(di>=0){
+            dense_val[(size_t)di]=std::move(v);
             return dense_val[(size_t)di];
         }
-        sparse[idx]=(int)dense_idx.size();
+        sparse_ref(idx)=(i32)dense_idx.size();
         dense_idx.push_back(idx);
-        dense_val.push_back(v);
-        return dense_val.back();
+        dense_val.push_back(std::move(v));
+        if(owner) owner->on_add(idx);
+        return dense_val[(size_t)sparse_ref(idx)];
     }
 
-    void remove(Entity e){
-        u16 idx=ent_idx(e);
-        if(idx>=sparse.size()) return;
-        int di=sparse[idx];
-        if(di<0) return;
+    void remove(Entity e){ remove_idx(ent_idx(e)); }
+
+    void remove_idx(u32 idx) override {
+        if(sparse_at(idx)<0) return;
+        if(owner) owner->on_remove(idx);
+        size_t di=(size_t)sparse_ref(idx);
         size_t last=dense_idx.size()-1;
-        if((size_t)di!=last){
-            dense_idx[(size_t)di]=dense_idx[last];
-            dense_val[(size_t)di]=dense_val[last];
-            sparse[dense_idx[(size_t)di]]=(int)di;
+        if(di!=last){
+            dense_idx[di]=dense_idx[last];
+            dense_val[di]=std::move(dense_val[last]);
+            sparse_ref(dense_idx[di])=(i32)di;
         }
         dense_idx.pop_back();
         dense_val.pop_back();
-        sparse[idx]=-1;
+        sparse_ref(idx)=-1;
+    }
+
+    // by raw slot index (no generation check)
+    bool has_idx(u32 idx) const { return sparse_at(idx)>=0; }
+    T& at_idx(u32 idx){ return dense_val[(size_t)sparse_ref(idx)]; }
+
+    void swap_dense(size_t a,size_t b){
+        if(a==b) return;
+        std::swap(dense_idx[a], dense_idx[b]);
+        std::swap(dense_val[a], dense_val[b]);
+        sparse_ref(dense_idx[a])=(i32)a;
+        sparse_ref(dense_idx[b])=(i32)b;
     }
 
     // iterate: dense arrays
     size_t size() const { return dense_idx.size(); }
     Entity entity_at(size_t i, const Registry& r) const {
-        u16 idx=dense_idx[i];
+        u32 idx=dense_idx[i];
         return make_ent(idx, r.gen[idx]);
     }
     T& value_at(size_t i){ return dense_val[i]; }
     const T& value_at(size_t i) const { return dense_val[i]; }
 };
 
+template<typename... Ts> static const char ecs_group_tag=0;
+
+// f(e, comps...) if it takes the entity, else f(comps...)
+template<typename F, typename... A>
+static inline void ecs_invoke(F& f, Entity e, A&... a){
+    if constexpr(std::is_invocable_v<F&, Entity, A&...>) f(e, a...);
+    else f(a...);
+}
+
 struct ECS {
     Registry reg;
 
@@ -1511,8 +6012,334 @@ struct ECS {
     Pool<CPlayer>    player;
     Pool<CSprite>    spr;
     Pool<CLight>     light;
+
+    std::vector<std::unique_ptr<GroupBase>> groups;
+
+    // physics bodies are walked every frame: keep them packed
+    ECS(){
+        reg.attach(&tr); reg.attach(&vel); reg.attach(&col);
+        reg.attach(&player); reg.attach(&spr); reg.attach(&light);
+        group<CTransform,CVel,CCollider>();
+    }
+
+    // same as reg.destroy: strips every component, then frees the slot
+    void destroy(Entity e){ reg.destroy(e); }
+    ECS(const ECS&)=delete;
+    ECS& operator=(const ECS&)=delete;
+
+    template<typename T> Pool<T>& pool(){
+        if constexpr(std::is_same_v<T,CTransform>) return tr;
+        else if constexpr(std::is_same_v<T,CVel>) return vel;
+        else if constexpr(std::is_same_v<T,CCollider>) return col;
+        else if constexpr(std::is_same_v<T,CPlayer>) return player;
+        else if constexpr(std::is_same_v<T,CSprite>) return spr;
+        else { static_assert(std::is_same_v<T,CLight>, "ECS::pool: unknown component"); return light; }
+    }
+
+    template<typename... Ts>
+    struct Group : GroupBase {
+        ECS* ecs=nullptr;
+        bool in_all(u32 idx){ return (ecs->pool<Ts>().has_idx(idx) && ...); }
+        bool in_group(u32 idx){
+            using T0=std::tuple_element_t<0, std::tuple<Ts...>>;
+            return (size_t)ecs->pool<T0>().sparse_at(idx) < len;
+        }
+        void on_add(u32 idx) override {
+            if(!in_all(idx) || in_group(idx)) return;
+            (ecs->pool<Ts>().swap_dense((size_t)ecs->pool<Ts>().sparse_at(idx), len), ...);
+            len++;
+        }
+        void on_remove(u32 idx) override {
+            if(!in_all(idx) || !in_group(idx)) return;
+            len--;
+            (ecs->pool<Ts>().swap_dense((size_t)ecs->pool<Ts>().sparse_at(idx), len), ...);
+        }
+    };
+
+    // Owning group: Ts' pools keep their common entities packed at the front in the same
+    // order, so each<Ts...> becomes a linear walk. A pool can be owned by one group.
+    template<typename... Ts>
+    void group(){
+        static_assert(sizeof...(Ts)>=2, "ECS::group needs two or more components");
+        WE_ASSERT(((pool<Ts>().owner==nullptr) && ...));
+        auto g=std::make_unique<Group<Ts...>>();
+        g->ecs=this;
+        g->tag=&ecs_group_tag<Ts...>;
+        (void(pool<Ts>().owner=g.get()), ...);
+        using T0=std::tuple_element_t<0, std::tuple<Ts...>>;
+        for(size_t i=0;i<pool<T0>().size();i++) g->on_add(pool<T0>().dense_idx[i]); // existing entities
+        groups.push_back(std::move(g));
+    }
+
+    // f([Entity,] Ts&...) for every entity with all of Ts: a linear walk if an owning group
+    // matches Ts exactly, else the smallest pool drives and the others are looked up.
+    // Do not add/remove Ts components inside f.
+    template<typename... Ts, typename F>
+    void each(F&& f){ each_range<Ts...>(0, each_size<Ts...>(), f); }
+
+    // Slots each<Ts...> walks (group length, or the driving pool's size); each_range over
+    // disjoint [i0,i1) splits of it touches disjoint entities, so chunks can run in parallel.
+    template<typename... Ts>
+    size_t each_size(){
+        using T0=std::tuple_element_t<0, std::tuple<Ts...>>;
+        if constexpr(sizeof...(Ts)>1){
+            GroupBase* g=pool<T0>().owner;
+            if(g && g->tag==&ecs_group_tag<Ts...>) return g->len;
+        }
+        return std::min({pool<Ts>().size()...});
+    }
+
+    template<typename... Ts, typename F>
+    void each_range(size_t i0, size_t i1, F&& f){
+        std::tuple<Pool<Ts>*...> ps{&pool<Ts>()...};
+        using T0=std::tuple_element_t<0, std::tuple<Ts...>>;
+
+        if constexpr(sizeof...(Ts)>1){
+            GroupBase* g=pool<T0>().owner;
+            if(g && g->tag==&ecs_group_tag<Ts...>){
+                const std::vector<u32>& ids=pool<T0>().dense_idx;
+                for(size_t i=i0;i<i1;i++)
+                    ecs_invoke(f, make_ent(ids[i], reg.gen[ids[i]]), std::get<Pool<Ts>*>(ps)->dense_val[i]...);
+                return;
+            }
+        }
+
+        size_t best=std::min({pool<Ts>().size()...});
+        bool done=false;
+        auto drive=[&](auto* pd){
+            if(done || pd->size()!=best) return;
+            done=true;
+            for(size_t i=i0;i<i1;i++){
+                u32 idx=pd->dense_idx[i];
+                if(!(std::get<Pool<Ts>*>(ps)->has_idx(idx) && ...)) continue;
+                ecs_invoke(f, make_ent(idx, reg.gen[idx]), std::get<Pool<Ts>*>(ps)->at_idx(idx)...);
+            }
+        };
+        (drive(std::get<Pool<Ts>*>(ps)), ...);
+    }
+};
+
+// ============================================================
+// Spatial hash (uniform-grid broad phase over CTransform entities)
+// ============================================================
+// Rebuilt from the ECS once per tick (counting sort into hashed buckets, allocation-free
+// once warm). Each entity's bounds cover its collider, sprite and light reach, so the same
+// grid serves collision, area queries and view culling. Cells are cell_tiles tiles wide.
+struct SpatialHash {
+    struct Item {
+        Entity e=0;
+        f32 x0=0,y0=0,x1=0,y1=0;      // bounds
+        f32 cx0=0,cy0=0,cx1=0,cy1=0;  // collider box (solid only)
+        int gx0=0,gy0=0,gx1=0,gy1=0;  // covered cells
+        bool solid=false;
+    };
+    struct Ref { int gx, gy; u32 item; };
+
+    int cell_tiles=4;
+    f32 cell=128, inv_cell=1.0f/128;
+    std::vector<Item> items;
+    std::vector<Ref>  refs;        // grouped by bucket
+    std::vector<u32>  bucket;      // bucket b: refs[bucket[b]..bucket[b+1])
+    u32 mask=0;
+
+    u32 slot(int gx,int gy) const { return ((u32)gx*73856093u ^ (u32)gy*19349663u) & mask; }
+    int cell_of(f32 v) const { return (int)std::floor(v*inv_cell); }
+
+    void build(ECS& ecs, int tile_px){
+        cell=(f32)(std::max(cell_tiles,1)*tile_px);
+        inv_cell=1.0f/cell;
+        items.clear();
+        ecs.each<CTransform>([&](Entity e, CTransform& t){
+            Item it; it.e=e;
+            f32 hx=0, hy=0;
+            if(const CCollider* c=ecs.col.get(e)){
+                it.solid=true;
+                it.cx0=t.pos.x-c->half.x; it.cx1=t.pos.x+c->half.x;
+                it.cy0=t.pos.y-c->half.y; it.cy1=t.pos.y+c->half.y;
+                hx=c->half.x; hy=c->half.y;
+            }
+            if(const CSprite* s=ecs.spr.get(e); s && s->img){
+                hx=std::max(hx, 0.5f*(f32)(s->sw>0 ? s->sw : s->img->w));
+                hy=std::max(hy, 0.5f*(f32)(s->sh>0 ? s->sh : s->img->h));
+            }
+            if(const CLight* l=ecs.light.get(e)){
+                f32 r=(f32)((l->radius_tiles+1)*tile_px);
+                hx=std::max(hx,r); hy=std::max(hy,r);
+            }
+            it.x0=t.pos.x-hx; it.x1=t.pos.x+hx;
+            it.y0=t.pos.y-hy; it.y1=t.pos.y+hy;
+            items.push_back(it);
+        });
+        rebin();
+    }
+
+    // Recompute cells and buckets from items (after moving them).
+    void rebin(){
+        size_t total=0;
+        for(Item& it: items){
+            it.gx0=cell_of(it.x0); it.gx1=cell_of(it.x1);
+            it.gy0=cell_of(it.y0); it.gy1=cell_of(it.y1);
+            total+=(size_t)(it.gx1-it.gx0+1)*(size_t)(it.gy1-it.gy0+1);
+        }
+        size_t nb=256;
+        while(nb<total*2) nb<<=1;
+        mask=(u32)nb-1;
+        bucket.assign(nb+1, 0);
+        for(const Item& it: items)
+            for(int gy=it.gy0;gy<=it.gy1;gy++)
+                for(int gx=it.gx0;gx<=it.gx1;gx++) bucket[slot(gx,gy)+1]++;
+        for(size_t b=0;b<nb;b++) bucket[b+1]+=bucket[b];
+        refs.resize(total);
+        for(u32 i=0;i<(u32)items.size();i++){
+            const Item& it=items[i];
+            for(int gy=it.gy0;gy<=it.gy1;gy++)
+                for(int gx=it.gx0;gx<=it.gx1;gx++) refs[bucket[slot(gx,gy)]++]=Ref{gx,gy,i};
+        }
+        for(size_t b=nb;b>0;b--) bucket[b]=bucket[b-1]; // fill pass advanced the starts
+        bucket[0]=0;
+    }
+
+    // f(const Item&) once per item whose cells touch [gx0,gx1]x[gy0,gy1].
+    template<typename F>
+    void visit_cells(int gx0,int gy0,int gx1,int gy1, F&& f) const {
+        if((size_t)(gx1-gx0+1)*(size_t)(gy1-gy0+1) > items.size()){
+            for(const Item& it: items)
+                if(it.gx1>=gx0 && it.gx0<=gx1 && it.gy1>=gy0 && it.gy0<=gy1) f(it);
+            return;
+        }
+        for(int gy=gy0;gy<=gy1;gy++)
+            for(int gx=gx0;gx<=gx1;gx++){
+                u32 b=slot(gx,gy);
+                for(u32 r=bucket[b];r<bucket[b+1];r++){
+                    const Ref& rf=refs[r];
+                    if(rf.gx!=gx || rf.gy!=gy) continue;
+                    const Item& it=items[rf.item];
+                    // report once: in the first query cell the item covers
+                    if(gx!=std::max(it.gx0,gx0) || gy!=std::max(it.gy0,gy0)) continue;
+                    f(it);
+                }
+            }
+    }
+
+    // f(Entity) for entities whose bounds overlap the box (world px).
+    template<typename F>
+    void query_aabb(f32 x0,f32 y0,f32 x1,f32 y1, F&& f) const {
+        visit_cells(cell_of(x0),cell_of(y0),cell_of(x1),cell_of(y1), [&](const Item& it){
+            if(it.x1<x0 || it.x0>x1 || it.y1<y0 || it.y0>y1) return;
+            f(it.e);
+        });
+    }
+
+    // f(Entity) for entities whose bounds come within r of c.
+    template<typename F>
+    void query_radius(v2 c, f32 r, F&& f) const {
+        visit_cells(cell_of(c.x-r),cell_of(c.y-r),cell_of(c.x+r),cell_of(c.y+r), [&](const Item& it){
+            f32 dx=c.x-clampf(c.x,it.x0,it.x1), dy=c.y-clampf(c.y,it.y0,it.y1);
+            if(dx*dx+dy*dy>r*r) return;
+            f(it.e);
+        });
+    }
+
+    // Nearest collider hit along o + d*t, t in [0,max_t] (d need not be normalized).
+    bool raycast(v2 o, v2 d, f32 max_t, Entity& hit, f32& t_hit, Entity ignore=0) const {
+        auto slab=[&](const Item& it, f32& t)->bool{
+            f32 t0=0, t1=max_t;
+            const f32 lo[2]={it.cx0,it.cy0}, hi[2]={it.cx1,it.cy1}, p[2]={o.x,o.y}, v[2]={d.x,d.y};
+            for(int a=0;a<2;a++){
+                if(v[a]==0){ if(p[a]<lo[a] || p[a]>hi[a]) return false; continue; }
+                f32 inv=1.0f/v[a];
+                f32 ta=(lo[a]-p[a])*inv, tb=(hi[a]-p[a])*inv;
+                if(ta>tb) std::swap(ta,tb);
+                t0=std::max(t0,ta); t1=std::min(t1,tb);
+                if(t0>t1) return false;
+            }
+            t=t0; return true;
+        };
+
+        // grid DDA over the cells the ray crosses
+        int gx=cell_of(o.x), gy=cell_of(o.y);
+        int sx=d.x>0 ? 1 : -1, sy=d.y>0 ? 1 : -1;
+        f32 tdx = d.x!=0 ? std::fabs(cell/d.x) : 1e30f;
+        f32 tdy = d.y!=0 ? std::fabs(cell/d.y) : 1e30f;
+        f32 tx = d.x!=0 ? (((f32)(gx+(sx>0))*cell)-o.x)/d.x : 1e30f;
+        f32 ty = d.y!=0 ? (((f32)(gy+(sy>0))*cell)-o.y)/d.y : 1e30f;
+
+        bool found=false;
+        t_hit=max_t;
+        if(items.empty()) return false;
+        f32 t_cell=0;
+        for(int steps=0; steps<4096 && t_cell<=t_hit; steps++){
+            u32 b=slot(gx,gy);
+            for(u32 r=bucket[b]; r<bucket[b+1]; r++){
+                const Ref& rf=refs[r];
+                if(rf.gx!=gx || rf.gy!=gy) continue;
+                const Item& it=items[rf.item];
+                f32 t;
+                if(!it.solid || it.e==ignore || !slab(it,t) || t>=t_hit) continue;
+                t_hit=t; hit=it.e; found=true;
+            }
+            if(tx<ty){ t_cell=tx; tx+=tdx; gx+=sx; }
+            else     { t_cell=ty; ty+=tdy; gy+=sy; }
+        }
+        return found;
+    }
+
+    // Push overlapping colliders apart along the shallower axis (half each); the upper
+    // body of a vertical contact lands (on_ground). Bounds are not updated.
+    void resolve_entities(ECS& ecs){
+        size_t nb=bucket.empty() ? 0 : bucket.size()-1;
+        for(size_t b=0;b<nb;b++){
+            for(u32 r=bucket[b];r<bucket[b+1];r++){
+                const Ref& ra=refs[r];
+                Item& a=items[ra.item];
+                if(!a.solid) continue;
+                for(u32 q=r+1;q<bucket[b+1];q++){
+                    const Ref& rb=refs[q];
+                    Item& c=items[rb.item];
+                    if(!c.solid || rb.gx!=ra.gx || rb.gy!=ra.gy) continue;
+                    // each pair once: in the first cell both cover
+                    if(ra.gx!=std::max(a.gx0,c.gx0) || ra.gy!=std::max(a.gy0,c.gy0)) continue;
+                    separate(ecs, a, c);
+                }
+            }
+        }
+    }
+
+private:
+    static void separate(ECS& ecs, Item& a, Item& b){
+        f32 ox=std::min(a.cx1,b.cx1)-std::max(a.cx0,b.cx0);
+        f32 oy=std::min(a.cy1,b.cy1)-std::max(a.cy0,b.cy0);
+        if(ox<=0 || oy<=0) return;
+        CTransform* ta=ecs.tr.get(a.e); CTransform* tb=ecs.tr.get(b.e);
+        if(!ta || !tb) return;
+        CVel* va=ecs.vel.get(a.e); CVel* vb=ecs.vel.get(b.e);
+        if(ox<oy){
+            f32 s = (a.cx0+a.cx1 < b.cx0+b.cx1) ? -0.5f*ox : 0.5f*ox; // a moves left if it is left
+            ta->pos.x+=s; tb->pos.x-=s;
+            a.cx0+=s; a.cx1+=s; b.cx0-=s; b.cx1-=s;
+            if(va && va->v.x*s<0) va->v.x=0;
+            if(vb && vb->v.x*s>0) vb->v.x=0;
+        }else{
+            bool a_up = a.cy0+a.cy1 < b.cy0+b.cy1;
+            f32 s = a_up ? -0.5f*oy : 0.5f*oy;
+            ta->pos.y+=s; tb->pos.y-=s;
+            a.cy0+=s; a.cy1+=s; b.cy0-=s; b.cy1-=s;
+            if(va && va->v.y*s<0) va->v.y=0;
+            if(vb && vb->v.y*s>0) vb->v.y=0;
+            CCollider* up = ecs.col.get(a_up ? a.e : b.e);
+            if(up) up->on_ground=true;
+        }
+    }
 };
 
+// World-space box containing the camera view at any rotation, grown by pad px.
+static inline void cam_cull_box(const Camera2D& cam, f32 pad, f32& x0,f32& y0,f32& x1,f32& y1){
+    f32 invz = (cam.zoom!=0) ? 1.0f/cam.zoom : 1.0f;
+    f32 r = 0.5f*std::sqrt(cam.viewport.x*cam.viewport.x + cam.viewport.y*cam.viewport.y)*invz + pad;
+    x0=cam.pos.x-r; x1=cam.pos.x+r;
+    y0=cam.pos.y-r; y1=cam.pos.y+r;
+}
+
 // ============================================================
 // Tile physics (AABB vs solid tiles)
 // ============================================================
@@ -1532,176 +6359,454 @@ static inline bool aabb_overlaps_tile(v2 pos, v2 half, int tile_px, int tx,int t
     return !(x1<=t0 || x0>=t1 || y1<=s0 || y0>=s1);
 }
 
-static inline void resolve_axis_x(ECS& ecs, World& world, Entity e, f32 dt){
-    auto* t=ecs.tr.get(e);
-    auto* v=ecs.vel.get(e);
-    auto* c=ecs.col.get(e);
-    if(!t||!v||!c) return;
+// Swept per-axis moves: only the tile columns (rows) the leading edge crosses are tested,
+// nearest first, so the cost is O(edge length x tiles crossed) and nothing tunnels at any
+// speed. Tiles the box only touches (edges equal) do not count, matching the overlap test.
+static inline int tile_lo(f32 a, int tp){ return (int)std::floor(a/(f32)tp); }      // first tile touching [a,..)
+static inline int tile_hi(f32 b, int tp){ return (int)std::ceil(b/(f32)tp) - 1; }   // last tile touching (..,b]
 
-    t->pos.x += v->v.x * dt;
+static inline void resolve_axis_x(World& world, CTransform& tr, CVel& vel, CCollider& col, f32 dt){
+    f32 dx = vel.v.x * dt;
+    if(dx==0) return;
 
     int tp=world.tile_px;
-    int min_tx = floor_div_tile(t->pos.x - c->half.x, tp) - 1;
-    int max_tx = floor_div_tile(t->pos.x + c->half.x, tp) + 1;
-    int min_ty = floor_div_tile(t->pos.y - c->half.y, tp) - 1;
-    int max_ty = floor_div_tile(t->pos.y + c->half.y, tp) + 1;
-
-    for(int ty=min_ty; ty<=max_ty; ty++){
-        for(int tx=min_tx; tx<=max_tx; tx++){
-            u16 tile=world.get(tx,ty);
-            if(!world.solid(tile)) continue;
-            if(!aabb_overlaps_tile(t->pos,c->half,tp,tx,ty)) continue;
-
-            // push out along x
-            f32 tile_left  = (f32)(tx*tp);
-            f32 tile_right = tile_left + (f32)tp;
-            if(v->v.x > 0){
-                t->pos.x = tile_left - c->half.x;
-            }else if(v->v.x < 0){
-                t->pos.x = tile_right + c->half.x;
-            }
-            v->v.x = 0;
+    int ty0=tile_lo(tr.pos.y - col.half.y, tp);
+    int ty1=tile_hi(tr.pos.y + col.half.y, tp);
+
+    if(dx>0){
+        f32 edge=tr.pos.x + col.half.x;
+        int tx1=tile_hi(edge+dx, tp);
+        for(int tx=tile_lo(edge, tp); tx<=tx1; tx++){
+            if(!world.solid_col(tx, ty0, ty1)) continue;
+            tr.pos.x = (f32)(tx*tp) - col.half.x;
+            vel.v.x = 0;
+            return;
+        }
+    }else{
+        f32 edge=tr.pos.x - col.half.x;
+        int tx1=tile_lo(edge+dx, tp);
+        for(int tx=tile_hi(edge, tp); tx>=tx1; tx--){
+            if(!world.solid_col(tx, ty0, ty1)) continue;
+            tr.pos.x = (f32)((tx+1)*tp) + col.half.x;
+            vel.v.x = 0;
+            return;
         }
     }
+    tr.pos.x += dx;
 }
 
-static inline void resolve_axis_y(ECS& ecs, World& world, Entity e, f32 dt){
-    auto* t=ecs.tr.get(e);
-    auto* v=ecs.vel.get(e);
-    auto* c=ecs.col.get(e);
-    if(!t||!v||!c) return;
-
-    c->on_ground=false;
-    t->pos.y += v->v.y * dt;
+static inline void resolve_axis_y(World& world, CTransform& tr, CVel& vel, CCollider& col, f32 dt){
+    col.on_ground=false;
+    f32 dy = vel.v.y * dt;
+    if(dy==0) return;
 
     int tp=world.tile_px;
-    int min_tx = floor_div_tile(t->pos.x - c->half.x, tp) - 1;
-    int max_tx = floor_div_tile(t->pos.x + c->half.x, tp) + 1;
-    int min_ty = floor_div_tile(t->pos.y - c->half.y, tp) - 1;
-    int max_ty = floor_div_tile(t->pos.y + c->half.y, tp) + 1;
-
-    for(int ty=min_ty; ty<=max_ty; ty++){
-        for(int tx=min_tx; tx<=max_tx; tx++){
-            u16 tile=world.get(tx,ty);
-            if(!world.solid(tile)) continue;
-            if(!aabb_overlaps_tile(t->pos,c->half,tp,tx,ty)) continue;
-
-            f32 tile_top    = (f32)(ty*tp);
-            f32 tile_bottom = tile_top + (f32)tp;
-            if(v->v.y > 0){
-                // moving down
-                t->pos.y = tile_top - c->half.y;
-                c->on_ground=true;
-            }else if(v->v.y < 0){
-                // moving up
-                t->pos.y = tile_bottom + c->half.y;
-            }
-            v->v.y = 0;
+    int tx0=tile_lo(tr.pos.x - col.half.x, tp);
+    int tx1=tile_hi(tr.pos.x + col.half.x, tp);
+
+    if(dy>0){
+        // moving down
+        f32 edge=tr.pos.y + col.half.y;
+        int ty1=tile_hi(edge+dy, tp);
+        for(int ty=tile_lo(edge, tp); ty<=ty1; ty++){
+            if(!world.solid_row(ty, tx0, tx1)) continue;
+            tr.pos.y = (f32)(ty*tp) - col.half.y;
+            vel.v.y = 0;
+            col.on_ground=true;
+            return;
+        }
+    }else{
+        // moving up
+        f32 edge=tr.pos.y - col.half.y;
+        int ty1=tile_lo(edge+dy, tp);
+        for(int ty=tile_hi(edge, tp); ty>=ty1; ty--){
+            if(!world.solid_row(ty, tx0, tx1)) continue;
+            tr.pos.y = (f32)((ty+1)*tp) + col.half.y;
+            vel.v.y = 0;
+            return;
         }
     }
+    tr.pos.y += dy;
+}
+
+static inline void resolve_axis_x(ECS& ecs, World& world, Entity e, f32 dt){
+    auto* t=ecs.tr.get(e);
+    auto* v=ecs.vel.get(e);
+    auto* c=ecs.col.get(e);
+    if(t&&v&&c) resolve_axis_x(world,*t,*v,*c,dt);
+}
+static inline void resolve_axis_y(ECS& ecs, World& world, Entity e, f32 dt){
+    auto* t=ecs.tr.get(e);
+    auto* v=ecs.vel.get(e);
+    auto* c=ecs.col.get(e);
+    if(t&&v&&c) resolve_axis_y(world,*t,*v,*c,dt);
 }
 
 // Systems
 static inline void sys_player(ECS& ecs, const Input& in, f32 dt){
-    (void)dt;
-    for(size_t i=0;i<ecs.player.size();i++){
-        Entity e = ecs.player.entity_at(i, ecs.reg);
-        if(!ecs.reg.alive(e)) continue;
+    f32 ax=0;
+    if(in.key['A']) ax -= 1;
+    if(in.key['D']) ax += 1;
+    f32 k = 1.0f - std::exp(-18.0f*dt);
 
-        auto* pl=ecs.player.get(e);
-        auto* v =ecs.vel.get(e);
-        auto* c =ecs.col.get(e);
-        if(!pl||!v||!c) continue;
-
-        f32 ax=0;
-        if(in.key['A']) ax -= 1;
-        if(in.key['D']) ax += 1;
-
-        f32 speed=pl->move_speed;
+    ecs.each<CPlayer,CVel,CCollider>([&](CPlayer& pl, CVel& v, CCollider& c){
+        f32 speed=pl.move_speed;
         if(in.key[VK_SHIFT]) speed *= 1.6f;
 
         // "scary smoothing"
         f32 target = ax * speed;
-        v->v.x = lerp(v->v.x, target, 1.0f - std::exp(-18.0f*dt));
+        v.v.x = lerp(v.v.x, target, k);
 
         // jump
-        if(in.key_pressed[VK_SPACE] && c->on_ground){
-            v->v.y = -pl->jump_speed;
-            c->on_ground=false;
+        if(in.key_pressed[VK_SPACE] && c.on_ground){
+            v.v.y = -pl.jump_speed;
+            c.on_ground=false;
         }
-    }
+    });
 }
 
-static inline void sys_physics(ECS& ecs, World& world, f32 dt){
+// Start of a sim step: remember where everything was, for interpolated rendering.
+static inline void snapshot_transforms(ECS& ecs){
+    for(CTransform& t: ecs.tr.dense_val){ t.prev_pos=t.pos; t.prev_rot=t.rot; t.has_prev=true; }
+}
+
+static inline void apply_gravity(CVel& v, f32 dt){
     const f32 gravity = 1200.0f;
+    v.v.y += gravity * dt;
+    v.v.y = std::min(v.v.y, 3000.0f);
+}
 
+static inline void sys_physics(ECS& ecs, World& world, f32 dt){
+    WE_ZONE("sys_physics");
     // apply gravity
-    for(size_t i=0;i<ecs.vel.size();i++){
-        Entity e = ecs.vel.entity_at(i, ecs.reg);
-        if(!ecs.reg.alive(e)) continue;
-        auto* v=ecs.vel.get(e);
-        if(!v) continue;
-        v->v.y += gravity * dt;
-        v->v.y = std::min(v->v.y, 3000.0f);
-    }
+    for(CVel& v: ecs.vel.dense_val) apply_gravity(v, dt);
 
-    // resolve X then Y for entities with collider
-    for(size_t i=0;i<ecs.col.size();i++){
-        Entity e = ecs.col.entity_at(i, ecs.reg);
-        if(!ecs.reg.alive(e)) continue;
-        if(!ecs.tr.get(e) || !ecs.vel.get(e)) continue;
-        resolve_axis_x(ecs, world, e, dt);
-        resolve_axis_y(ecs, world, e, dt);
-    }
+    // resolve X then Y for entities with collider (owning group: linear walk)
+    ecs.each<CTransform,CVel,CCollider>([&](CTransform& t, CVel& v, CCollider& c){
+        resolve_axis_x(world, t, v, c, dt);
+        resolve_axis_y(world, t, v, c, dt);
+    });
 }
 
 static inline void sys_render_world(Canvas& c, World& world, const Camera2D& cam){
     world.draw(c, cam);
 }
 
-static inline void sys_render_sprites(Canvas& c, ECS& ecs, const Camera2D& cam){
-    m3 V=cam.view();
-    for(size_t i=0;i<ecs.spr.size();i++){
-        Entity e = ecs.spr.entity_at(i, ecs.reg);
-        if(!ecs.reg.alive(e)) continue;
-        auto* t=ecs.tr.get(e);
-        auto* s=ecs.spr.get(e);
-        if(!t||!s||!s->img||s->img->empty()) continue;
+// Visible entities from the hash, in dense order of pool p (keeps draw/gather order stable).
+template<typename T>
+static inline void cull_visible(const SpatialHash& hash, const Pool<T>& p, const Camera2D& cam, f32 pad,
+                                std::vector<u32>& out){
+    f32 x0,y0,x1,y1;
+    cam_cull_box(cam, pad, x0,y0,x1,y1);
+    out.clear();
+    hash.query_aabb(x0,y0,x1,y1, [&](Entity e){
+        i32 di=p.sparse_at(ent_idx(e));
+        if(di>=0) out.push_back((u32)di);
+    });
+    std::sort(out.begin(), out.end());
+}
+
+static inline void draw_sprite(Canvas& c, const m3& V, const Camera2D& cam, const CTransform& t, const CSprite& s, f32 alpha){
+    if(!s.img || s.img->empty()) return;
+
+    v2 sp = m3_mul_v2(V, interp_pos(t, alpha));
+    int dx=(int)std::floor(sp.x);
+    int dy=(int)std::floor(sp.y);
 
-        v2 sp = m3_mul_v2(V, t->pos);
-        int dx=(int)std::floor(sp.x);
-        int dy=(int)std::floor(sp.y);
+    // default sprite rect if not set
+    int sw = (s.sw>0)?s.sw:s.img->w;
+    int sh = (s.sh>0)?s.sh:s.img->h;
 
-        // default sprite rect if not set
-        int sw = (s->sw>0)?s->sw:s->img->w;
-        int sh = (s->sh>0)?s->sh:s->img->h;
+    int draw_w = (int)(sw * cam.zoom);
+    int draw_h = (int)(sh * cam.zoom);
 
-        int draw_w = (int)(sw * cam.zoom);
-        int draw_h = (int)(sh * cam.zoom);
+    blit(c, dx - draw_w/2, dy - draw_h/2, draw_w, draw_h,
+         *s.img, s.sx, s.sy, sw, sh,
+         s.blend, s.bilinear, s.tint);
+}
 
-        blit(c, dx - draw_w/2, dy - draw_h/2, draw_w, draw_h,
-             *s->img, s->sx, s->sy, sw, sh,
-             s->blend, s->bilinear, s->tint);
+// hash: draw only sprites whose bounds reach the view (built this tick).
+// alpha: interpolate between the last two sim steps (1 = current positions).
+static inline void sys_render_sprites(Canvas& c, ECS& ecs, const Camera2D& cam, const SpatialHash* hash=nullptr, f32 alpha=1.0f){
+    WE_ZONE("sys_render_sprites");
+    m3 V=cam.view();
+    if(!hash){
+        ecs.each<CTransform,CSprite>([&](CTransform& t, CSprite& s){ draw_sprite(c, V, cam, t, s, alpha); });
+        return;
     }
+    static thread_local std::vector<u32> vis;
+    cull_visible(*hash, ecs.spr, cam, 64.0f, vis); // pad: interpolated positions trail the hash by < 1 step
+    for(u32 di: vis){
+        u32 idx=ecs.spr.dense_idx[di];
+        if(ecs.tr.has_idx(idx)) draw_sprite(c, V, cam, ecs.tr.at_idx(idx), ecs.spr.dense_val[di], alpha);
+    }
+}
+
+static inline LightSource light_source(const CTransform& t, const CLight& l){
+    LightSource ls;
+    ls.pos_px = t.pos;
+    ls.radius_tiles = l.radius_tiles;
+    ls.intensity = l.intensity;
+    return ls;
 }
 
 static inline void gather_lights(ECS& ecs, std::vector<LightSource>& out){
     out.clear();
-    out.reserve(128);
+    ecs.each<CTransform,CLight>([&](CTransform& t, CLight& l){ out.push_back(light_source(t, l)); });
+}
+
+// Culled: only lights that can reach the LightMap window (view + 4 tiles; see LightMap::build).
+static inline void gather_lights(ECS& ecs, std::vector<LightSource>& out, const SpatialHash& hash,
+                                 const Camera2D& cam, int tile_px){
+    out.clear();
+    static thread_local std::vector<u32> vis;
+    cull_visible(hash, ecs.light, cam, (f32)(5*tile_px), vis);
+    for(u32 di: vis){
+        u32 idx=ecs.light.dense_idx[di];
+        if(ecs.tr.has_idx(idx)) out.push_back(light_source(ecs.tr.at_idx(idx), ecs.light.dense_val[di]));
+    }
+}
+
+// ============================================================
+// System scheduler (declared read/write sets, run on the job system)
+// ============================================================
+// Resources a system touches. Two systems conflict if one writes what the other reads
+// or writes; conflicting systems run in registration order, the rest concurrently.
+enum : u32 {
+    RES_TRANSFORM = 1u<<0,
+    RES_VEL       = 1u<<1,
+    RES_COLLIDER  = 1u<<2,
+    RES_PLAYER    = 1u<<3,
+    RES_SPRITE    = 1u<<4,
+    RES_LIGHT     = 1u<<5,
+    RES_ECS       = 0xFFu,  // every component
+    RES_ENTITIES  = 1u<<8,  // create/destroy/add/remove: writing it conflicts with all RES_ECS users
+    RES_WORLD     = 1u<<9,
+    RES_INPUT     = 1u<<10,
+    RES_LIGHTS    = 1u<<11, // gathered LightSource list
+    RES_PARTICLES = 1u<<12,
+    RES_SPATIAL   = 1u<<13, // SpatialHash
+    RES_USER      = 1u<<16, // first bit free for game resources
+};
+
+template<typename T> constexpr u32 ecs_res_of(){
+    if constexpr(std::is_same_v<T,CTransform>) return RES_TRANSFORM;
+    else if constexpr(std::is_same_v<T,CVel>) return RES_VEL;
+    else if constexpr(std::is_same_v<T,CCollider>) return RES_COLLIDER;
+    else if constexpr(std::is_same_v<T,CPlayer>) return RES_PLAYER;
+    else if constexpr(std::is_same_v<T,CSprite>) return RES_SPRITE;
+    else { static_assert(std::is_same_v<T,CLight>, "ecs_res: unknown component"); return RES_LIGHT; }
+}
+template<typename... Ts> constexpr u32 ecs_res(){ return (ecs_res_of<Ts>() | ... | 0u); }
+
+// Systems are registered once; run() builds the dependency graph from the enabled ones
+// each frame and executes it on the job system (blocking). A chunked system is split into
+// [i0,i1) ranges that run in parallel, so it must only touch the items of its range.
+struct Scheduler {
+    struct System {
+        const char* name="";
+        u32 reads=0, writes=0;
+        bool enabled=true;
+        std::function<void()> fn;                  // whole system, or chunked:
+        std::function<size_t()> count;             //   items this frame
+        std::function<void(size_t,size_t)> range;  //   f(i0,i1) over [0,count)
+        int grain=256;
+    };
+
+    std::vector<System> systems;
+
+    // per-run graph
+    std::vector<int> active, roots;
+    std::vector<std::vector<int>> succ;
+    std::unique_ptr<std::atomic<int>[]> waiting;
+    size_t waiting_cap=0;
+
+    // add* return the system's index: a System& would dangle once systems grows.
+    int add(const char* name, u32 reads, u32 writes, std::function<void()> fn){
+        System s; s.name=name; s.reads=reads; s.writes=writes; s.fn=std::move(fn);
+        systems.push_back(std::move(s));
+        return (int)systems.size()-1;
+    }
+    int add_chunked(const char* name, u32 reads, u32 writes, int grain,
+                    std::function<size_t()> count, std::function<void(size_t,size_t)> range){
+        System s; s.name=name; s.reads=reads; s.writes=writes; s.grain=grain;
+        s.count=std::move(count); s.range=std::move(range);
+        systems.push_back(std::move(s));
+        return (int)systems.size()-1;
+    }
+    // Chunked ecs.each<Ts...>(f); f runs concurrently on different entities.
+    template<typename... Ts, typename F>
+    int add_each(const char* name, ECS& ecs, u32 reads, u32 writes, int grain, F f){
+        return add_chunked(name, reads, writes, grain,
+            [&ecs]{ return ecs.each_size<Ts...>(); },
+            [&ecs,f](size_t i0,size_t i1){ ecs.each_range<Ts...>(i0, i1, f); });
+    }
+
+    System& system(int i){ return systems[(size_t)i]; }
+    System* find(const char* name){
+        for(auto& s: systems) if(std::strcmp(s.name,name)==0) return &s;
+        return nullptr;
+    }
+
+    static void expand(u32& r, u32& w){
+        if(w & RES_ENTITIES) w |= RES_ECS;
+        if((r|w) & RES_ECS) r |= RES_ENTITIES;
+    }
+    static bool conflict(const System& a, const System& b){
+        u32 ra=a.reads, wa=a.writes, rb=b.reads, wb=b.writes;
+        expand(ra,wa); expand(rb,wb);
+        return (wa & (rb|wb)) || (ra & wb);
+    }
+
+    void build(){
+        active.clear();
+        for(int i=0;i<(int)systems.size();i++) if(systems[(size_t)i].enabled) active.push_back(i);
+        size_t n=active.size();
+        succ.resize(n);
+        for(auto& v: succ) v.clear();
+        if(waiting_cap<n){ waiting.reset(new std::atomic<int>[n]); waiting_cap=n; }
+        for(size_t j=0;j<n;j++){
+            int deps=0;
+            for(size_t i=0;i<j;i++){
+                if(!conflict(systems[(size_t)active[i]], systems[(size_t)active[j]])) continue;
+                succ[i].push_back((int)j);
+                deps++;
+            }
+            waiting[j].store(deps);
+        }
+    }
 
-    for(size_t i=0;i<ecs.light.size();i++){
-        Entity e = ecs.light.entity_at(i, ecs.reg);
-        if(!ecs.reg.alive(e)) continue;
-        auto* t=ecs.tr.get(e);
-        auto* l=ecs.light.get(e);
-        if(!t||!l) continue;
+    // Runs every enabled system once; returns when all have finished.
+    void run(JobSystem& jobs){
+        build();
+        roots.clear();
+        for(size_t i=0;i<active.size();i++) if(waiting[i].load()==0) roots.push_back((int)i);
+        JobCounter done;
+        run_jobs=&jobs; run_done=&done;
+        for(int i: roots) launch(i); // collected first: launched jobs release others
+        jobs.wait(done);
+        run_jobs=nullptr; run_done=nullptr;
+    }
+
+private:
+    void exec(JobSystem& jobs, System& s){
+        WE_ZONE(s.name);
+        if(s.fn){ s.fn(); return; }
+        size_t n=s.count ? s.count() : 0;
+        jobs.parallel_range((int)n, s.grain, [&s](int i0,int i1){ s.range((size_t)i0, (size_t)i1); });
+    }
 
-        LightSource ls;
-        ls.pos_px = t->pos;
-        ls.radius_tiles = l->radius_tiles;
-        ls.intensity = l->intensity;
-        out.push_back(ls);
+    // Successors are queued before this job's counter drops, so done cannot hit 0 early.
+    // The job only captures [this,i]: small enough for std::function's inline storage.
+    JobSystem* run_jobs=nullptr;
+    JobCounter* run_done=nullptr;
+    void launch(int i){
+        run_jobs->submit([this,i]{
+            exec(*run_jobs, systems[(size_t)active[(size_t)i]]);
+            for(int s: succ[(size_t)i])
+                if(waiting[s].fetch_sub(1)==1) launch(s);
+        }, run_done);
     }
+};
+
+// Built-in systems for a Scheduler (in, dt and out are read/written on every run).
+// Register first when rendering interpolates (fixed-step sims).
+static inline int schedule_snapshot(Scheduler& sch, ECS& ecs){
+    return sch.add("snapshot", 0, RES_TRANSFORM, [&ecs]{ snapshot_transforms(ecs); });
+}
+
+static inline int schedule_player(Scheduler& sch, ECS& ecs, const Input& in, const f32& dt){
+    return sch.add("player", RES_INPUT|RES_PLAYER, RES_VEL|RES_COLLIDER,
+                   [&ecs,&in,&dt]{ sys_player(ecs, in, dt); });
+}
+
+// sys_physics as two chunked passes: gravity over every CVel, then tile collision per body.
+static inline void schedule_physics(Scheduler& sch, ECS& ecs, World& world, const f32& dt, int grain=256){
+    sch.add_chunked("gravity", 0, RES_VEL, grain*4,
+        [&ecs]{ return ecs.vel.size(); },
+        [&ecs,&dt](size_t i0,size_t i1){ for(size_t i=i0;i<i1;i++) apply_gravity(ecs.vel.dense_val[i], dt); });
+    sch.add_each<CTransform,CVel,CCollider>("physics", ecs, RES_WORLD, RES_TRANSFORM|RES_VEL|RES_COLLIDER, grain,
+        [&world,&dt](CTransform& t, CVel& v, CCollider& c){
+            resolve_axis_x(world, t, v, c, dt);
+            resolve_axis_y(world, t, v, c, dt);
+        });
+}
+
+static inline int schedule_gather_lights(Scheduler& sch, ECS& ecs, std::vector<LightSource>& out){
+    return sch.add("lights", RES_TRANSFORM|RES_LIGHT, RES_LIGHTS, [&ecs,&out]{ gather_lights(ecs, out); });
+}
+// Culled against cam through the hash (schedule_spatial_hash first).
+static inline int schedule_gather_lights(Scheduler& sch, ECS& ecs, std::vector<LightSource>& out,
+                                         const SpatialHash& hash, const Camera2D& cam, const World& world){
+    return sch.add("lights", RES_TRANSFORM|RES_LIGHT|RES_SPATIAL, RES_LIGHTS,
+                   [&ecs,&out,&hash,&cam,&world]{ gather_lights(ecs, out, hash, cam, world.tile_px); });
+}
+
+// Rebuild the hash; with collide, then push overlapping colliders apart.
+static inline int schedule_spatial_hash(Scheduler& sch, SpatialHash& hash, ECS& ecs,
+                                        const World& world, bool collide=false){
+    u32 writes = RES_SPATIAL | (collide ? RES_TRANSFORM|RES_VEL|RES_COLLIDER : 0u);
+    return sch.add("spatial", RES_TRANSFORM|RES_COLLIDER|RES_SPRITE|RES_LIGHT, writes,
+                   [&hash,&ecs,&world,collide]{
+                       hash.build(ecs, world.tile_px);
+                       if(collide) hash.resolve_entities(ecs);
+                   });
 }
 
 } // namespace we
+
+// ============================================================
+// Counting global operator new/delete (WE_ALLOC_HOOKS, one translation unit only)
+// ============================================================
+#if defined(WE_ALLOC_HOOKS)
+#if defined(__GNUC__)
+  #define WE_HOOK_NOINLINE __attribute__((noinline)) // keeps GCC's new/free pairing checks quiet
+#else
+  #define WE_HOOK_NOINLINE
+#endif
+static const bool we_alloc_hooked_ = (we::AllocCounters::hooked=true);
+
+static inline void* we_counted_alloc(std::size_t n, std::size_t align){
+    we::AllocCounters::count.fetch_add(1, std::memory_order_relaxed);
+    we::AllocCounters::bytes.fetch_add(n, std::memory_order_relaxed);
+    if(n==0) n=1;
+    if(align<=alignof(std::max_align_t)) return std::malloc(n);
+  #if defined(_WIN32)
+    return _aligned_malloc(n, align);
+  #else
+    return std::aligned_alloc(align, (n+align-1)/align*align);
+  #endif
+}
+static inline void we_counted_free(void* p, std::size_t align){
+    if(!p) return;
+    we::AllocCounters::frees.fetch_add(1, std::memory_order_relaxed);
+  #if defined(_WIN32)
+    if(align>alignof(std::max_align_t)){ _aligned_free(p); return; }
+  #else
+    (void)align;
+  #endif
+    std::free(p);
+}
+
+WE_HOOK_NOINLINE void* operator new(std::size_t n){
+    if(void* p=we_counted_alloc(n, 0)) return p;
+    throw std::bad_alloc();
+}
+WE_HOOK_NOINLINE void* operator new[](std::size_t n){ return operator new(n); }
+WE_HOOK_NOINLINE void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return we_counted_alloc(n, 0); }
+WE_HOOK_NOINLINE void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return we_counted_alloc(n, 0); }
+WE_HOOK_NOINLINE void* operator new(std::size_t n, std::align_val_t a){
+    if(void* p=we_counted_alloc(n, (std::size_t)a)) return p;
+    throw std::bad_alloc();
+}
+WE_HOOK_NOINLINE void* operator new[](std::size_t n, std::align_val_t a){ return operator new(n, a); }
+
+WE_HOOK_NOINLINE void operator delete(void* p) noexcept { we_counted_free(p, 0); }
+WE_HOOK_NOINLINE void operator delete[](void* p) noexcept { we_counted_free(p, 0); }
+WE_HOOK_NOINLINE void operator delete(void* p, std::size_t) noexcept { we_counted_free(p, 0); }
+WE_HOOK_NOINLINE void operator delete[](void* p, std::size_t) noexcept { we_counted_free(p, 0); }
+WE_HOOK_NOINLINE void operator delete(void* p, std::align_val_t a) noexcept { we_counted_free(p, (std::size_t)a); }
+WE_HOOK_NOINLINE void operator delete[](void* p, std::align_val_t a) noexcept { we_counted_free(p, (std::size_t)a); }
+WE_HOOK_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t a) noexcept { we_counted_free(p, (std::size_t)a); }
+WE_HOOK_NOINLINE void operator delete[](void* p, std::size_t, std::align_val_t a) noexcept { we_counted_free(p, (std::size_t)a); }
+#endif